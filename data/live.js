@@ -0,0 +1,62 @@
+/*
+	Live measurement data
+
+	Opens a websocket to /live and asks for an update every periodMs milliseconds. If websockets aren't available or the
+	connection drops, /measure.json is polled instead until the websocket can be opened again.
+	onData gets the same object as /measure.json returns: {measuredField, sensorReading, motorRPM}
+*/
+function openLiveData(periodMs, onData){
+	var socket = null;
+	var pollTimer = null;
+	var keepaliveTimer = null;
+	//the server closes the least recently active socket when it runs out of them, see LD_KEEPALIVE_MS
+	var keepaliveMs = 10000;
+
+	function poll(){
+		var xobj = new XMLHttpRequest();
+		xobj.overrideMimeType("application/json");
+		xobj.open('GET', '../measure.json', true);
+		xobj.onreadystatechange = function () {
+			if (xobj.readyState == 4 && xobj.status == "200") {
+				onData(JSON.parse(xobj.responseText));
+			}
+		};
+		xobj.send(null);
+	}
+
+	function startPolling(){
+		if(pollTimer == null){ pollTimer = setInterval(poll, Math.max(periodMs, 500)); }
+	}
+
+	function stopPolling(){
+		if(pollTimer != null){ clearInterval(pollTimer); }
+		pollTimer = null;
+	}
+
+	function connect(){
+		if(!("WebSocket" in window)){
+			startPolling();
+			return;
+		}
+
+		socket = new WebSocket("ws://" + window.location.host + "/live");
+		socket.onopen = function(){
+			stopPolling();
+			socket.send(String(periodMs));
+			keepaliveTimer = setInterval(function(){ socket.send(""); }, keepaliveMs);
+		};
+		socket.onmessage = function(event){
+			var update = JSON.parse(event.data);
+			onData({measuredField: update.f, sensorReading: update.r, motorRPM: update.n});
+		};
+		socket.onclose = function(){
+			if(keepaliveTimer != null){ clearInterval(keepaliveTimer); }
+			keepaliveTimer = null;
+			socket = null;
+			startPolling();
+			setTimeout(connect, 5000);
+		};
+	}
+
+	connect();
+}
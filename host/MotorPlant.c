@@ -0,0 +1,69 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "MotorPlant.h"
+
+#define MP_EDGES_PER_REV 2
+#define MP_EDGES_PER_PERIOD 4
+
+//roughly the motor and rotor of the current hardware, 50% duty is a bit above 3600 rpm with no controller
+void MP_defaultParams(MP_Params_t * params){
+    params->rpmPerDuty = 76.0f;
+    params->tau = 0.35f;
+    params->load = 80.0f;
+    params->ripple = 0.02f;
+    params->edgeJitter = 2e-6f;
+    params->timerHz = 40000000;
+}
+
+void MP_init(MP_Plant_t * plant, const MP_Params_t * params, uint32_t seed){
+    memset(plant, 0, sizeof(MP_Plant_t));
+    plant->params = *params;
+    plant->noise = seed ? seed : 1;
+}
+
+//xorshift32 and a sum of uniforms are plenty for edge jitter
+static float MP_gaussian(MP_Plant_t * plant){
+    float sum = 0.0f;
+    for(unsigned i = 0; i < 12; i++){
+        plant->noise ^= plant->noise << 13;
+        plant->noise ^= plant->noise >> 17;
+        plant->noise ^= plant->noise << 5;
+        sum += (float) plant->noise / 4294967296.0f;
+    }
+    return sum - 6.0f;
+}
+
+//advances the model by dt, returns 1 and the measured period if a period was completed during the step
+unsigned MP_step(MP_Plant_t * plant, float duty, double dt, uint64_t * periodTicks){
+    const MP_Params_t * p = &plant->params;
+    unsigned ret = 0;
+
+    float drive = p->rpmPerDuty * duty * (1.0f + p->ripple * sinf(2.0f * (float) M_PI * (float) plant->revolutions));
+    float target = drive - p->load;
+    if(target < 0.0f) target = 0.0f;
+    plant->rpm += (target - plant->rpm) * (float) (dt / p->tau);
+    if(plant->rpm < 0.0f) plant->rpm = 0.0f;
+
+    double lastRevolutions = plant->revolutions;
+    plant->revolutions += plant->rpm / 60.0 * dt;
+    plant->time += dt;
+
+    //at most one edge per step as long as dt is short compared to half a revolution
+    double edgeSpacing = 1.0 / MP_EDGES_PER_REV;
+    if(floor(plant->revolutions / edgeSpacing) > floor(lastRevolutions / edgeSpacing)){
+        double crossing = floor(plant->revolutions / edgeSpacing) * edgeSpacing;
+        double edgeTime = plant->time - dt * (plant->revolutions - crossing) / (plant->revolutions - lastRevolutions);
+        edgeTime += p->edgeJitter * MP_gaussian(plant);
+
+        if((plant->edges++ % MP_EDGES_PER_PERIOD) == 0){
+            if(plant->edges > 1){
+                *periodTicks = (uint64_t) ((edgeTime - plant->lastEdgeTime) * p->timerHz);
+                ret = 1;
+            }
+            plant->lastEdgeTime = edgeTime;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef MP_include
+#define MP_include
+#include <stdint.h>
+
+/*
+    Motor and rotor plant model for trying speed controller tunings on a host
+
+    The motor is a first order system, the rotor speed settles towards rpmPerDuty * duty - load with the mechanical time
+    constant tau. Cogging adds a torque ripple once per revolution. The interrupter is modelled like the real one: two edges
+    per revolution, a period is reported every four edges and is measured in timer ticks, so the controller sees the same
+    quantization and edge jitter as on the device.
+*/
+
+typedef struct{
+    float rpmPerDuty;           //no load speed per % duty
+    float tau;                  //mechanical time constant in s
+    float load;                 //speed lost to friction and air drag in rpm
+    float ripple;               //torque ripple as a fraction of the drive
+    float edgeJitter;           //rms timing noise of an interrupter edge in s
+    uint32_t timerHz;           //the period is counted in ticks of this timer
+} MP_Params_t;
+
+typedef struct{
+    MP_Params_t params;
+    double time;                //s
+    double revolutions;
+    float rpm;                  //true rotor speed
+    uint32_t edges;
+    double lastEdgeTime;        //measured time of the edge that started the current period
+    uint32_t noise;             //random generator state
+} MP_Plant_t;
+
+void MP_defaultParams(MP_Params_t * params);
+void MP_init(MP_Plant_t * plant, const MP_Params_t * params, uint32_t seed);
+unsigned MP_step(MP_Plant_t * plant, float duty, double dt, uint64_t * periodTicks);
+
+#endif
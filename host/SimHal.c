@@ -0,0 +1,104 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SimHal.h"
+
+#define SH_PI 3.14159265
+#define SH_EDGES_PER_REV 2
+#define SH_BOUNCE_TICKS 400         //10us between the edges of a bounce
+#define SH_ADC_MIN -4096
+#define SH_ADC_MAX 4095
+
+//3600 rpm, the fringing blanked by the default deadtime and a noisy but usable signal
+void SH_defaultConfig(SH_Config_t * config){
+    config->rpm = 3600.0f;
+    config->edgeJitter = 2e-6f;
+    config->bounceEvery = 50;
+    config->amplitude = 300.0f;
+    config->offset = -32.0f;
+    config->noise = 20.0f;
+    config->fringe = 0.08f;
+    config->convTicks = 480;
+}
+
+void SH_init(SH_Hal_t * sh, const SH_Config_t * config, uint32_t seed){
+    memset(sh, 0, sizeof(SH_Hal_t));
+    sh->config = *config;
+    sh->noise = seed ? seed : 1;
+    sh->segmentLen = (double) SH_TIMER_HZ * 60.0 / (config->rpm * SH_EDGES_PER_REV);
+    //the capture counter wraps after about 1000 segments, like it does every 54 s on the device
+    sh->edgePhase = 4294967296.0 / 2 - sh->segmentLen * 1000;
+    sh->nextEdge = (uint64_t) sh->edgePhase;
+    sh->level = 0;
+}
+
+//xorshift32 and a sum of uniforms, like the motor plant
+static double SH_gaussian(SH_Hal_t * sh){
+    double sum = 0.0;
+    for(unsigned i = 0; i < 12; i++){
+        sh->noise ^= sh->noise << 13;
+        sh->noise ^= sh->noise >> 17;
+        sh->noise ^= sh->noise << 5;
+        sum += (double) sh->noise / 4294967296.0;
+    }
+    return sum - 6.0;
+}
+
+static void SH_setEdge(SH_Edge_t * edge, uint64_t time, unsigned level){
+    edge->time = time;
+    edge->capture = (uint32_t) (time * (SH_CAPTURE_HZ / SH_TIMER_HZ));
+    edge->level = level;
+}
+
+/*
+    moves to the start of the next segment and writes the edges the capture unit saw into edges, at most three. The
+    first one is always the real edge, a bounce adds two more right after it
+*/
+uint32_t SH_nextSegment(SH_Hal_t * sh, SH_Edge_t * edges){
+    uint32_t count = 0;
+    sh->lastEdge = sh->nextEdge;
+    sh->level = !sh->level;
+    sh->segments++;
+    SH_setEdge(&edges[count++], sh->lastEdge, sh->level);
+    if(sh->config.bounceEvery != 0 && (sh->segments % sh->config.bounceEvery) == 0){
+        SH_setEdge(&edges[count++], sh->lastEdge + SH_BOUNCE_TICKS, !sh->level);
+        SH_setEdge(&edges[count++], sh->lastEdge + 2 * SH_BOUNCE_TICKS, sh->level);
+    }
+
+    sh->edgePhase += sh->segmentLen;
+    sh->nextEdge = (uint64_t) (sh->edgePhase + sh->config.edgeJitter * SH_TIMER_HZ * SH_gaussian(sh));
+    return count;
+}
+
+//signal at time t in ADC counts, a burst that runs over the end of the segment sees the next one
+static double SH_signal(const SH_Hal_t * sh, uint64_t t){
+    double length = (double) (sh->nextEdge - sh->lastEdge);
+    unsigned level = sh->level;
+    double distance;
+    if(t >= sh->nextEdge){
+        level = !level;
+        distance = (double) (t - sh->nextEdge) / length;
+    }else{
+        double sinceEdge = (double) (t - sh->lastEdge);
+        double untilEdge = (double) (sh->nextEdge - t);
+        distance = ((sinceEdge < untilEdge) ? sinceEdge : untilEdge) / length;
+    }
+
+    double shape = 1.0;
+    if(sh->config.fringe > 0.0f && distance < sh->config.fringe) shape = sin(SH_PI * 0.5 * distance / sh->config.fringe);
+    return level ? shape * sh->config.amplitude : -shape * sh->config.amplitude;
+}
+
+//count conversions of the current segment, the first one starts at start. Writes the 13 bit results the ADC transfers
+void SH_convert(SH_Hal_t * sh, uint64_t start, uint32_t count, uint32_t * raw){
+    uint64_t t = start + (sh->config.convTicks >> 1);
+    for(uint32_t i = 0; i < count; i++){
+        double value = sh->config.offset + SH_signal(sh, t) + sh->config.noise * SH_gaussian(sh);
+        long quantised = lround(value);
+        if(quantised < SH_ADC_MIN) quantised = SH_ADC_MIN;
+        if(quantised > SH_ADC_MAX) quantised = SH_ADC_MAX;
+        raw[i] = (uint32_t) quantised & 0x1fff;
+        t += sh->config.convTicks;
+    }
+}
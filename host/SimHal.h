@@ -0,0 +1,58 @@
+#ifndef SH_include
+#define SH_include
+#include <stdint.h>
+
+/*
+    Simulated field mill hardware for the host build
+
+    Stands in for the parts of the ESP32 the signal path sees: the ADC timer (timer group 0 counter 1, FM_TIMER_HZ), the
+    capture unit that timestamps the interrupter edges with the 32 bit counter at twice that rate, and the MCP3301. Time
+    only moves when the next edge or a conversion is asked for, so a run is deterministic for a seed and as fast as the
+    host allows.
+
+    Rotor: turns at a constant speed, every interrupter edge gets timing noise. Every Nth edge can bounce (two more edges
+    right after it) to keep the edge filter busy.
+
+    Field: the electrode gets +amplitude counts while exposed (rotorPos = 1) and -amplitude while covered. Fringing turns
+    the step at every edge into a quarter sine that reaches the plateau after fringe (part of the segment) from the edge.
+    Gaussian noise and the frontend offset are added and the result is quantised to the 13 bit transfer of the ADC, so it
+    goes through ADC_signExtend() like on the device.
+*/
+
+#define SH_TIMER_HZ 40000000        //FM_TIMER_HZ
+#define SH_CAPTURE_HZ 80000000      //APB clock of the capture unit
+
+typedef struct{
+    float rpm;
+    float edgeJitter;               //rms timing noise of an edge in s
+    uint32_t bounceEvery;           //edges between bounces, 0 for none
+    float amplitude;                //ADC counts on the plateaus
+    float offset;                   //ADC counts
+    float noise;                    //rms ADC counts
+    float fringe;                   //part of the segment from the edge until the plateau is reached
+    uint32_t convTicks;             //ADC timer ticks one conversion takes
+} SH_Config_t;
+
+typedef struct{
+    uint64_t time;                  //ADC timer
+    uint32_t capture;               //capture counter
+    unsigned level;                 //rotorPos after the edge
+} SH_Edge_t;
+
+typedef struct{
+    SH_Config_t config;
+    uint64_t lastEdge;              //true time of the edge that started the current segment
+    uint64_t nextEdge;              //true time of the edge that ends it
+    unsigned level;
+    uint32_t segments;
+    double segmentLen;              //nominal segment length in ticks
+    double edgePhase;               //nominal time of the next edge without jitter
+    uint32_t noise;                 //random generator state
+} SH_Hal_t;
+
+void SH_defaultConfig(SH_Config_t * config);
+void SH_init(SH_Hal_t * sh, const SH_Config_t * config, uint32_t seed);
+uint32_t SH_nextSegment(SH_Hal_t * sh, SH_Edge_t * edges);
+void SH_convert(SH_Hal_t * sh, uint64_t start, uint32_t count, uint32_t * raw);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+    Replays a recorded rotor edge trace through the edge filter
+
+        edge_replay <trace> [captureHz]
+
+    The trace has one edge per line: the 32 bit capture timestamp and the level after the edge (1 = rising), separated by
+    whitespace. Lines starting with # are skipped. Every completed period is printed with the speed it corresponds to,
+    followed by the number of rejected edges and restarts.
+
+    A trace can state what the filter has to make of it in a line
+
+        #expect periods=<n> rejected=<n> restarts=<n> rpm=<speed> tolerance=<percent>
+
+    every key is optional. With rpm every period has to be within tolerance percent (default 1) of that speed. If any
+    expectation isn't met the exit code is 1, so a trace with the faults seen on a mill (host/traces) works as a test.
+*/
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RotorEdge.h"
+
+#define REPLAY_REVS_PER_PERIOD 2
+
+typedef struct{
+    long periods;                       //-1 where nothing is expected
+    long rejected;
+    long restarts;
+    double rpm;                         //0 where nothing is expected
+    double tolerance;                   //percent
+} REPLAY_Expect_t;
+
+static void REPLAY_parseExpect(REPLAY_Expect_t * expect, char * line){
+    for(char * key = strtok(line + strlen("#expect"), " \t\r\n"); key != NULL; key = strtok(NULL, " \t\r\n")){
+        char * value = strchr(key, '=');
+        if(value == NULL) continue;
+        *value++ = 0;
+        if(strcmp(key, "periods") == 0) expect->periods = atol(value);
+        else if(strcmp(key, "rejected") == 0) expect->rejected = atol(value);
+        else if(strcmp(key, "restarts") == 0) expect->restarts = atol(value);
+        else if(strcmp(key, "rpm") == 0) expect->rpm = atof(value);
+        else if(strcmp(key, "tolerance") == 0) expect->tolerance = atof(value);
+        else fprintf(stderr, "unknown expectation %s\n", key);
+    }
+}
+
+static unsigned REPLAY_check(const char * what, long expected, uint32_t actual){
+    if(expected < 0 || expected == (long) actual) return 1;
+    printf("expected %ld %s, got %" PRIu32 "\n", expected, what, actual);
+    return 0;
+}
+
+int main(int argc, char ** argv){
+    if(argc < 2 || argc > 3){
+        fprintf(stderr, "usage: %s <trace> [captureHz]\n", argv[0]);
+        return 1;
+    }
+    double captureHz = (argc == 3) ? atof(argv[2]) : 80e6;
+
+    FILE * trace = fopen(argv[1], "r");
+    if(trace == NULL){
+        perror(argv[1]);
+        return 1;
+    }
+
+    RE_Filter_t re;
+    RE_init(&re);
+    REPLAY_Expect_t expect = {.periods = -1, .rejected = -1, .restarts = -1, .rpm = 0.0, .tolerance = 1.0};
+    unsigned ok = 1;
+
+    char line[128];
+    uint32_t edges = 0;
+    uint32_t periods = 0;
+    while(fgets(line, sizeof(line), trace) != NULL){
+        if(strncmp(line, "#expect", strlen("#expect")) == 0){
+            REPLAY_parseExpect(&expect, line);
+            continue;
+        }
+        uint32_t timestamp;
+        unsigned level;
+        if(line[0] == '#' || sscanf(line, "%" SCNu32 " %u", &timestamp, &level) != 2) continue;
+        edges++;
+
+        if(RE_addEdge(&re, timestamp, level) == RE_PERIOD){
+            periods++;
+            double rpm = REPLAY_REVS_PER_PERIOD * 60.0 * captureHz / re.period;
+            unsigned inRange = expect.rpm <= 0.0 || fabs(rpm - expect.rpm) <= expect.rpm * expect.tolerance / 100.0;
+            printf("%10" PRIu32 " %10" PRIu32 " ticks %9.2f rpm%s\n", timestamp, re.period, rpm, inRange ? "" : " out of range");
+            ok &= inRange;
+        }
+    }
+    fclose(trace);
+
+    printf("%" PRIu32 " edges, %" PRIu32 " periods, %" PRIu32 " rejected, %" PRIu32 " restarts\n", edges, periods, re.rejected, re.restarts);
+    ok &= REPLAY_check("periods", expect.periods, periods);
+    ok &= REPLAY_check("rejected edges", expect.rejected, re.rejected);
+    ok &= REPLAY_check("restarts", expect.restarts, re.restarts);
+    if(!ok) printf("FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/*
+    Measures the cost of output filter chains per reading
+
+        filter_bench [chain ...]
+
+    Without arguments a set of typical chains is measured. Every chain filters the same synthetic readings at 60 per
+    second (3600 rpm): a constant level with noise and occasional spikes. For each chain the time and, on x86, the TSC
+    cycles per reading going in are printed, together with the noise left on the output relative to the input.
+*/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+#include "FilterChain.h"
+
+#define BENCH_READINGS 2000000
+#define BENCH_RATE 60.0f
+#define BENCH_LEVEL 250.0f
+#define BENCH_NOISE 5.0f
+#define BENCH_SPIKE 400.0f
+#define BENCH_SPIKE_EVERY 97
+
+static const char * BENCH_defaultChains[] = {
+    "",
+    "avg:32",
+    "median:5",
+    "lowpass:1.5",
+    "median:5,avg:16",
+    "median:5,lowpass:1.5,decimate:4",
+    "median:9,avg:256,lowpass:2,decimate:8",
+};
+
+static float BENCH_gauss(){
+    float u = (rand() + 1.0f) / ((float) RAND_MAX + 2.0f);
+    float v = (rand() + 1.0f) / ((float) RAND_MAX + 2.0f);
+    return sqrtf(-2.0f * logf(u)) * cosf(6.2831853f * v);
+}
+
+static double BENCH_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BENCH_run(const char * description, const float * input, float inputSd){
+    static FC_Chain_t chain;
+    if(FC_configure(&chain, description, BENCH_RATE) < 0){
+        printf("%-40s invalid\n", description);
+        return;
+    }
+
+    //one pass to warm up the caches, the second one is measured
+    float sink = 0.0f;
+    for(uint32_t i = 0; i < BENCH_READINGS / 10; i++){
+        float value = input[i];
+        if(FC_process(&chain, &value)) sink += value;
+    }
+    FC_reset(&chain);
+
+    double sum = 0.0, sumSquares = 0.0;
+    uint32_t outputs = 0;
+    double start = BENCH_now();
+#ifdef BENCH_HAVE_TSC
+    uint64_t cycles = __rdtsc();
+#endif
+    for(uint32_t i = 0; i < BENCH_READINGS; i++){
+        float value = input[i];
+        if(!FC_process(&chain, &value)) continue;
+        sum += value;
+        sumSquares += (double) value * value;
+        outputs++;
+    }
+#ifdef BENCH_HAVE_TSC
+    cycles = __rdtsc() - cycles;
+#endif
+    double elapsed = BENCH_now() - start;
+
+    double mean = sum / outputs;
+    double sd = sqrt(sumSquares / outputs - mean * mean);
+#ifdef BENCH_HAVE_TSC
+    printf("%-40s %8.2f %10.2f %10u %10.3f\n", description[0] ? description : "(none)", elapsed * 1e9 / BENCH_READINGS, (double) cycles / BENCH_READINGS, outputs, sd / inputSd);
+#else
+    printf("%-40s %8.2f %10s %10u %10.3f\n", description[0] ? description : "(none)", elapsed * 1e9 / BENCH_READINGS, "-", outputs, sd / inputSd);
+#endif
+    if(sink == 12345.0f) printf("\n");
+}
+
+int main(int argc, char ** argv){
+    float * input = malloc(sizeof(float) * BENCH_READINGS);
+    if(input == NULL) return 1;
+
+    srand(1);
+    double sum = 0.0, sumSquares = 0.0;
+    for(uint32_t i = 0; i < BENCH_READINGS; i++){
+        input[i] = BENCH_LEVEL + BENCH_NOISE * BENCH_gauss();
+        if(rand() % BENCH_SPIKE_EVERY == 0) input[i] += BENCH_SPIKE;
+        sum += input[i];
+        sumSquares += (double) input[i] * input[i];
+    }
+    double mean = sum / BENCH_READINGS;
+    float inputSd = (float) sqrt(sumSquares / BENCH_READINGS - mean * mean);
+
+    printf("%u readings at %.0f/s, noise sd %.2f incl. spikes\n", BENCH_READINGS, BENCH_RATE, inputSd);
+    printf("%-40s %8s %10s %10s %10s\n", "chain", "ns/rd", "cycles/rd", "outputs", "rel. sd");
+    if(argc > 1){
+        for(int i = 1; i < argc; i++) BENCH_run(argv[i], input, inputSd);
+    }else{
+        for(uint32_t i = 0; i < sizeof(BENCH_defaultChains) / sizeof(BENCH_defaultChains[0]); i++) BENCH_run(BENCH_defaultChains[i], input, inputSd);
+    }
+    free(input);
+    return 0;
+}
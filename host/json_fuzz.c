@@ -0,0 +1,253 @@
+/*
+    Fuzz target for the streaming JSON tokenizer
+
+        json_fuzz [iterations [seed]]       mutates built in documents on its own
+        json_fuzz file...                   runs each file once, for AFL (json_fuzz @@) or to replay a crash
+
+    Built with -DJF_LIBFUZZER and -fsanitize=fuzzer only LLVMFuzzerTestOneInput() is compiled and libFuzzer brings its
+    own main.
+
+    Every input is tokenized twice: in one piece and split into random chunks of 1 to JF_MAX_CHUNK bytes, the split taken
+    from a hash of the input so a crash replays. Each chunk is copied into an allocation of its own size, so a sanitizer
+    catches any read past the end of a chunk, and freed after JT_feed() returns. Both runs end with JT_finish(). The
+    split run has to deliver the same tokens (type, depth, content, unescaped content) with the same result and error
+    position, except that a token longer than JT_MAX_TOKEN may fail with JT_ERR_TOKEN_TOO_LONG earlier once it is
+    split. Some inputs also abort from the callback after a number of tokens. A difference calls abort().
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "JsonTok.h"
+
+#define JF_MAX_CHUNK 64
+#define JF_MAX_INPUT 4096               //longer generated inputs are cut
+#define JF_ITERATIONS 200000
+
+typedef struct{
+    uint32_t * hashes;                  //hash of the token stream up to every token of the reference run
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t abortAt;                   //token the callback returns 1 at, 0 for none
+    unsigned reference;                 //1 while recording, 0 while comparing
+    const char * chunk;                 //the chunk JT_feed() currently works on
+    uint32_t chunkLength;
+    const JT_Parser_t * parser;
+    uint32_t hash;
+} JF_Run_t;
+
+#define JF_CHECK(condition) do{ if(!(condition)) JF_fail(#condition, __LINE__); }while(0)
+
+static void JF_fail(const char * what, int line){
+    fprintf(stderr, "json_fuzz line %d: %s\n", line, what);
+    abort();
+}
+
+static uint32_t JF_hash(uint32_t hash, const void * data, uint32_t length){
+    const uint8_t * bytes = data;
+    for(uint32_t i = 0; i < length; i++){
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t JF_random(uint32_t * state){
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int JF_token(void * ctx, const JT_Token_t * token){
+    JF_Run_t * run = ctx;
+
+    //the slice is inside the current chunk or the parser's buffer for split tokens
+    const char * chunkEnd = run->chunk + run->chunkLength;
+    const char * partial = run->parser->partial;
+    unsigned inChunk = token->start >= run->chunk && token->start + token->length <= chunkEnd;
+    unsigned inPartial = token->start >= partial && token->start + token->length <= partial + JT_MAX_TOKEN;
+    JF_CHECK(inChunk || inPartial || token->length == 0);
+    JF_CHECK(token->depth <= JT_MAX_DEPTH);
+
+    uint32_t fields[3] = {token->type, token->depth, token->escaped};
+    run->hash = JF_hash(run->hash, fields, sizeof(fields));
+    run->hash = JF_hash(run->hash, token->start, token->length);
+    if(token->escaped){
+        char decoded[JT_MAX_TOKEN + 1];
+        uint32_t length = JT_unescape(token->start, token->length, decoded, sizeof(decoded));
+        JF_CHECK(length < sizeof(decoded) && decoded[length] == 0);
+        run->hash = JF_hash(run->hash, decoded, length);
+    }
+
+    if(run->reference){
+        if(run->count == run->capacity){
+            run->capacity = run->capacity ? run->capacity * 2 : 256;
+            run->hashes = realloc(run->hashes, sizeof(uint32_t) * run->capacity);
+            JF_CHECK(run->hashes != NULL);
+        }
+        run->hashes[run->count] = run->hash;
+    }else{
+        JF_CHECK(run->count < run->capacity && run->hashes[run->count] == run->hash);
+    }
+    run->count++;
+    return run->abortAt != 0 && run->count == run->abortAt;
+}
+
+static JT_Result_t JF_feed(JF_Run_t * run, JT_Parser_t * parser, const uint8_t * data, uint32_t length){
+    char * chunk = malloc(length ? length : 1);
+    JF_CHECK(chunk != NULL);
+    memcpy(chunk, data, length);
+    run->chunk = chunk;
+    run->chunkLength = length;
+    JT_Result_t result = JT_feed(parser, chunk, length);
+    free(chunk);
+    return result;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size){
+    if(size > JF_MAX_INPUT) size = JF_MAX_INPUT;
+    uint32_t length = (uint32_t) size;
+    uint32_t random = JF_hash(2166136261u, data, length) | 1;
+    JF_Run_t run = {0};
+    if((JF_random(&random) & 7) == 0) run.abortAt = 1 + JF_random(&random) % 32;
+
+    //in one piece
+    JT_Parser_t parser;
+    JT_init(&parser, JF_token, &run);
+    run.parser = &parser;
+    run.reference = 1;
+    JT_Result_t whole = JF_feed(&run, &parser, data, length);
+    if(whole == JT_OK) whole = JT_finish(&parser);
+    uint32_t wholePosition = parser.position;
+    uint32_t wholeCount = run.count;
+    JF_CHECK(wholePosition <= length);
+    JF_CHECK(whole != JT_OK || wholePosition == length);
+
+    //in random chunks, JT_feed() keeps returning the first error once there is one
+    JT_init(&parser, JF_token, &run);
+    run.reference = 0;
+    run.count = 0;
+    run.hash = 0;
+    JT_Result_t split = JT_OK;
+    uint32_t offset = 0;
+    do{
+        uint32_t chunk = JF_random(&random) % (JF_MAX_CHUNK + 1);
+        if(chunk > length - offset) chunk = length - offset;
+        JT_Result_t result = JF_feed(&run, &parser, data + offset, chunk);
+        JF_CHECK(split == JT_OK || result == split);
+        split = result;
+        offset += chunk;
+    }while(offset < length);
+    if(split == JT_OK) split = JT_finish(&parser);
+    JF_CHECK(JT_finish(&parser) == split);
+
+    //a split token may get too long before the whole input notices, or notices at a different position
+    if(split == JT_ERR_TOKEN_TOO_LONG){
+        JF_CHECK(run.count <= wholeCount);
+    }else{
+        JF_CHECK(split == whole);
+        JF_CHECK(run.count == wholeCount);
+        JF_CHECK(parser.position == wholePosition);
+    }
+    JF_CHECK(JT_errorString(split) != NULL);
+
+    free(run.hashes);
+    return 0;
+}
+
+#ifndef JF_LIBFUZZER
+
+static const char * JF_seeds[] = {
+    "{\"FM_targetRPM\":\"3600\",\"FM_motorKp\":\"0.005\",\"FM_filterChain\":\"avg:32\",\"WIFI_clientEnabled\":\"false\"}",
+    "{\"FM_deadtime\":90,\"FM_autoDeadtime\":true,\"MQTT_topic\":\"mill\\/1\",\"x\":null}",
+    "[{\"sensorReading\":-2400,\"appliedField\":-10000},{\"sensorReading\":0,\"appliedField\":0.5e1},"
+        "{\"sensorReading\":2400,\"appliedField\":1E4}]",
+    "{\"s\":\"\\\"\\\\\\b\\f\\n\\r\\t\\u0041\\ud83d\\ude00\\udc00\"}",
+    "[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]",
+    "{\"a\":[1,-0,-0.5,1e-3,12345678901234567890,true,false,null,\"\",{}],\"b\":{\"c\":[]}}",
+};
+
+//one of the ways libFuzzer and AFL change an input
+static uint32_t JF_mutate(uint8_t * data, uint32_t length, uint32_t * random){
+    static const char interesting[] = "{}[]:,\"\\ue-+.0123456789truefalsenull \t\n";
+    uint32_t position = length ? JF_random(random) % length : 0;
+    switch(JF_random(random) % 6){
+        case 0:
+            if(length) data[position] ^= 1 << (JF_random(random) & 7);
+            break;
+        case 1:
+            if(length) data[position] = interesting[JF_random(random) % (sizeof(interesting) - 1)];
+            break;
+        case 2:
+            if(length) data[position] = (uint8_t) JF_random(random);
+            break;
+        case 3:
+            if(length < JF_MAX_INPUT){
+                memmove(data + position + 1, data + position, length - position);
+                data[position] = interesting[JF_random(random) % (sizeof(interesting) - 1)];
+                length++;
+            }
+            break;
+        case 4:
+            if(length){
+                uint32_t count = 1 + JF_random(random) % 8;
+                if(count > length - position) count = length - position;
+                memmove(data + position, data + position + count, length - position - count);
+                length -= count;
+            }
+            break;
+        case 5:{
+            //repeat a part, grows tokens past JT_MAX_TOKEN and nesting past JT_MAX_DEPTH
+            uint32_t count = 1 + JF_random(random) % 16;
+            if(count > length - position) count = length - position;
+            uint32_t times = 1 + JF_random(random) % 32;
+            for(uint32_t i = 0; i < times && length + count <= JF_MAX_INPUT; i++){
+                memmove(data + position + count, data + position, length - position);
+                length += count;
+            }
+            break;
+        }
+    }
+    return length;
+}
+
+static int JF_runFile(const char * path){
+    FILE * file = fopen(path, "rb");
+    if(file == NULL){
+        perror(path);
+        return 1;
+    }
+    static uint8_t data[JF_MAX_INPUT];
+    uint32_t length = (uint32_t) fread(data, 1, sizeof(data), file);
+    fclose(file);
+    LLVMFuzzerTestOneInput(data, length);
+    return 0;
+}
+
+int main(int argc, char ** argv){
+    if(argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9')){
+        int ret = 0;
+        for(int i = 1; i < argc; i++) ret |= JF_runFile(argv[i]);
+        return ret;
+    }
+    uint32_t iterations = (argc > 1) ? (uint32_t) atoi(argv[1]) : JF_ITERATIONS;
+    uint32_t random = (argc > 2) ? (uint32_t) atoi(argv[2]) : 1;
+    if(random == 0) random = 1;
+
+    static uint8_t data[JF_MAX_INPUT];
+    uint32_t seeds = sizeof(JF_seeds) / sizeof(JF_seeds[0]);
+    for(uint32_t i = 0; i < iterations; i++){
+        const char * seed = JF_seeds[i % seeds];
+        uint32_t length = (uint32_t) strlen(seed);
+        memcpy(data, seed, length);
+        uint32_t mutations = (i < seeds) ? 0 : 1 + JF_random(&random) % 8;
+        for(uint32_t m = 0; m < mutations; m++) length = JF_mutate(data, length, &random);
+        LLVMFuzzerTestOneInput(data, length);
+    }
+    printf("%u inputs, no difference between whole and split input\n", iterations);
+    return 0;
+}
+
+#endif
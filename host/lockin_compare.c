@@ -0,0 +1,127 @@
+/*
+    Compares the lock-in demodulator with the sign-flip average it replaced
+
+        lockin_compare [samplesPerSegment [noise [offset]]]
+
+    A synthetic rotor signal is fed through both: every segment gets a number of samples of +-amplitude plus the frontend
+    offset and gaussian noise. Like the free running ADC of the old firmware the number of samples varies from segment
+    to segment. After LC_STEP_TIME the amplitude steps from LC_LEVEL_LOW to LC_LEVEL_HIGH.
+
+    Both outputs are looked at once per revolution:
+
+        sign-flip   the old FM_currAVG, an exponential average over 10000 samples of value * (rotorPos ? 1 : -1)
+        lock-in     LI_Demodulator_t.inPhase of every revolution
+        lock-in avg LI_Demodulator_t.average over FM_CONF_LOCKIN_CYCLES revolutions
+
+    For each the response time to the step (until the output first gets to LC_RISE of the step, a noisy output would never
+    stay inside a narrow band), the standard deviation and the bias from the true amplitude in the last LC_STEADY_TIME
+    seconds are printed.
+*/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LockIn.h"
+
+#define LC_RPM 3600.0f
+#define LC_LOCKIN_CYCLES 32             //FM_CONF_LOCKIN_CYCLES
+#define LC_EMA_SAMPLES 10000.0f         //the old sign-flip average
+#define LC_LEVEL_LOW 100.0f
+#define LC_LEVEL_HIGH 300.0f
+#define LC_STEP_TIME 20.0f              //s
+#define LC_DURATION 60.0f               //s
+#define LC_STEADY_TIME 20.0f            //s at the end the noise and bias are measured over
+#define LC_RISE 0.9f
+
+typedef enum{
+    LC_SIGN_FLIP,
+    LC_LOCKIN,
+    LC_LOCKIN_AVERAGE,
+    LC_OUTPUTS
+} LC_Output_t;
+
+static const char * LC_names[LC_OUTPUTS] = {"sign-flip", "lock-in", "lock-in avg"};
+
+typedef struct{
+    float response;                     //s from the step until the output got to LC_RISE of it, < 0 until then
+    double sum;
+    double sumSquares;
+    uint32_t count;
+} LC_Stats_t;
+
+static uint32_t LC_noise = 1;
+
+//xorshift32 and a sum of uniforms, like the motor plant
+static float LC_gaussian(){
+    float sum = 0.0f;
+    for(unsigned i = 0; i < 12; i++){
+        LC_noise ^= LC_noise << 13;
+        LC_noise ^= LC_noise >> 17;
+        LC_noise ^= LC_noise << 5;
+        sum += (float) LC_noise / 4294967296.0f;
+    }
+    return sum - 6.0f;
+}
+
+static void LC_evaluate(LC_Stats_t * stats, float time, float value){
+    float threshold = LC_LEVEL_LOW + LC_RISE * (LC_LEVEL_HIGH - LC_LEVEL_LOW);
+    if(time >= LC_STEP_TIME && stats->response < 0.0f && value >= threshold) stats->response = time - LC_STEP_TIME;
+    if(time >= LC_DURATION - LC_STEADY_TIME){
+        stats->sum += value;
+        stats->sumSquares += (double) value * value;
+        stats->count++;
+    }
+}
+
+int main(int argc, char ** argv){
+    uint32_t samplesPerSegment = (argc > 1) ? (uint32_t) atoi(argv[1]) : 64;
+    float noise = (argc > 2) ? (float) atof(argv[2]) : 20.0f;
+    float offset = (argc > 3) ? (float) atof(argv[3]) : -32.0f;
+    if(samplesPerSegment < 4){
+        fprintf(stderr, "usage: %s [samplesPerSegment [noise [offset]]]\n", argv[0]);
+        return 1;
+    }
+
+    LI_Demodulator_t li;
+    LI_init(&li, LC_LOCKIN_CYCLES);
+    float ema = 0.0f;
+    LC_Stats_t stats[LC_OUTPUTS] = {{0}};
+    for(uint32_t i = 0; i < LC_OUTPUTS; i++) stats[i].response = -1.0f;
+
+    float segmentTime = 60.0f / (LC_RPM * 2);
+    uint32_t segments = (uint32_t) (LC_DURATION / segmentTime);
+    for(uint32_t s = 0; s < segments; s++){
+        float time = s * segmentTime;
+        float amplitude = (time < LC_STEP_TIME) ? LC_LEVEL_LOW : LC_LEVEL_HIGH;
+        unsigned rotorPos = (s & 1) ? 0 : 1;
+        //between 3/4 and all of the samples, depending on where the free running conversions fell
+        uint32_t count = samplesPerSegment - (LC_noise % (samplesPerSegment / 4 + 1));
+
+        for(uint32_t i = 0; i < count; i++){
+            float value = offset + (rotorPos ? amplitude : -amplitude) + noise * LC_gaussian();
+            int32_t sample = (int32_t) lroundf(value);
+            ema = (ema * (LC_EMA_SAMPLES - 1.0f) + (float) (rotorPos ? sample : -sample)) / LC_EMA_SAMPLES;
+            if(!LI_addSample(&li, sample, rotorPos)) continue;
+
+            LC_evaluate(&stats[LC_SIGN_FLIP], time, ema);
+            LC_evaluate(&stats[LC_LOCKIN], time, li.inPhase);
+            LC_evaluate(&stats[LC_LOCKIN_AVERAGE], time, li.average);
+        }
+    }
+
+    printf("%u samples per segment at %.0f rpm, noise sd %.1f, offset %.1f, step %.0f -> %.0f at %.0f s\n",
+        samplesPerSegment, LC_RPM, noise, offset, LC_LEVEL_LOW, LC_LEVEL_HIGH, LC_STEP_TIME);
+    printf("%-12s %12s %10s %10s\n", "output", "response s", "sd", "bias");
+    for(uint32_t i = 0; i < LC_OUTPUTS; i++){
+        LC_Stats_t * s = &stats[i];
+        double mean = s->sum / s->count;
+        double sd = sqrt(s->sumSquares / s->count - mean * mean);
+        if(s->response < 0.0f){
+            printf("%-12s %12s %10.3f %+10.3f\n", LC_names[i], "never", sd, mean - LC_LEVEL_HIGH);
+        }else{
+            printf("%-12s %12.3f %10.3f %+10.3f\n", LC_names[i], s->response, sd, mean - LC_LEVEL_HIGH);
+        }
+    }
+    return 0;
+}
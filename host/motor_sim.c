@@ -0,0 +1,118 @@
+/*
+    Runs the rotor speed controller against the plant model and reports settling time, overshoot and speed jitter
+
+        motor_sim [kp ki kd feedForward slewRate integralBand]
+
+    Without arguments the firmware defaults are used. The scenario starts the motor from standstill, changes the target
+    speed and then adds a load step, each phase is evaluated separately.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "MotorCtrl.h"
+#include "MotorPlant.h"
+
+#define SIM_DT 20e-6                //plant integration step in s
+#define SIM_TIMEOUT 1.0             //s without a period until the firmware restarts the controller
+#define SIM_BAND 10.0f              //rpm, settled once the error stays inside
+#define SIM_JITTER_WINDOW 2.0       //s at the end of each phase the jitter is measured over
+
+typedef struct{
+    const char * name;
+    double duration;
+    float target;
+    float extraLoad;
+} SIM_Phase_t;
+
+static const SIM_Phase_t SIM_phases[] = {
+    {"startup",     8.0, 3600.0f,   0.0f},
+    {"target step", 6.0, 3300.0f,   0.0f},
+    {"load step",   6.0, 3300.0f, 150.0f},
+};
+
+int main(int argc, char ** argv){
+    //same defaults as the FM_motor* settings
+    MC_Tuning_t tuning = {
+        .kp = 0.005f,
+        .ki = 0.04f,
+        .kd = 0.0f,
+        .feedForward = 0.0139f,
+        .slewRate = 50.0f,
+        .integralBand = 150.0f,
+        .outMin = 0.0f,
+        .outMax = 100.0f
+    };
+    if(argc == 7){
+        tuning.kp = atof(argv[1]);
+        tuning.ki = atof(argv[2]);
+        tuning.kd = atof(argv[3]);
+        tuning.feedForward = atof(argv[4]);
+        tuning.slewRate = atof(argv[5]);
+        tuning.integralBand = atof(argv[6]);
+    }else if(argc != 1){
+        fprintf(stderr, "usage: %s [kp ki kd feedForward slewRate integralBand]\n", argv[0]);
+        return 1;
+    }
+
+    MP_Params_t params;
+    MP_defaultParams(&params);
+    float baseLoad = params.load;
+    MP_Plant_t plant;
+    MP_init(&plant, &params, 12345);
+
+    MC_Controller_t mc;
+    MC_init(&mc, &tuning);
+    MC_reset(&mc, SIM_phases[0].target);
+
+    printf("kp %g  ki %g  kd %g  feed forward %g  slew %g %%/s  integral band %g rpm\n", tuning.kp, tuning.ki, tuning.kd, tuning.feedForward, tuning.slewRate, tuning.integralBand);
+    printf("%-12s %10s %10s %12s %12s %10s\n", "phase", "settle s", "overshoot", "jitter rpm", "max err rpm", "updates");
+
+    float duty = mc.output;
+    double lastPeriodTime = 0.0;
+    for(unsigned i = 0; i < sizeof(SIM_phases) / sizeof(SIM_phases[0]); i++){
+        const SIM_Phase_t * phase = &SIM_phases[i];
+        plant.params.load = baseLoad + phase->extraLoad;
+        float startError = phase->target - plant.rpm;
+
+        double start = plant.time;
+        double settled = -1.0;
+        float overshoot = 0.0f;
+        double sumSquares = 0.0;
+        float maxError = 0.0f;
+        uint32_t jitterSamples = 0;
+        uint32_t updates = 0;
+
+        while(plant.time - start < phase->duration){
+            uint64_t ticks;
+            if(MP_step(&plant, duty, SIM_DT, &ticks)){
+                float rpm = 120.0f * params.timerHz / (float) ticks;
+                duty = MC_update(&mc, phase->target, rpm, (float) ticks / params.timerHz);
+                lastPeriodTime = plant.time;
+                updates++;
+            }else if(plant.time - lastPeriodTime > SIM_TIMEOUT){
+                MC_reset(&mc, phase->target);
+                duty = mc.output;
+                lastPeriodTime = plant.time;
+            }
+
+            float error = phase->target - plant.rpm;
+            if(fabsf(error) > SIM_BAND) settled = -1.0;
+            else if(settled < 0.0) settled = plant.time - start;
+
+            //overshoot is error past the target in the direction of the step, without a step it's the largest deviation
+            float past = (startError > SIM_BAND) ? -error : (startError < -SIM_BAND) ? error : fabsf(error);
+            if(past > overshoot) overshoot = past;
+
+            if(phase->duration - (plant.time - start) < SIM_JITTER_WINDOW){
+                sumSquares += (double) error * error;
+                if(fabsf(error) > maxError) maxError = fabsf(error);
+                jitterSamples++;
+            }
+        }
+
+        if(settled >= 0.0) printf("%-12s %10.2f %10.1f %12.2f %12.2f %10u\n", phase->name, settled, overshoot, sqrt(sumSquares / jitterSamples), maxError, updates);
+        else printf("%-12s %10s %10.1f %12.2f %12.2f %10u\n", phase->name, "never", overshoot, sqrt(sumSquares / jitterSamples), maxError, updates);
+    }
+    return 0;
+}
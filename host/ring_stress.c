@@ -0,0 +1,139 @@
+/*
+    Stress test of the lock-free sample ring with one producer and one consumer thread
+
+        ring_stress [blocks]
+
+    The producer writes blocks of 1 to RS_MAX_BLOCK numbered elements, like the ADC task writes its bursts, the consumer
+    takes them out with SR_peek()/SR_consume() and SR_read() in turns, like the value task. Both yield at random so the
+    ring runs full and empty over and over. The consumer checks that
+
+    - every element arrives intact (the check word matches the sequence number), so no element is read before it is
+      completely written or overwritten while it is read
+    - the sequence numbers only go up, the gaps are exactly the elements the producer was told didn't fit
+    - received + overruns is the number of elements that were produced
+
+    and the program exits with 1 if anything doesn't add up. Built with -fsanitize=thread as well if the compiler supports
+    it, which also catches a missing acquire/release.
+*/
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "SampleRing.h"
+
+#define RS_DEPTH 512                    //ADC_RING_DEPTH
+#define RS_MAX_BLOCK 64                 //ADC_BURST_LEN
+#define RS_READ_MAX 48                  //elements per SR_read(), smaller than a block so reads split them
+#define RS_BLOCKS 2000000
+
+typedef struct{
+    uint32_t seq;
+    uint32_t check;                     //~seq
+    uint64_t pad;                       //the size of an ADC sample
+} RS_Elem_t;
+
+static SR_Ring_t RS_ring;
+static RS_Elem_t RS_buffer[RS_DEPTH];
+static uint32_t RS_blocks = RS_BLOCKS;
+static atomic_uint RS_done;
+static uint64_t RS_produced;
+static uint64_t RS_notWritten;          //what SR_write() reported as not written
+
+static uint32_t RS_random(uint32_t * state){
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void * RS_producer(void * arg){
+    (void) arg;
+    uint32_t random = 1;
+    uint32_t seq = 0;
+    RS_Elem_t block[RS_MAX_BLOCK];
+    for(uint32_t b = 0; b < RS_blocks; b++){
+        uint32_t count = 1 + RS_random(&random) % RS_MAX_BLOCK;
+        for(uint32_t i = 0; i < count; i++){
+            block[i].seq = seq + i;
+            block[i].check = ~(seq + i);
+        }
+        uint32_t written = SR_write(&RS_ring, block, count);
+        RS_notWritten += count - written;
+        RS_produced += count;
+        seq += count;
+        if((RS_random(&random) & 7) == 0) sched_yield();
+    }
+    atomic_store_explicit(&RS_done, 1, memory_order_release);
+    return NULL;
+}
+
+typedef struct{
+    uint64_t received;
+    uint64_t gaps;                      //elements missing between the ones received
+    uint64_t errors;
+    uint32_t next;                      //sequence number expected next
+} RS_Check_t;
+
+static void RS_check(RS_Check_t * check, const RS_Elem_t * elems, uint32_t count){
+    for(uint32_t i = 0; i < count; i++){
+        const RS_Elem_t * elem = &elems[i];
+        if(elem->check != ~elem->seq || elem->seq < check->next){
+            if(check->errors++ < 10) fprintf(stderr, "element %u (check %08x) after %u\n", elem->seq, elem->check, check->next);
+            continue;
+        }
+        check->gaps += elem->seq - check->next;
+        check->next = elem->seq + 1;
+        check->received++;
+    }
+}
+
+static void * RS_consumer(void * arg){
+    RS_Check_t * check = arg;
+    uint32_t random = 7;
+    RS_Elem_t copy[RS_READ_MAX];
+    while(1){
+        unsigned done = atomic_load_explicit(&RS_done, memory_order_acquire);
+        uint32_t count;
+        if(RS_random(&random) & 1){
+            void * elems;
+            count = SR_peek(&RS_ring, &elems);
+            RS_check(check, elems, count);
+            SR_consume(&RS_ring, count);
+        }else{
+            count = SR_read(&RS_ring, copy, RS_READ_MAX);
+            RS_check(check, copy, count);
+        }
+        //the producer is done and everything it wrote before was read
+        if(done && count == 0 && SR_fillLevel(&RS_ring) == 0) break;
+        if((RS_random(&random) & 7) == 0) sched_yield();
+    }
+    return NULL;
+}
+
+int main(int argc, char ** argv){
+    if(argc > 1) RS_blocks = (uint32_t) atoi(argv[1]);
+    if(SR_init(&RS_ring, RS_buffer, sizeof(RS_Elem_t), RS_DEPTH) != 0) return 1;
+
+    RS_Check_t check = {0};
+    pthread_t producer, consumer;
+    pthread_create(&consumer, NULL, RS_consumer, &check);
+    pthread_create(&producer, NULL, RS_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    uint32_t overruns = atomic_load(&RS_ring.overruns);
+    uint32_t highWater = atomic_load(&RS_ring.highWater);
+    //elements missing after the last one received were dropped as well
+    uint64_t gaps = check.gaps + (RS_produced - check.next);
+    printf("%llu produced, %llu received, %u overruns, %llu gaps, max fill %u/%u, %llu errors\n",
+        (unsigned long long) RS_produced, (unsigned long long) check.received, overruns, (unsigned long long) gaps,
+        highWater, RS_DEPTH, (unsigned long long) check.errors);
+
+    unsigned ok = check.errors == 0 && check.received + overruns == RS_produced && gaps == overruns &&
+        overruns == RS_notWritten && highWater <= RS_DEPTH;
+    if(!ok) printf("FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/*
+    Checks the burst scheduling and the deadtime window of RotorPhase against its edge cases
+
+        rotorphase_check
+
+    Covers a stopped rotor, bursts that don't fit, the burst and rate limits, the sweep and its wrap, the window check at
+    its borders and, for a grid of speeds, deadtimes and conversion times, that a scheduled burst always stays inside the
+    usable window. Every failed check is printed, the exit code is 1 if there was one.
+*/
+#include <stdint.h>
+#include <stdio.h>
+
+#include "RotorPhase.h"
+
+#define RC_TIMER_HZ 40000000            //FM_TIMER_HZ
+#define RC_MAX_BURST 64                 //ADC_BURST_LEN
+#define RC_MAX_SAMPLERATE 10000         //FM_CONF_MAX_SAMPLERATE
+#define RC_CONV_TICKS 480               //the default conversion time of RP_init, 12us
+
+static uint32_t RC_failures = 0;
+
+#define RC_CHECK(condition) RC_check((condition), #condition, __LINE__)
+
+static void RC_check(unsigned ok, const char * what, int line){
+    if(ok) return;
+    printf("line %d: %s\n", line, what);
+    RC_failures++;
+}
+
+//period of two revolutions, like the rotor edge filter measures it
+static uint64_t RC_period(uint32_t rpm){
+    return (uint64_t) RC_TIMER_HZ * 2 * 60 / rpm;
+}
+
+static void RC_stopped(){
+    RP_Predictor_t rp;
+    RP_Schedule_t s;
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, RC_MAX_SAMPLERATE);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 0);
+
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen > 0);
+    RP_updatePeriod(&rp, 0);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 0);
+    RC_CHECK(rp.deadtime == 0);
+}
+
+static void RC_centered(){
+    RP_Predictor_t rp;
+    RP_Schedule_t s;
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, RC_MAX_SAMPLERATE);
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_schedule(&rp, &s);
+    uint32_t segment = (uint32_t) (RC_period(3600) / 4);
+    uint32_t deadtime = RP_deadtimeTicks(segment, 90);
+    RC_CHECK(rp.segmentTicks == segment);
+    RC_CHECK(rp.deadtime == deadtime);
+    RC_CHECK(s.burstLen == RC_MAX_BURST);
+    RC_CHECK(s.convTicks == RC_CONV_TICKS);
+
+    //the pads before and after the burst differ by at most one tick
+    uint32_t before = s.startOffset - deadtime;
+    uint32_t after = segment - deadtime - (s.startOffset + s.burstLen * s.convTicks);
+    RC_CHECK(before == after || before + 1 == after);
+}
+
+static void RC_limits(){
+    RP_Predictor_t rp;
+    RP_Schedule_t s;
+
+    //without a burst limit the rate limit applies: 10000/s of a 1/120 s segment
+    RP_init(&rp, RC_TIMER_HZ, 90, 1000, RC_MAX_SAMPLERATE);
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 83);
+
+    //without both the window is filled
+    RP_init(&rp, RC_TIMER_HZ, 90, 100000, 0);
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == (rp.segmentTicks - 2 * rp.deadtime) / RC_CONV_TICKS);
+    RC_CHECK(s.startOffset + s.burstLen * s.convTicks <= rp.segmentTicks - rp.deadtime);
+
+    //a window shorter than one conversion
+    RP_init(&rp, RC_TIMER_HZ, 0, RC_MAX_BURST, 0);
+    RP_updatePeriod(&rp, (RC_CONV_TICKS - 1) * 4);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 0);
+    RP_updatePeriod(&rp, RC_CONV_TICKS * 4);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 1);
+    RC_CHECK(s.startOffset == 0);
+
+    //the deadtime is clamped below half the segment, 2 * 499 permille leave 2 permille
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, 0);
+    RP_setDeadtime(&rp, 600);
+    RC_CHECK(rp.deadtimePermille == 499);
+    RP_updatePeriod(&rp, (uint64_t) RC_CONV_TICKS * 1000 * 4);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 2);
+
+    //no conversion time at all
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, 0);
+    rp.convTicks = 0;
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.burstLen == 0);
+}
+
+static void RC_conversionTime(){
+    RP_Predictor_t rp;
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, 0);
+    RP_updateConversionTime(&rp, 0, 64);
+    RP_updateConversionTime(&rp, 1000, 0);
+    RC_CHECK(rp.convTicks == RC_CONV_TICKS);
+    for(uint32_t i = 0; i < 200; i++) RP_updateConversionTime(&rp, 640 * 64, 64);
+    RC_CHECK(rp.convTicks == 640);
+}
+
+static void RC_sweep(){
+    const uint32_t steps = 15;
+    RP_Predictor_t rp;
+    RP_Schedule_t s;
+    RP_init(&rp, RC_TIMER_HZ, 90, RC_MAX_BURST, RC_MAX_SAMPLERATE);
+    RP_updatePeriod(&rp, RC_period(3600));
+    RP_setSweep(&rp, steps);
+    uint32_t burstTicks = RC_MAX_BURST * RC_CONV_TICKS;
+
+    //the deadtime is ignored, the first burst starts at the edge and the last one ends at the next edge
+    uint32_t last = 0;
+    for(uint32_t i = 0; i < steps; i++){
+        RP_schedule(&rp, &s);
+        RC_CHECK(s.burstLen == RC_MAX_BURST);
+        if(i == 0) RC_CHECK(s.startOffset == 0);
+        else RC_CHECK(s.startOffset > last);
+        if(i == steps - 1) RC_CHECK(s.startOffset + burstTicks == rp.segmentTicks);
+        RC_CHECK(s.startOffset + burstTicks <= rp.segmentTicks);
+        last = s.startOffset;
+        RP_nextSweep(&rp);
+    }
+    RP_schedule(&rp, &s);
+    RC_CHECK(rp.sweepPos == 0);
+    RC_CHECK(s.startOffset == 0);
+
+    //a single step stays centered on the whole segment, stopping the sweep centers on the window again
+    RP_setSweep(&rp, 1);
+    RP_nextSweep(&rp);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.startOffset == (rp.segmentTicks - burstTicks) / 2);
+    RP_setSweep(&rp, 0);
+    RP_nextSweep(&rp);
+    RP_schedule(&rp, &s);
+    RC_CHECK(s.startOffset == rp.deadtime + (rp.segmentTicks - 2 * rp.deadtime - burstTicks) / 2);
+}
+
+static void RC_window(){
+    RC_CHECK(RP_isInWindow(100, 1000, 100));
+    RC_CHECK(!RP_isInWindow(99, 1000, 100));
+    RC_CHECK(RP_isInWindow(899, 1000, 100));
+    RC_CHECK(!RP_isInWindow(900, 1000, 100));
+    RC_CHECK(RP_isInWindow(0, 1000, 0));
+    RC_CHECK(!RP_isInWindow(1000, 1000, 0));
+    RC_CHECK(!RP_isInWindow(0, 0, 0));
+    RC_CHECK(!RP_isInWindow(500, 1000, 500));
+
+    //a long segment at a large deadtime must not overflow
+    RC_CHECK(RP_deadtimeTicks(4000000000u, 450) == 1800000000u);
+    RC_CHECK(RP_deadtimeTicks(0, 450) == 0);
+}
+
+//every schedule of a grid of speeds, deadtimes and conversion times fits into its window
+static void RC_grid(){
+    for(uint32_t rpm = 300; rpm <= 20000; rpm += 337){
+        for(uint32_t deadtime = 0; deadtime <= 450; deadtime += 15){
+            for(uint32_t conv = 100; conv <= 20000; conv *= 3){
+                RP_Predictor_t rp;
+                RP_Schedule_t s;
+                RP_init(&rp, RC_TIMER_HZ, deadtime, RC_MAX_BURST, RC_MAX_SAMPLERATE);
+                rp.convTicks = conv;
+                RP_updatePeriod(&rp, RC_period(rpm));
+                RP_schedule(&rp, &s);
+                if(s.burstLen == 0) continue;
+                uint32_t end = s.startOffset + s.burstLen * s.convTicks;
+                if(s.startOffset < rp.deadtime || end > rp.segmentTicks - rp.deadtime || s.burstLen > RC_MAX_BURST){
+                    printf("%u rpm, %u permille, %u ticks: burst %u..%u outside of %u..%u\n", rpm, deadtime, conv,
+                        s.startOffset, end, rp.deadtime, rp.segmentTicks - rp.deadtime);
+                    RC_failures++;
+                }
+                //the first and the last conversion are usable samples
+                uint32_t mid = s.convTicks >> 1;
+                RC_CHECK(RP_isInWindow(s.startOffset + mid, rp.segmentTicks, rp.deadtime));
+                RC_CHECK(RP_isInWindow(end - s.convTicks + mid, rp.segmentTicks, rp.deadtime));
+            }
+        }
+    }
+}
+
+int main(){
+    RC_stopped();
+    RC_centered();
+    RC_limits();
+    RC_conversionTime();
+    RC_sweep();
+    RC_window();
+    RC_grid();
+    if(RC_failures == 0) printf("all checks passed\n");
+    return RC_failures ? 1 : 0;
+}
@@ -0,0 +1,678 @@
+/*
+    Runs the signal path of the firmware on simulated hardware and measures every stage of it
+
+        signal_bench [seconds [filterChain [calFile]]]
+
+    The simulation (SimHal.h) drives the modules the firmware tasks use in the same order: the rotor edges go through the
+    edge filter and the phase predictor, every segment gets an ADC burst that is converted like in MCP3301.c and passed
+    through the sample ring to the consumer, which records it. The recording is then run through each processing stage on
+    its own:
+
+        validate    deadtime window of every sample (RP_isInWindow)
+        profile     segment edge profile (EP_addSample)
+        waveform    phase bin and rotor waveform average, the template is updated once per revolution
+        lock-in     demodulation with the segment means (LI_addSample)
+        matched     demodulation weighted with the waveform template (LI_addWeightedSample)
+        events      transient detector on the calibrated revolution (TR_addReading)
+        filter      output filter chain (FC_process), the default of FM_filterChain unless one is given
+        calibrate   calibration curve loaded from cal.json (CT_scale)
+        json, cbor  telemetry batches of BENCH_BATCH readings (TM_encode)
+        pipeline    all of it per block of samples, like the value task
+
+    Throughput is measured over the whole recording without timing single calls. The latency is measured in a second pass
+    for every call (a block of samples, a reading or a batch) with the cost of reading the clock taken out, calls much
+    shorter than the clock resolution only show up in the throughput. The readings are repeated until there are
+    BENCH_READINGS of them, a simulated run has too few to time the cheap per reading stages.
+
+    At the end the calibrated readings are compared with the field that was simulated, so a change that makes a stage
+    faster but the result worse shows up too.
+
+    Last the calibration table is compared with the linear scan it replaced for 2 to 100 points, the exit code is 1 if
+    the two don't give the same field, and the JSON tokenizer is timed on settings.json fed in chunks of 1 to 512 bytes
+    like httpd_req_recv() hands them out.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "SimHal.h"
+#include "MCP3301.h"
+#include "SampleRing.h"
+#include "RotorEdge.h"
+#include "RotorPhase.h"
+#include "EdgeProfile.h"
+#include "Waveform.h"
+#include "LockIn.h"
+#include "Transient.h"
+#include "FilterChain.h"
+#include "CalTable.h"
+#include "Telemetry.h"
+
+//firmware defaults, see FieldMill.h and the settings
+#define BENCH_MAX_SAMPLERATE 10000      //FM_CONF_MAX_SAMPLERATE
+#define BENCH_DEADTIME 90               //FM_deadtime
+#define BENCH_LOCKIN_CYCLES 32          //FM_CONF_LOCKIN_CYCLES
+#define BENCH_FILTER "avg:32"           //FM_filterChain
+#define BENCH_BATCH 10                  //MQTT_batchSize
+#define BENCH_FIELD 4000.0f             //simulated field in calibrated units
+#define BENCH_EVENT_RATE 20000.0f       //FM_eventRate for the measurement, the firmware default is off
+#define BENCH_EVENT_SLOPE 3             //FM_eventSlope
+#define BENCH_SECONDS 120.0
+#define BENCH_READINGS 1000000
+#define BENCH_SETTLE 64                 //revolutions left out of the accuracy, the averages are still settling
+#define BENCH_JSON_MAX 16384            //largest settings document
+#define BENCH_JSON_BYTES 16000000       //tokenized per chunk size
+
+typedef struct{
+    uint32_t first;                     //index of the first sample in the recording
+    uint32_t count;
+    uint32_t segmentTicks;              //FM_segmentTicks when the block was read from the ring
+} BENCH_Block_t;
+
+typedef struct{
+    uint64_t time;                      //us
+    float inPhase;
+} BENCH_Reading_t;
+
+static ADC_Sample_t * BENCH_samples;
+static uint32_t BENCH_sampleCount;
+static BENCH_Block_t * BENCH_blocks;
+static uint32_t BENCH_blockCount;
+static BENCH_Reading_t * BENCH_readings;
+static uint32_t BENCH_readingCount;
+static uint64_t * BENCH_latency;
+static uint64_t BENCH_clockOverhead;
+static float BENCH_rpm;
+
+static EP_Profile_t BENCH_profile;
+static WF_Averager_t BENCH_waveform;
+static LI_Demodulator_t BENCH_demod;
+static TR_Detector_t BENCH_transient;
+static FC_Chain_t BENCH_filter;
+static CT_Table_t * BENCH_calTable;
+static const char * BENCH_filterDescription = BENCH_FILTER;
+static TM_Reading_t BENCH_batch[TM_MAX_BATCH];
+static uint32_t BENCH_batchCount;
+static uint8_t BENCH_message[TM_MAX_MESSAGE];
+static volatile uint32_t BENCH_sink;     //keeps results the compiler could otherwise drop
+
+static uint64_t BENCH_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void * BENCH_alloc(size_t size){
+    void * p = malloc(size);
+    if(p == NULL){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+    Simulation
+*/
+
+static void BENCH_record(const ADC_Sample_t * samples, uint32_t count, uint32_t segmentTicks, uint32_t capacity){
+    if(BENCH_sampleCount + count > capacity) return;
+    BENCH_Block_t * block = &BENCH_blocks[BENCH_blockCount++];
+    block->first = BENCH_sampleCount;
+    block->count = count;
+    block->segmentTicks = segmentTicks;
+    memcpy(&BENCH_samples[BENCH_sampleCount], samples, sizeof(ADC_Sample_t) * count);
+    BENCH_sampleCount += count;
+}
+
+static void BENCH_simulate(const SH_Config_t * config, double seconds){
+    uint32_t segments = (uint32_t) (seconds * config->rpm / 60.0 * 2);
+    uint32_t capacity = segments * ADC_BURST_LEN;
+    BENCH_samples = BENCH_alloc(sizeof(ADC_Sample_t) * capacity);
+    BENCH_blocks = BENCH_alloc(sizeof(BENCH_Block_t) * segments * 2);
+
+    SH_Hal_t sh;
+    SH_init(&sh, config, 1);
+    RE_Filter_t re;
+    RE_init(&re);
+    RP_Predictor_t rp;
+    RP_init(&rp, SH_TIMER_HZ, BENCH_DEADTIME, ADC_BURST_LEN, BENCH_MAX_SAMPLERATE);
+    static ADC_Sample_t ringBuffer[ADC_RING_DEPTH];
+    SR_Ring_t ring;
+    SR_init(&ring, ringBuffer, sizeof(ADC_Sample_t), ADC_RING_DEPTH);
+
+    uint32_t segmentTicks = 0;
+    uint64_t edge = 0;
+    unsigned rotorPos = 0;
+    for(uint32_t s = 0; s < segments; s++){
+        //rotor ISR: the edge filter decides if the edge starts a segment, a completed period updates the prediction
+        SH_Edge_t edges[3];
+        uint32_t edgeCount = SH_nextSegment(&sh, edges);
+        unsigned segmentStart = 0;
+        for(uint32_t e = 0; e < edgeCount; e++){
+            RE_Result_t result = RE_addEdge(&re, edges[e].capture, edges[e].level);
+            if(result == RE_REJECTED) continue;
+            if(result == RE_PERIOD){
+                uint64_t period = re.period / (SH_CAPTURE_HZ / SH_TIMER_HZ);
+                segmentTicks = (uint32_t) (period / 4);
+                BENCH_rpm = (float) SH_TIMER_HZ * 2 * 60 / (float) period;
+                RP_updatePeriod(&rp, period);
+            }
+            rotorPos = edges[e].level;
+            edge = edges[e].time;
+            segmentStart = 1;
+        }
+        if(!segmentStart) continue;
+
+        //ADC task: one burst at the predicted position, converted like in ADC_burst()
+        RP_Schedule_t schedule;
+        RP_schedule(&rp, &schedule);
+        if(schedule.burstLen == 0) continue;
+        uint64_t start = edge + schedule.startOffset;
+        uint32_t raw[ADC_BURST_LEN];
+        SH_convert(&sh, start, schedule.burstLen, raw);
+
+        ADC_Sample_t burst[ADC_BURST_LEN];
+        uint64_t sampleTime = start + (schedule.convTicks >> 1);
+        for(uint32_t i = 0; i < schedule.burstLen; i++){
+            burst[i].sampleTime = sampleTime;
+            burst[i].rotorPos = rotorPos;
+            burst[i].edgeOffset = (uint32_t) (sampleTime - edge);
+            burst[i].value = ADC_signExtend(raw[i]);
+            sampleTime += schedule.convTicks;
+        }
+        RP_updateConversionTime(&rp, schedule.burstLen * config->convTicks, schedule.burstLen);
+        RP_nextSweep(&rp);
+        SR_write(&ring, burst, schedule.burstLen);
+
+        //value task
+        ADC_Sample_t * samples;
+        uint32_t count;
+        while((count = SR_peek(&ring, (void **) &samples)) > 0){
+            BENCH_record(samples, count, segmentTicks, capacity);
+            SR_consume(&ring, count);
+        }
+    }
+
+    printf("simulated %.0f s at %.0f rpm: %u segments, %u samples in %u blocks\n", seconds, config->rpm, segments,
+        BENCH_sampleCount, BENCH_blockCount);
+    printf("edge filter: %u rejected, %u restarts; sample ring: %u overruns, max fill %u/%u\n\n", re.rejected,
+        re.restarts, ring.overruns, ring.highWater, ADC_RING_DEPTH);
+}
+
+/*
+    Stages, one call per block of samples, reading or batch
+*/
+
+static void BENCH_resetSamples(){
+    EP_init(&BENCH_profile, 256, 0.05f, 8.0f);
+}
+
+static void BENCH_validate(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    uint32_t deadtime = RP_deadtimeTicks(block->segmentTicks, BENCH_DEADTIME);
+    uint32_t usable = 0;
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        usable += RP_isInWindow(BENCH_samples[i].edgeOffset, block->segmentTicks, deadtime);
+    }
+    BENCH_sink += usable;
+}
+
+static void BENCH_addProfile(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        const ADC_Sample_t * sample = &BENCH_samples[i];
+        EP_addSample(&BENCH_profile, sample->value, sample->rotorPos, sample->edgeOffset, block->segmentTicks);
+    }
+}
+
+//the template is updated at the end of every revolution, when the covered segment is complete
+static void BENCH_addWaveform(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        const ADC_Sample_t * sample = &BENCH_samples[i];
+        WF_addSample(&BENCH_waveform, WF_bin(sample->rotorPos, sample->edgeOffset, block->segmentTicks), sample->value);
+    }
+    if(BENCH_samples[block->first].rotorPos == 0) WF_update(&BENCH_waveform);
+}
+
+static void BENCH_resetDemod(){
+    LI_init(&BENCH_demod, BENCH_LOCKIN_CYCLES);
+    BENCH_readingCount = 0;
+}
+
+static void BENCH_storeReading(const ADC_Sample_t * sample){
+    BENCH_Reading_t * reading = &BENCH_readings[BENCH_readingCount++];
+    reading->time = sample->sampleTime / (SH_TIMER_HZ / 1000000);
+    reading->inPhase = BENCH_demod.inPhase;
+}
+
+static void BENCH_lockIn(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        const ADC_Sample_t * sample = &BENCH_samples[i];
+        if(LI_addSample(&BENCH_demod, sample->value, sample->rotorPos)) BENCH_storeReading(sample);
+    }
+}
+
+static void BENCH_matched(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        const ADC_Sample_t * sample = &BENCH_samples[i];
+        uint32_t bin = WF_bin(sample->rotorPos, sample->edgeOffset, block->segmentTicks);
+        unsigned revolution;
+        if(bin != WF_NO_BIN){
+            LI_Weight_t weight = {BENCH_waveform.weight[bin], BENCH_waveform.norm[bin], BENCH_waveform.offset};
+            revolution = LI_addWeightedSample(&BENCH_demod, sample->value, sample->rotorPos, &weight);
+        }else{
+            revolution = LI_addSample(&BENCH_demod, sample->value, sample->rotorPos);
+        }
+        if(revolution) BENCH_storeReading(sample);
+    }
+}
+
+static void BENCH_resetReadings(){
+    TR_init(&BENCH_transient);
+    TR_configure(&BENCH_transient, BENCH_EVENT_SLOPE, BENCH_EVENT_RATE, 0.0f, 32, 32);
+    FC_configure(&BENCH_filter, BENCH_filterDescription, BENCH_rpm / 60.0f);
+    BENCH_batchCount = 0;
+}
+
+static void BENCH_event(uint32_t n){
+    const BENCH_Reading_t * reading = &BENCH_readings[n];
+    BENCH_sink += TR_addReading(&BENCH_transient, reading->time, CT_scale(BENCH_calTable, reading->inPhase));
+}
+
+static void BENCH_filterReading(uint32_t n){
+    float value = BENCH_readings[n].inPhase;
+    if(FC_process(&BENCH_filter, &value)) BENCH_sink += (uint32_t) value;
+}
+
+static void BENCH_calibrate(uint32_t n){
+    BENCH_sink += (uint32_t) CT_scale(BENCH_calTable, BENCH_readings[n].inPhase);
+}
+
+static void BENCH_fillBatch(uint32_t n){
+    for(uint32_t i = 0; i < BENCH_BATCH; i++){
+        const BENCH_Reading_t * reading = &BENCH_readings[(n * BENCH_BATCH + i) % BENCH_readingCount];
+        TM_Reading_t * out = &BENCH_batch[i];
+        out->time = (uint32_t) (reading->time / 1000);
+        out->field = CT_scale(BENCH_calTable, reading->inPhase);
+        out->raw = (int32_t) reading->inPhase;
+        out->rpm = (uint32_t) BENCH_rpm;
+    }
+}
+
+static void BENCH_json(uint32_t n){
+    (void) n;
+    BENCH_sink += TM_encode(BENCH_batch, BENCH_BATCH, TM_FORMAT_JSON, BENCH_message, TM_MAX_MESSAGE);
+}
+
+static void BENCH_cbor(uint32_t n){
+    (void) n;
+    BENCH_sink += TM_encode(BENCH_batch, BENCH_BATCH, TM_FORMAT_CBOR, BENCH_message, TM_MAX_MESSAGE);
+}
+
+static void BENCH_resetPipeline(){
+    BENCH_resetDemod();
+    BENCH_resetReadings();
+}
+
+//FM_valueTask with the matched filter on and the edge profile idle, the readings are overwritten with the filtered ones
+static void BENCH_pipeline(uint32_t n){
+    const BENCH_Block_t * block = &BENCH_blocks[n];
+    unsigned matched = BENCH_waveform.ready;
+    for(uint32_t i = block->first; i < block->first + block->count; i++){
+        const ADC_Sample_t * sample = &BENCH_samples[i];
+        uint32_t bin = WF_bin(sample->rotorPos, sample->edgeOffset, block->segmentTicks);
+        WF_addSample(&BENCH_waveform, bin, sample->value);
+
+        unsigned revolution;
+        if(matched && bin != WF_NO_BIN){
+            LI_Weight_t weight = {BENCH_waveform.weight[bin], BENCH_waveform.norm[bin], BENCH_waveform.offset};
+            revolution = LI_addWeightedSample(&BENCH_demod, sample->value, sample->rotorPos, &weight);
+        }else{
+            revolution = LI_addSample(&BENCH_demod, sample->value, sample->rotorPos);
+        }
+        if(!revolution) continue;
+        WF_update(&BENCH_waveform);
+
+        uint64_t time = sample->sampleTime / (SH_TIMER_HZ / 1000000);
+        TR_addReading(&BENCH_transient, time, CT_scale(BENCH_calTable, BENCH_demod.inPhase));
+        float reading = BENCH_demod.inPhase;
+        if(!FC_process(&BENCH_filter, &reading)) continue;
+
+        BENCH_Reading_t * out = &BENCH_readings[BENCH_readingCount++];
+        out->time = time;
+        out->inPhase = reading;
+        TM_Reading_t * telemetry = &BENCH_batch[BENCH_batchCount++];
+        telemetry->time = (uint32_t) (time / 1000);
+        telemetry->field = CT_scale(BENCH_calTable, reading);
+        telemetry->raw = (int32_t) reading;
+        telemetry->rpm = (uint32_t) BENCH_rpm;
+        if(BENCH_batchCount == BENCH_BATCH){
+            BENCH_sink += TM_encode(BENCH_batch, BENCH_batchCount, TM_FORMAT_JSON, BENCH_message, TM_MAX_MESSAGE);
+            BENCH_batchCount = 0;
+        }
+    }
+}
+
+/*
+    Measurement
+*/
+
+static int BENCH_compare(const void * a, const void * b){
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+//median of back to back clock reads, subtracted from every timed call
+static void BENCH_measureClock(){
+    for(uint32_t i = 0; i < 1001; i++){
+        uint64_t start = BENCH_now();
+        BENCH_latency[i] = BENCH_now() - start;
+    }
+    qsort(BENCH_latency, 1001, sizeof(uint64_t), BENCH_compare);
+    BENCH_clockOverhead = BENCH_latency[500];
+}
+
+/*
+    calls is the number of calls, items what they process in total (samples, readings). reset puts the state of the stage
+    back before each of the two passes, so both see the same work
+*/
+static void BENCH_stage(const char * name, const char * unit, void (*reset)(), void (*step)(uint32_t), uint32_t calls, uint64_t items){
+    if(reset) reset();
+    uint64_t start = BENCH_now();
+    for(uint32_t i = 0; i < calls; i++) step(i);
+    uint64_t elapsed = BENCH_now() - start;
+
+    if(reset) reset();
+    for(uint32_t i = 0; i < calls; i++){
+        uint64_t callStart = BENCH_now();
+        step(i);
+        uint64_t duration = BENCH_now() - callStart;
+        BENCH_latency[i] = (duration > BENCH_clockOverhead) ? duration - BENCH_clockOverhead : 0;
+    }
+    qsort(BENCH_latency, calls, sizeof(uint64_t), BENCH_compare);
+
+    printf("%-10s %-8s %9u %9.2f %9.2f %9llu %9llu %9llu\n", name, unit, calls, (double) elapsed / items,
+        items * 1e3 / elapsed, (unsigned long long) BENCH_latency[calls / 2],
+        (unsigned long long) BENCH_latency[(uint32_t) (calls * 0.99)], (unsigned long long) BENCH_latency[calls - 1]);
+}
+
+static void BENCH_statistics(const char * name, uint32_t first, uint32_t count, float field){
+    double sum = 0.0, sumSquares = 0.0;
+    for(uint32_t i = first; i < count; i++){
+        double value = CT_scale(BENCH_calTable, BENCH_readings[i].inPhase);
+        sum += value;
+        sumSquares += value * value;
+    }
+    uint32_t n = count - first;
+    double mean = sum / n;
+    double sd = sqrt(sumSquares / n - mean * mean);
+    printf("%-10s %6u readings, mean %9.2f (error %+7.3f%%), sd %8.3f\n", name, n, mean, (mean - field) * 100.0 / field, sd);
+}
+
+static CT_Table_t * BENCH_loadCalibration(const char * path){
+    FILE * file = fopen(path, "r");
+    if(file == NULL){
+        perror(path);
+        return NULL;
+    }
+    CT_Loader_t * loader = CT_createLoader();
+    if(loader == NULL){
+        fclose(file);
+        return NULL;
+    }
+    char chunk[64];
+    size_t length;
+    while((length = fread(chunk, 1, sizeof(chunk), file)) > 0) JT_feed(&loader->parser, chunk, (uint32_t) length);
+    fclose(file);
+
+    CT_Table_t * table = NULL;
+    JT_Result_t result = CT_finishLoader(loader);
+    if(result == JT_OK) table = CT_build(loader->points, loader->count);
+    else fprintf(stderr, "%s: %s at byte %u\n", path, JT_errorString(result), loader->parser.position);
+    if(result == JT_OK && table == NULL) fprintf(stderr, "%s: needs at least two points\n", path);
+    CT_freeLoader(loader);
+    return table;
+}
+
+/*
+    Calibration sweep
+
+    The linear scan CFM_scaleMeasurement() did before the calibration was compiled into a CT_Table_t, kept as the
+    reference. Changed only as far as needed to run at all: the index is signed so the scan ends (the old uint32_t i >= 0
+    never did) and it takes the float reading CT_scale() takes. The points have to be sorted, the old loader relied on
+    that too.
+*/
+typedef struct{
+    int32_t sensorReading;
+    float appliedField;
+    float inclination;                  //slope to the next point
+} BENCH_CalPoint_t;
+
+static float BENCH_linearScale(const BENCH_CalPoint_t * calData, uint32_t calDataCount, float reading){
+    if(reading < calData[0].sensorReading){
+        float base = reading - calData[0].sensorReading;
+        return calData[0].appliedField + base * calData[0].inclination;
+    }
+    for(int32_t i = calDataCount - 1; i >= 0; i--){
+        if(reading >= calData[i].sensorReading){
+            float base = reading - calData[i].sensorReading;
+            return calData[i].appliedField + base * calData[(i == (int32_t) calDataCount - 1) ? (i - 1) : i].inclination;
+        }
+    }
+    return -1;
+}
+
+static uint32_t BENCH_random(uint32_t * state){
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+    times the linear scan and the table for 2 to 100 random monotonic calibrations over the whole ADC range, the readings
+    go beyond the first and last point and hit every point exactly once. Returns 0 if any output differs by more than
+    rounding
+*/
+static unsigned BENCH_calibrationSweep(){
+    static const uint32_t sizes[] = {2, 3, 5, 8, 13, 16, 25, 32, 50, 64, 100};
+    uint32_t random = 3;
+    float * input = BENCH_alloc(sizeof(float) * BENCH_READINGS);
+    unsigned ok = 1;
+
+    printf("%-10s %9s %9s %9s %12s\n", "cal points", "scan ns", "table ns", "speedup", "max diff");
+    for(uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        uint32_t count = sizes[s];
+        BENCH_CalPoint_t old[100];
+        CT_Point_t points[100];
+        int32_t step = 8000 / count;
+        float field = -15000.0f;
+        for(uint32_t i = 0; i < count; i++){
+            old[i].sensorReading = points[i].sensorReading = -4000 + (int32_t) i * step + (int32_t) (BENCH_random(&random) % (step / 2));
+            old[i].appliedField = points[i].appliedField = field;
+            field += 100.0f + (float) (BENCH_random(&random) % 3000);
+        }
+        for(uint32_t i = 0; i + 1 < count; i++){
+            old[i].inclination = (old[i + 1].appliedField - old[i].appliedField) / (float) (old[i + 1].sensorReading - old[i].sensorReading);
+        }
+        CT_Table_t * table = CT_build(points, count);
+        if(table == NULL) return 0;
+
+        for(uint32_t i = 0; i < BENCH_READINGS; i++){
+            input[i] = (i < count) ? (float) points[i].sensorReading : (float) (BENCH_random(&random) % 9000) - 4500.0f + (float) (i & 7) * 0.125f;
+        }
+
+        float maxDiff = 0.0f, maxField = 0.0f;
+        for(uint32_t i = 0; i < BENCH_READINGS; i++){
+            float a = BENCH_linearScale(old, count, input[i]);
+            float b = CT_scale(table, input[i]);
+            if(fabsf(a - b) > maxDiff) maxDiff = fabsf(a - b);
+            if(fabsf(a) > maxField) maxField = fabsf(a);
+        }
+        //a few ulp of the largest field
+        if(maxDiff > maxField * 1e-5f){
+            printf("%u points: the table differs from the scan by %g\n", count, maxDiff);
+            ok = 0;
+        }
+
+        float sink = 0.0f;
+        uint64_t start = BENCH_now();
+        for(uint32_t i = 0; i < BENCH_READINGS; i++) sink += BENCH_linearScale(old, count, input[i]);
+        uint64_t scan = BENCH_now() - start;
+        start = BENCH_now();
+        for(uint32_t i = 0; i < BENCH_READINGS; i++) sink += CT_scale(table, input[i]);
+        uint64_t lookup = BENCH_now() - start;
+        BENCH_sink += (uint32_t) sink;
+        CT_free(table);
+
+        printf("%-10u %9.2f %9.2f %9.2f %12g\n", count, (double) scan / BENCH_READINGS, (double) lookup / BENCH_READINGS,
+            (double) scan / lookup, maxDiff);
+    }
+    free(input);
+    return ok;
+}
+
+/*
+    JT_feed() throughput on the settings document the web interface posts, for chunk sizes from 1 to 512 bytes. Every
+    pass tokenizes the whole document, the callback only counts the tokens
+*/
+static int BENCH_countToken(void * ctx, const JT_Token_t * token){
+    (*(uint32_t *) ctx) += token->length;
+    return 0;
+}
+
+static unsigned BENCH_tokenizerSweep(const char * path){
+    FILE * file = fopen(path, "r");
+    if(file == NULL){
+        perror(path);
+        return 0;
+    }
+    char * document = BENCH_alloc(BENCH_JSON_MAX);
+    uint32_t length = (uint32_t) fread(document, 1, BENCH_JSON_MAX, file);
+    fclose(file);
+    uint32_t passes = BENCH_JSON_BYTES / length + 1;
+    unsigned ok = 1;
+
+    printf("%-10s %9s %9s %9s\n", "json chunk", "ns/byte", "MB/s", "ns/chunk");
+    for(uint32_t chunk = 1; chunk <= 512; chunk *= 2){
+        JT_Parser_t parser;
+        uint32_t tokenBytes = 0;
+        JT_Result_t result = JT_OK;
+        uint64_t start = BENCH_now();
+        for(uint32_t p = 0; p < passes; p++){
+            JT_init(&parser, BENCH_countToken, &tokenBytes);
+            for(uint32_t offset = 0; offset < length; offset += chunk){
+                JT_feed(&parser, document + offset, (length - offset < chunk) ? length - offset : chunk);
+            }
+            result = JT_finish(&parser);
+        }
+        uint64_t elapsed = BENCH_now() - start;
+        BENCH_sink += tokenBytes;
+        if(result != JT_OK){
+            printf("%s: %s at byte %u\n", path, JT_errorString(result), parser.position);
+            ok = 0;
+            break;
+        }
+        uint64_t bytes = (uint64_t) passes * length;
+        uint64_t chunks = (uint64_t) passes * ((length + chunk - 1) / chunk);
+        printf("%-10u %9.2f %9.1f %9.1f\n", chunk, (double) elapsed / bytes, bytes * 1e3 / elapsed, (double) elapsed / chunks);
+    }
+    free(document);
+    return ok;
+}
+
+//the signal amplitude in ADC counts the calibration turns into field, the curve is monotonic
+static float BENCH_amplitudeFor(float field){
+    float low = -4096.0f, high = 4096.0f;
+    for(uint32_t i = 0; i < 40; i++){
+        float middle = (low + high) * 0.5f;
+        if(CT_scale(BENCH_calTable, middle) < field) low = middle; else high = middle;
+    }
+    return (low + high) * 0.5f;
+}
+
+int main(int argc, char ** argv){
+    double seconds = (argc > 1) ? atof(argv[1]) : BENCH_SECONDS;
+    if(argc > 2) BENCH_filterDescription = argv[2];
+    const char * calFile = (argc > 3) ? argv[3] : BENCH_CAL_FILE;
+    if(seconds < 1.0){
+        fprintf(stderr, "usage: %s [seconds [filterChain [calFile]]]\n", argv[0]);
+        return 1;
+    }
+    if(FC_configure(&BENCH_filter, BENCH_filterDescription, 60.0f) < 0){
+        fprintf(stderr, "invalid filter chain \"%s\"\n", BENCH_filterDescription);
+        return 1;
+    }
+    BENCH_calTable = BENCH_loadCalibration(calFile);
+    if(BENCH_calTable == NULL) return 1;
+
+    SH_Config_t config;
+    SH_defaultConfig(&config);
+    config.amplitude = BENCH_amplitudeFor(BENCH_FIELD);
+    BENCH_simulate(&config, seconds);
+
+    uint32_t revolutions = BENCH_blockCount / 2 + 1;
+    uint32_t maxCalls = (BENCH_blockCount > BENCH_READINGS) ? BENCH_blockCount : BENCH_READINGS;
+    BENCH_readings = BENCH_alloc(sizeof(BENCH_Reading_t) * ((revolutions > BENCH_READINGS) ? revolutions : BENCH_READINGS));
+    BENCH_latency = BENCH_alloc(sizeof(uint64_t) * ((maxCalls > 1001) ? maxCalls : 1001));
+    BENCH_measureClock();
+
+    printf("%-10s %-8s %9s %9s %9s %9s %9s %9s\n", "stage", "per call", "calls", "ns/item", "Mitem/s", "p50 ns", "p99 ns", "max ns");
+    BENCH_stage("validate", "block", NULL, BENCH_validate, BENCH_blockCount, BENCH_sampleCount);
+    BENCH_stage("profile", "block", BENCH_resetSamples, BENCH_addProfile, BENCH_blockCount, BENCH_sampleCount);
+    WF_init(&BENCH_waveform, 2048, 64, 4.0f);
+    BENCH_stage("waveform", "block", NULL, BENCH_addWaveform, BENCH_blockCount, BENCH_sampleCount);
+    BENCH_stage("matched", "block", BENCH_resetDemod, BENCH_matched, BENCH_blockCount, BENCH_sampleCount);
+    uint32_t matchedCycles = BENCH_demod.matchedCycles;
+    uint32_t matchedCount = BENCH_readingCount;
+    float * matched = BENCH_alloc(sizeof(float) * matchedCount);
+    for(uint32_t i = 0; i < matchedCount; i++) matched[i] = BENCH_readings[i].inPhase;
+    BENCH_stage("lock-in", "block", BENCH_resetDemod, BENCH_lockIn, BENCH_blockCount, BENCH_sampleCount);
+    uint32_t revolutionCount = BENCH_readingCount;
+
+    //the lock-in readings are repeated for the stages per reading, the time keeps going up for the transient detector
+    if(revolutionCount < BENCH_SETTLE * 2){
+        fprintf(stderr, "the simulation is too short, %u revolutions\n", revolutionCount);
+        return 1;
+    }
+    for(uint32_t i = revolutionCount; i < BENCH_READINGS; i++){
+        BENCH_readings[i] = BENCH_readings[i % revolutionCount];
+        BENCH_readings[i].time += (uint64_t) (i / revolutionCount) * (BENCH_readings[revolutionCount - 1].time + 1);
+    }
+    BENCH_readingCount = BENCH_READINGS;
+    BENCH_stage("events", "reading", BENCH_resetReadings, BENCH_event, BENCH_READINGS, BENCH_READINGS);
+    BENCH_stage("filter", "reading", BENCH_resetReadings, BENCH_filterReading, BENCH_READINGS, BENCH_READINGS);
+    BENCH_stage("calibrate", "reading", NULL, BENCH_calibrate, BENCH_READINGS, BENCH_READINGS);
+    uint32_t batches = BENCH_READINGS / BENCH_BATCH / 10;
+    BENCH_fillBatch(0);
+    BENCH_stage("json", "batch", NULL, BENCH_json, batches, (uint64_t) batches * BENCH_BATCH);
+    BENCH_stage("cbor", "batch", NULL, BENCH_cbor, batches, (uint64_t) batches * BENCH_BATCH);
+
+    BENCH_readingCount = revolutionCount;
+    BENCH_statistics("lock-in", BENCH_SETTLE, revolutionCount, BENCH_FIELD);
+    for(uint32_t i = 0; i < matchedCount; i++) BENCH_readings[i].inPhase = matched[i];
+    BENCH_statistics("matched", BENCH_SETTLE, matchedCount, BENCH_FIELD);
+    printf("%-10s %6u of the revolutions were weighted\n", "", matchedCycles);
+
+    //the pipeline starts with the template the waveform stage learned, like a running mill
+    printf("\n");
+    BENCH_stage("pipeline", "block", BENCH_resetPipeline, BENCH_pipeline, BENCH_blockCount, BENCH_sampleCount);
+    BENCH_statistics(BENCH_filterDescription[0] ? BENCH_filterDescription : "unfiltered", BENCH_SETTLE, BENCH_readingCount, BENCH_FIELD);
+    printf("%-10s %6u events with a rate threshold of %.0f/s\n", "", BENCH_transient.events, BENCH_EVENT_RATE);
+
+    printf("\n");
+    unsigned ok = BENCH_calibrationSweep();
+    printf("\n");
+    ok &= BENCH_tokenizerSweep(BENCH_SETTINGS_FILE);
+
+    free(matched);
+    CT_free(BENCH_calTable);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#ifndef AB_include
+#define AB_include
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+    Read only asset bundle
+
+    The static web UI is packed by tools/pack_assets.py into a single image that is written to the "assets" partition. At
+    startup the partition is memory mapped and checked once, after that a request is answered by a binary search over the
+    hashed paths and the response is sent straight out of the mapped flash. There is no filesystem, no copy and the MIME
+    type, ETag and compressed variant come from the index.
+
+    header: AB_Header_t followed by count AB_Entry_t sorted by hash, all offsets are from the start of the bundle
+*/
+
+#define AB_PARTITION_SUBTYPE 0x40
+#define AB_MAGIC 0x42414d46 //"FMAB"
+#define AB_VERSION 1
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t length;        //whole bundle including this header
+    uint32_t crc;           //crc32 of everything after the header
+} AB_Header_t;
+
+typedef struct{
+    uint32_t hash;          //FNV-1a of the path
+    uint32_t pathOffset;
+    uint16_t pathLength;
+    uint8_t mime;
+    uint8_t reserved;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t gzipOffset;
+    uint32_t gzipLength;    //0 if there is no compressed variant
+    uint32_t gzipCrc;
+} AB_Entry_t;
+
+typedef struct{
+    const char * data;
+    uint32_t length;
+    const char * gzipData;
+    uint32_t gzipLength;
+    const char * mime;
+    char etag[11];
+    char gzipEtag[11];
+} AB_Asset_t;
+
+esp_err_t AB_init();
+unsigned AB_find(const char * path, uint32_t pathLength, AB_Asset_t * asset);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CT_include
+#define CT_include
+#include <stdint.h>
+#include "JsonTok.h"
+
+/*
+    Compiled calibration curve
+
+    The calibration points are sorted and compiled into a table of segment start, field at the start and slope. The search
+    array is padded to a power of two so the segment can be found with a fixed number of branchless steps, the conversion
+    of a reading takes the same time no matter where on the curve it is or how it compares to the points.
+
+    Readings below the first point are extrapolated with the slope of the first segment, readings above the last one with
+    the slope of the last segment.
+
+    The points are loaded from {"Datapoints":[[reading,field],...]} by a CT_Loader_t, which is fed in chunks like the
+    parser inside it. Other members of the top level object are ignored, the point list grows until the heap runs out.
+*/
+
+typedef struct{
+    int32_t sensorReading;
+    float appliedField;
+} CT_Point_t;
+
+typedef struct{
+    uint32_t count;             //number of calibration points
+    uint32_t searchSize;        //count rounded up to a power of two
+    float * reading;            //segment start, padded with FLT_MAX up to searchSize
+    float * field;              //field at the segment start
+    float * slope;              //field per count in the segment
+} CT_Table_t;
+
+typedef struct{
+    JT_Parser_t parser;         //feed the document into this one
+    CT_Point_t * points;
+    uint32_t count;
+    uint32_t capacity;
+    CT_Point_t point;
+    uint32_t pointValues;
+    unsigned inDatapoints;
+    unsigned outOfMemory;       //the document was rejected because the points didn't fit
+} CT_Loader_t;
+
+CT_Table_t * CT_build(const CT_Point_t * points, uint32_t count);
+void CT_free(CT_Table_t * table);
+float CT_scale(const CT_Table_t * table, float reading);
+CT_Loader_t * CT_createLoader();
+JT_Result_t CT_finishLoader(CT_Loader_t * loader);
+void CT_freeLoader(CT_Loader_t * loader);
+
+#endif
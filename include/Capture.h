@@ -0,0 +1,60 @@
+#ifndef CAP_include
+#define CAP_include
+#include <stdint.h>
+#include "MCP3301.h"
+
+/*
+    Raw sample capture
+
+    Records the unprocessed ADC samples into a buffer that is allocated once at startup, so a capture never fails for lack
+    of memory and costs nothing but a state check while idle. The buffer takes what is left of the largest free heap block
+    after CAP_HEAP_RESERVE, up to CAP_MAX_RECORDS. Without a buffer start and download answer 503.
+
+    GET /capture/start?duration=<ms>[&level=<raw>][&pre=<percent>]
+        without level the capture starts right away. With level the buffer is filled continuously until the magnitude of a
+        raw reading reaches the level, pre percent of the capture are kept from before the trigger.
+    GET /capture/status
+        {"state":"idle|armed|recording|done","records":n,"capacity":n}, capacity is the size of the buffer in records
+    GET /capture.bin
+        the finished capture, a CAP_FileHeader_t followed by recordCount CAP_Record_t in chronological order, all little
+        endian.
+*/
+
+#define CAP_MAX_RECORDS 8192    //96kB, about 0.8s at the maximum sample rate
+#define CAP_MIN_RECORDS 256     //a smaller buffer isn't worth having
+#define CAP_HEAP_RESERVE 32768  //left in the block the buffer is taken from for WiFi, httpd and MQTT
+#define CAP_FILE_MAGIC 0x50434d46 //"FMCP"
+#define CAP_FILE_VERSION 3   //1: sampleTime restarted with every rotor period, 2: no edgeOffset
+
+#define CAP_FLAG_TIMER_RESTART 0x01 //sampleTime wrapped around since the previous record
+#define CAP_FLAG_TRIGGER 0x02       //the record that fired the trigger
+
+typedef struct{
+    uint32_t sampleTime;    //lower 32 bits of the free running ADC timer, see timerHz
+    int16_t value;          //raw MCP3301 reading
+    uint8_t rotorPos;
+    uint8_t flags;
+    uint32_t edgeOffset;    //ADC timer ticks since the rotor edge that started the segment, what the deadtime is checked on
+} CAP_Record_t;
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t recordCount;
+    uint32_t triggerIndex;  //index of the trigger record, 0 for a capture started on command
+    uint32_t timerHz;
+    int32_t triggerLevel;   //0 for a capture started on command
+} CAP_FileHeader_t;
+
+typedef enum{
+    CAP_IDLE,
+    CAP_ARMED,
+    CAP_RECORDING,
+    CAP_DONE
+} CAP_State_t;
+
+void CAP_init();
+void CAP_addSamples(const ADC_Sample_t * samples, uint32_t count);
+
+#endif
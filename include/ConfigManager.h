@@ -5,24 +5,91 @@
 #ifndef CFM_INC
 #define CFM_INC
 
+/*
+    Settings registry
+
+    All settings are declared here once with their type, default and limits. The list expands into the CFM_Setting_t enum,
+    the CFM_Settings_t struct that holds the native values and the descriptor table used to parse and store them, so values
+    are converted exactly once when they are loaded and subsystems just read the struct fields.
+
+    INT(name, default, min, max)
+    FLOAT(name, default, min, max)
+    BOOL(name, default)
+    STRING(name, default, maxLength)
+*/
+#define CFM_SETTINGS_LIST(INT, FLOAT, BOOL, STRING) \
+    INT(    FM_targetRPM,           3600,       1000,       5000)       \
+    FLOAT(  FM_motorKp,             0.005f,     0.0f,       10.0f)      \
+    FLOAT(  FM_motorKi,             0.04f,      0.0f,       10.0f)      \
+    FLOAT(  FM_motorKd,             0.0f,       0.0f,       10.0f)      \
+    FLOAT(  FM_motorFeedForward,    0.0139f,    0.0f,       0.1f)       \
+    FLOAT(  FM_motorSlewRate,       50.0f,      0.0f,       1000.0f)    \
+    FLOAT(  FM_speedGain,           0.0f,       -0.01f,     0.01f)      \
+    INT(    FM_speedRefRPM,         3600,       1000,       5000)       \
+    INT(    FM_deadtime,            90,         0,          450)        \
+    BOOL(   FM_autoDeadtime,        1)                                  \
+    BOOL(   FM_matchedFilter,       1)                                  \
+    STRING( FM_filterChain,         "avg:32",   64)                     \
+    FLOAT(  FM_eventRate,           0.0f,       0.0f,       1e7f)       \
+    INT(    FM_eventSlope,          3,          1,          64)         \
+    FLOAT(  FM_eventLevel,          0.0f,       0.0f,       1e6f)       \
+    INT(    FM_eventPre,            32,         0,          64)         \
+    INT(    FM_eventPost,           32,         0,          64)         \
+    BOOL(   MQTT_clientEnabled,     0)                                  \
+    STRING( MQTT_brokerURI,         "",         128)                    \
+    STRING( MQTT_user,              "",         64)                     \
+    STRING( MQTT_password,          "",         64)                     \
+    STRING( MQTT_topic,             "",         64)                     \
+    INT(    MQTT_period,            1000,       10,         3600000)    \
+    INT(    MQTT_batchSize,         1,          1,          100)        \
+    INT(    MQTT_maxLatency,        10000,      0,          3600000)    \
+    INT(    MQTT_qos,               1,          0,          2)          \
+    STRING( MQTT_format,            "json",     8)                      \
+    BOOL(   WIFI_clientEnabled,     0)                                  \
+    STRING( WIFI_ssid,              "",         32)                     \
+    STRING( WIFI_password,          "",         64)
+
+#define CFM_ENUM_NUM(name, def, min, max) CFM_##name,
+#define CFM_ENUM_BOOL(name, def) CFM_##name,
+#define CFM_ENUM_STRING(name, def, len) CFM_##name,
+typedef enum{
+    CFM_SETTINGS_LIST(CFM_ENUM_NUM, CFM_ENUM_NUM, CFM_ENUM_BOOL, CFM_ENUM_STRING)
+    CFM_SETTINGS_COUNT
+} CFM_Setting_t;
+
+#define CFM_FIELD_INT(name, def, min, max) int32_t name;
+#define CFM_FIELD_FLOAT(name, def, min, max) float name;
+#define CFM_FIELD_BOOL(name, def) uint8_t name;
+#define CFM_FIELD_STRING(name, def, len) char name[len + 1];
 typedef struct{
-    float appliedField;
-    int32_t sensorReading;
-    float inclination;
-} CalPoint;
+    CFM_SETTINGS_LIST(CFM_FIELD_INT, CFM_FIELD_FLOAT, CFM_FIELD_BOOL, CFM_FIELD_STRING)
+} CFM_Settings_t;
+
+typedef enum{
+    CFM_TYPE_INT,
+    CFM_TYPE_FLOAT,
+    CFM_TYPE_BOOL,
+    CFM_TYPE_STRING
+} CFM_SettingType_t;
 
 typedef struct{
-    char* key;
-    char* value;
-    unsigned skip;
-} SettingsItem;
+    const char * key;
+    CFM_SettingType_t type;
+    uint16_t offset;        //position of the value in CFM_Settings_t
+    uint16_t size;
+    float min;
+    float max;
+    float def;
+    const char * defString;
+} CFM_SettingDesc_t;
 
 esp_err_t CFM_init();
-SettingsItem* CFM_getSetting(char* key);
-float CFM_scaleMeasurement(int32_t reading);
-char* CFM_parseJSON(char* data, char* propertyToFind);
+//overwritten in place by the httpd task. Other tasks may read single numbers, strings are copied in FM_loadSettings()
+const CFM_Settings_t * CFM_getSettings();
+const CFM_SettingDesc_t * CFM_getSettingDesc(CFM_Setting_t setting);
+float CFM_scaleMeasurement(float reading);
 esp_err_t CFM_processNewCalData(httpd_req_t *req);
 esp_err_t CFM_processNewSettingsData(httpd_req_t *req);
-void CFM_loadAllSettings(char* data);
+esp_err_t CFM_setNumber(CFM_Setting_t setting, float value);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,43 @@
+#ifndef EP_include
+#define EP_include
+#include <stdint.h>
+
+/*
+    Rotor segment edge profile
+
+    Because of field fringing at the edges of the rotor, the signal of a segment ramps up and down instead of being a clean
+    square wave. Samples near an edge pull the demodulated reading towards zero and have to be blanked by the deadtime.
+
+    The profile collects samples against their position in the segment (edgeOffset / segmentTicks) into EP_BINS bins,
+    separately for both rotor positions. The centre quarter of the segment is taken as the plateau of each position, and
+    a bin is usable if both means stay within tolerance * |plateau(1) - plateau(0)| of their plateau. From the centre the
+    window grows outwards until the first bin that isn't usable. The deadtime is the larger of the two blanked ends, so
+    the window stays symmetric like RP_schedule() expects.
+
+    The profile needs a field on the mill. Without one both plateaus are the same and the edges can't be told from the
+    plateau, so EP_evaluate() reports EP_NO_SIGNAL.
+*/
+
+#define EP_BINS 32
+
+typedef enum{
+    EP_OK,
+    EP_INCOMPLETE,              //at least one bin has fewer than minCount samples
+    EP_NO_SIGNAL                //the plateau difference is below minStep or too noisy to find the window in
+} EP_Result_t;
+
+typedef struct{
+    int64_t sum[2][EP_BINS];    //indexed by rotorPos and bin
+    uint32_t count[2][EP_BINS];
+    uint32_t minCount;          //samples every bin needs before the profile is evaluated
+    float tolerance;            //allowed deviation from the plateau relative to the plateau difference
+    float minStep;              //smallest plateau difference a profile is evaluated for
+} EP_Profile_t;
+
+void EP_init(EP_Profile_t * ep, uint32_t minCount, float tolerance, float minStep);
+void EP_reset(EP_Profile_t * ep);
+void EP_addSample(EP_Profile_t * ep, int32_t value, unsigned rotorPos, uint32_t edgeOffset, uint32_t segmentTicks);
+unsigned EP_isComplete(const EP_Profile_t * ep);
+EP_Result_t EP_evaluate(const EP_Profile_t * ep, uint32_t * deadtimePermille);
+
+#endif
@@ -9,38 +9,71 @@
 #define FM_ADC_DIN_PIN 33
 #define FM_ADC_CS_PIN 32
 
-#define FM_CONF_DEADTIME (TIMER_BASE_CLK / 4000000) * 1500 //in 25ns increments
-#define FM_CONF_MOTORSPEED_GAIN 0.01f //1/( d(out/outN0)/(N0-))
+#define FM_CONF_MAX_SAMPLERATE 10000 //upper limit for the average number of ADC conversions per second
+#define FM_CONF_LOCKIN_CYCLES 32 //revolutions the logged lock-in average is taken over, the reading itself goes through FM_filterChain
+#define FM_CONF_REVS_PER_PERIOD 2 //the rotor period is measured over four interrupter edges, two per revolution
+#define FM_CONF_MOTOR_INTEGRAL_BAND 150.0f //rpm, the speed controller only integrates errors smaller than this
+#define FM_CONF_PROFILE_SWEEP 15 //burst positions while the edge profile is learned, odd so both rotor positions get all of them
+#define FM_CONF_PROFILE_MIN_COUNT 256 //samples every bin of the edge profile needs for each rotor position
+#define FM_CONF_PROFILE_TOLERANCE 0.05f //deviation from the plateau a usable sample may have, relative to the signal
+#define FM_CONF_PROFILE_MIN_STEP 8.0f //smallest signal in ADC counts the edge profile can be learned with
+#define FM_CONF_PROFILE_INTERVAL 3600 //s between learning the edge profile again
+#define FM_CONF_PROFILE_TIMEOUT 60 //s until learning the edge profile is given up
+#define FM_CONF_WAVEFORM_SAMPLES 2048 //samples every phase bin of the rotor waveform is averaged over
+#define FM_CONF_WAVEFORM_MIN_COUNT 64 //samples a phase bin needs before it's part of the template
+#define FM_CONF_WAVEFORM_MIN_AMPLITUDE 4.0f //ADC counts, the template shape is only updated above this signal
+#define FM_CONF_EVENT_MAX_LATENCY 100000 //us from the trigger until the alert is sent, slower ones are counted as late
+#define FM_CONF_EVENT_NETWORK_TIMEOUT 2000 //ms, limits how long any MQTT publish can block
+
+#define FM_TIMER_HZ (TIMER_BASE_CLK / 2) //ADC timer (timer group 0 counter 1), rotor edges and periods are converted to its ticks
 
 /*
-    Motor speed calibration maths:
-    target rotor speed := n0
-    FM_CONF_MOTORSPEED_GAIN := y
-    speed difference = n-no := dn
-    proportional value change = out@n0/out (dn) := r(dn)
+    Motor speed compensation
+
+    The reading grows with the rotor speed, close to the reference speed it is linear:
+    reference speed := n0 (FM_speedRefRPM)
+    speed difference = n - n0 := dn
+    gain := y (FM_speedGain, 1/rpm)
 
-    r(dn) = 1/(1 + dn * y)  //at n0 out = 1 * out@n0
-<=> 1/r(dn) = 1 + dn * y
-<=> (1/r(dn)) - 1) / dn = y
+    out(n) = out@n0 * (1 + y * dn)
+<=> y = (out(n) / out@n0 - 1) / dn
 
-    to measure y:
+    to measure y by hand:
 1.  apply a static field to the mill
-2.  log value at n0 (normally 3600 rpm) := out@n0
-3.  log value at known offset (for example 3300rpm = 3600rpm - dn) := out
-4.  use y = ((out@n0/out) - 1) / dn
+2.  log value at n0 := out@n0
+3.  log value at a known offset (for example 3300rpm = 3600rpm - 300rpm) := out(n)
+4.  use y = (out(n) / out@n0 - 1) / dn
+
+    /speedcal/start does the same automatically: it steps the target speed through the range, fits a line out = a + b * dn
+    through the averaged readings and stores y = b / a. Every demodulated revolution is then corrected with
+
+    out@n0 = out(n) / (1 + y * dn)
 
-    to apply cal to a value
-    out@n0 = out * r(dn) = out * 1/(1 + dn*y)
+    y = 0 turns the compensation off.
 */
 
-//#define FM_motorTuneP 50.0f
+/*
+    Measurement snapshot
+
+    The value task publishes one snapshot per demodulated rotor revolution into one of two slots and then advances the
+    sequence number, the slot it writes next is never the one a reader gets pointed to. FM_getMeasurement copies the
+    newest slot without taking a lock and retries only if the writer moved on while it was copying. A reader that keeps
+    the sequence of its last copy can tell if anything new was measured since.
+*/
+typedef struct{
+    uint32_t sequence;      //increments with every published measurement
+    uint32_t time;          //ms since boot when the measurement was taken
+    float field;            //calibrated field
+    float reading;          //demodulated sensor reading after the speed compensation and the output filter
+    int32_t raw;            //the same rounded to ADC counts
+    uint32_t rpm;           //rotor speed at the time of the measurement
+} FM_Measurement_t;
 
 void FM_init();
 void FM_loadSettings();
-unsigned FM_isSampleUsable(uint64_t time);
-int32_t FM_getRaw();
-uint32_t FM_getMotorRPM();
-float FM_getField();
+void FM_getMeasurement(FM_Measurement_t * measurement);
+void FM_setTargetRPM(uint32_t rpm);
+void FM_setSpeedCompensation(float gain, uint32_t refRpm);
 
 extern unsigned FM_rotorPos;
 #endif
\ No newline at end of file
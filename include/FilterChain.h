@@ -0,0 +1,61 @@
+#ifndef FC_include
+#define FC_include
+#include <stdint.h>
+
+/*
+    Output filter chain
+
+    The demodulated reading of every revolution passes through up to FC_MAX_STAGES stages that are configured by a text
+    description, for example "median:5,avg:16,lowpass:1.5,decimate:4":
+
+    median:N        median of the last N readings (N = 3, 5, 7 or 9), rejects single spikes
+    avg:N           moving average of the last N readings (N = 1..FC_MAX_WINDOW), O(1) per reading
+    lowpass:F       2nd order Butterworth low-pass (biquad) with a cutoff of F Hz
+    decimate:N      passes only every Nth reading on, put it behind a filter that removes what would alias
+
+    All decisions are made once in FC_configure(): every stage type and median size has its own process function (the
+    median is instantiated for each N from one macro so the sort loops have constant bounds and unroll), the biquad
+    coefficients and the reciprocal of the averaging window are precomputed. Per reading only the bound functions run, no
+    parsing, switching or division. Stages start from their first reading instead of zero, so there is no ramp up.
+
+    host/filter_bench measures the cost per reading of different chains.
+*/
+
+#define FC_MAX_STAGES 6
+#define FC_MAX_WINDOW 256               //longest moving average
+#define FC_MAX_HISTORY 512              //readings all stages of a chain can keep in total
+
+typedef struct FC_Stage FC_Stage_t;
+typedef unsigned (*FC_Process_t)(FC_Stage_t * stage, float * value);
+
+struct FC_Stage{
+    FC_Process_t process;   //returns 0 if the reading is dropped (decimator)
+    float * history;        //part of the chain's history buffer, median and average only
+    uint32_t length;        //window length, median size or decimation factor
+    uint32_t index;
+    unsigned primed;        //the stage has seen its first reading
+    float sum;              //moving average
+    float scale;            //1 / length for the moving average
+    float b0, b1, b2, a1, a2;
+    float z1, z2;           //biquad state, transposed direct form II
+};
+
+typedef struct{
+    FC_Stage_t stages[FC_MAX_STAGES];
+    uint32_t count;
+    float history[FC_MAX_HISTORY];
+} FC_Chain_t;
+
+int FC_configure(FC_Chain_t * chain, const char * description, float sampleRate);
+void FC_reset(FC_Chain_t * chain);
+
+//returns 1 and the filtered reading in value, or 0 if a decimator dropped it
+static inline unsigned FC_process(FC_Chain_t * chain, float * value){
+    for(uint32_t i = 0; i < chain->count; i++){
+        FC_Stage_t * stage = &chain->stages[i];
+        if(!stage->process(stage, value)) return 0;
+    }
+    return 1;
+}
+
+#endif
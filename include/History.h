@@ -0,0 +1,42 @@
+#ifndef HI_include
+#define HI_include
+#include <stdint.h>
+
+/*
+    Measurement history
+
+    Every field reading is accumulated into 1s buckets. Each closed bucket is folded into the current 1min bucket and each
+    of those into the current 1h bucket, so every tier keeps min, max, mean and count of everything that was added during
+    the bucket. The tiers are rings of fixed length allocated statically, the history never needs more memory than
+    HI_MEMORY no matter how long the device runs. Buckets without readings are stored with a count of 0. A bucket is
+    closed by the first reading after it or by HI_advance(), which /history calls, so it also shows up once the readings
+    stop.
+
+    Times are seconds since boot, the device has no wall clock.
+
+    GET /history?tier=<0..2>[&since=<time>]
+        {"tier":t,"bucket":<seconds>,"newest":<time>,"entries":[[time,min,max,mean,count],...]}
+        oldest first. With since only buckets starting after that time are returned, passing the time of the last entry
+        of the previous response fetches only what's new.
+*/
+
+#define HI_TIER_COUNT 3
+#define HI_TIER_SECONDS {1, 60, 3600}
+#define HI_TIER_LENGTH {600, 720, 336}     //10 minutes, 12 hours and 14 days
+#define HI_TOTAL_ENTRIES (600 + 720 + 336)
+
+typedef struct{
+    float min;
+    float max;
+    float mean;
+    uint32_t count;
+} HI_Entry_t;
+
+#define HI_MEMORY (HI_TOTAL_ENTRIES * sizeof(HI_Entry_t))
+
+void HI_init();
+void HI_addValue(float value, uint32_t time);
+void HI_advance(uint32_t time);
+uint32_t HI_read(uint32_t tier, uint32_t fromTime, HI_Entry_t * entries, uint32_t * times, uint32_t maxEntries);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef JT_include
+#define JT_include
+#include <stdint.h>
+
+/*
+    Streaming JSON tokenizer
+
+    The input can be fed in chunks of any size, for example straight from httpd_req_recv(). For every token the callback
+    gets a slice pointing into the chunk, nothing is allocated and nothing is copied. Only a token that is split between two
+    chunks is collected in the parser's own buffer, so the memory needed is fixed to JT_MAX_TOKEN no matter how big the
+    document is.
+
+    Slices are only valid during the callback. Strings are handed out raw without the quotes, if token.escaped is set they
+    contain escape sequences and have to be decoded with JT_unescape().
+
+    The structure is validated while tokenizing, the parser never reads past the length of a chunk and doesn't need zero
+    terminated input, so it's safe to use on untrusted POST bodies.
+*/
+
+#define JT_MAX_DEPTH 16
+#define JT_MAX_TOKEN 160    //longest string or number that may be split between two chunks
+
+typedef enum{
+    JT_OBJECT_START,
+    JT_OBJECT_END,
+    JT_ARRAY_START,
+    JT_ARRAY_END,
+    JT_KEY,
+    JT_STRING,
+    JT_NUMBER,
+    JT_TRUE,
+    JT_FALSE,
+    JT_NULL
+} JT_TokenType_t;
+
+typedef enum{
+    JT_OK = 0,
+    JT_ERR_SYNTAX,
+    JT_ERR_DEPTH,
+    JT_ERR_TOKEN_TOO_LONG,
+    JT_ERR_INCOMPLETE,
+    JT_ERR_ABORTED
+} JT_Result_t;
+
+typedef struct{
+    JT_TokenType_t type;
+    const char * start;
+    uint32_t length;
+    uint32_t depth;         //number of containers around the token, start and end of a container have the depth outside of it
+    uint8_t escaped;
+} JT_Token_t;
+
+//returning anything but 0 stops the parser with JT_ERR_ABORTED
+typedef int (*JT_Callback_t)(void * ctx, const JT_Token_t * token);
+
+typedef struct{
+    JT_Callback_t callback;
+    void * ctx;
+    JT_Result_t error;
+    uint32_t position;      //number of bytes processed, points to the offending byte after an error
+    uint8_t expect;
+    uint8_t lex;
+    uint8_t escape;
+    uint8_t escaped;
+    uint32_t depth;
+    uint32_t objectMask;    //bit n is set if the container at depth n + 1 is an object
+    uint32_t partialLength;
+    char partial[JT_MAX_TOKEN];
+} JT_Parser_t;
+
+void JT_init(JT_Parser_t * parser, JT_Callback_t callback, void * ctx);
+JT_Result_t JT_feed(JT_Parser_t * parser, const char * data, uint32_t length);
+JT_Result_t JT_finish(JT_Parser_t * parser);
+uint32_t JT_unescape(const char * src, uint32_t length, char * dest, uint32_t destSize);
+unsigned JT_equals(const JT_Token_t * token, const char * string);
+const char * JT_errorString(JT_Result_t error);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef LD_include
+#define LD_include
+#include <stdint.h>
+
+/*
+    Live data push
+
+    Browsers open a websocket on /live and get the current measurement pushed to them instead of polling /measure.json.
+    Each client chooses its own update period by sending it in milliseconds as a text frame (for example "250"), until it
+    does so it gets LD_DEFAULT_PERIOD_MS.
+
+    An empty text frame is a keepalive, clients send one at least every LD_KEEPALIVE_MS. httpd only counts data it
+    receives as activity of a socket, without it a client that is only pushed to would be the first one the server
+    closes when all sockets are taken (lru_purge_enable).
+
+    The push task wakes up every LD_TICK_MS, serializes the measurement once if any client is due and hands that single
+    buffer to the httpd task, which sends it to all due clients. If the httpd task hasn't finished the previous update yet
+    the tick is skipped, so slow clients can't pile up work.
+
+    update format: {"t":<ms since boot>,"f":<field>,"r":<raw reading>,"n":<rpm>}
+*/
+
+#define LD_MAX_CLIENTS 6
+#define LD_TICK_MS 50               //fastest possible update period
+#define LD_DEFAULT_PERIOD_MS 500
+#define LD_MAX_PERIOD_MS 60000
+#define LD_MAX_PAYLOAD 96
+#define LD_KEEPALIVE_MS 10000       //live.js keepaliveMs
+
+void LD_init();
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LI_include
+#define LI_include
+#include <stdint.h>
+
+/*
+    Synchronous (lock-in) demodulator for the rotor signal
+
+    Every rotor revolution consists of one segment with the electrode exposed (rotorPos = 1) and one with it covered (rotorPos = 0).
+    Instead of flipping the sign of each sample and averaging over thousands of them, the samples of both segments are summed up
+    separately and the in-phase value of the revolution is calculated from the segment means:
+
+        inPhase = (mean(pos 1) - mean(pos 0)) / 2
+
+    Any offset of the ADC or the frontend is present in both means and cancels out, and a different number of samples in the two
+    segments no longer biases the result. The division by two keeps the value on the same scale as the old sign-flip average so
+    existing calibrations stay valid.
+
+    Every revolution is multiplied by gain before it goes into the average. The owner sets it between revolutions, the
+    field mill uses it to take out the dependence of the reading on the rotor speed.
+
+    Samples can also be added with a matched filter weight from the averaged rotor waveform (see Waveform.h). A revolution
+    that consists only of weighted samples is demodulated as
+
+        inPhase = sum(weight * (value - offset)) / sum(norm)
+
+    which is the least squares amplitude of the template in that revolution. On the plateaus the template is +-1 and the
+    result is on the same scale as the segment means above. Revolutions with unweighted samples use the segment means.
+
+    host/lockin_compare feeds a synthetic rotor signal through it and through the old sign-flip average and compares the
+    response to a step, the noise and the bias of both.
+*/
+
+typedef struct{
+    float weight;               //template value of the sample's phase bin divided by the bin's relative variance
+    float norm;                 //template value squared divided by the relative variance
+    float offset;               //midpoint of the plateaus, subtracted before weighting
+} LI_Weight_t;
+
+typedef struct{
+    int64_t segSum[2];          //sum of the samples of the current segment pair, indexed by rotorPos
+    uint32_t segCount[2];       //number of samples in each of the two segments
+    unsigned lastPos;
+    float matchedSum;           //sum of weight * (value - offset) of the current revolution
+    float matchedNorm;          //sum of norm of the current revolution
+    uint32_t matchedCount;      //weighted samples in the current revolution
+    float gain;                 //applied to every revolution, 1 unless changed with LI_setGain
+    float inPhase;              //demodulated value of the last complete revolution
+    float average;              //inPhase averaged over the configured number of revolutions
+    float alpha;
+    uint32_t cycleCount;        //number of revolutions that were demodulated
+    uint32_t droppedCycles;     //revolutions that were discarded because one segment had no samples
+    uint32_t matchedCycles;     //revolutions that were demodulated with the matched filter
+} LI_Demodulator_t;
+
+void LI_init(LI_Demodulator_t * li, uint32_t averagingCycles);
+void LI_reset(LI_Demodulator_t * li);
+void LI_setGain(LI_Demodulator_t * li, float gain);
+unsigned LI_addSample(LI_Demodulator_t * li, int32_t value, unsigned rotorPos);
+unsigned LI_addWeightedSample(LI_Demodulator_t * li, int32_t value, unsigned rotorPos, const LI_Weight_t * weight);
+
+#endif
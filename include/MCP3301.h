@@ -1,17 +1,35 @@
 #ifndef MCP_include
 #define MCP_include
 #include <stdint.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
+#include "SampleRing.h"
 
-xQueueHandle ADC_init();
-void ADC_setSampingRate(uint32_t samplingRate);
-uint16_t ADC_read();
+/*
+    MCP3301 13 bit ADC, sampled in bursts synchronous to the rotor
+
+    Only the driver in MCP3301.c touches the hardware. The sample format and the conversion of the raw result below don't
+    depend on it, so the host simulation produces the same samples as the ADC task.
+*/
+
+#define ADC_BURST_LEN 64 //maximum number of conversions done back to back in every rotor segment
+#define ADC_RING_DEPTH 512 //samples buffered between the ADC and the processing task, must be a power of two
 
 typedef struct{
     int32_t value;
     unsigned rotorPos;
-    uint64_t sampleTime;
+    uint64_t sampleTime;    //free running ADC timer (timer group 0 counter 1), the rotor edges are on the same time base
+    uint32_t edgeOffset;    //ADC timer ticks since the rotor edge that started the segment
 } ADC_Sample_t;
 
+//the result is 13 bit two's complement in the low bits of the transfer
+static inline int32_t ADC_signExtend(uint32_t raw){
+    return (raw & 0x1000) ? (int32_t) (raw | 0xfffff000) : (int32_t) (raw & 0xfff);
+}
+
+SR_Ring_t * ADC_init(uint32_t samplingRate, uint32_t deadtimePermille);
+void ADC_setRotorPeriod(uint64_t periodTicks);
+void ADC_setDeadtime(uint32_t deadtimePermille);
+void ADC_setSweep(uint32_t sweepSteps);
+void ADC_registerConsumer();
+void ADC_segmentStartFromISR(uint64_t edgeTime);
+
 #endif
\ No newline at end of file
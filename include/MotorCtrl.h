@@ -0,0 +1,47 @@
+#ifndef MC_include
+#define MC_include
+#include <stdint.h>
+
+/*
+    Rotor speed controller
+
+    Runs once for every measured rotor period, dt is that period, so the loop rate follows the rotor instead of a fixed
+    task delay. The output is the motor PWM duty in percent:
+
+        duty = feedForward * target + kp * e + I + kd * d(-rpm)/dt        e = target - rpm
+
+    - the feed forward term puts the motor close to the target duty on its own, so the integral only has to trim
+    - the derivative acts on the measurement, a change of the target doesn't kick the output
+    - the integral only grows while the error is inside integralBand and the output isn't saturated in the same direction
+      (conditional integration), it can't wind up while the motor is spinning up, stalled or slewing
+    - the output may change by at most slewRate %/s, that protects the driver and avoids current spikes
+
+    host/motor_sim runs it against a plant model of the motor and rotor to try tunings.
+*/
+
+typedef struct{
+    float kp;                   //%/rpm
+    float ki;                   //%/(rpm * s)
+    float kd;                   //%/(rpm / s)
+    float feedForward;          //% duty per rpm of target
+    float slewRate;             //maximum output change in %/s, 0 disables the limit
+    float integralBand;         //rpm, larger errors are left to the proportional and feed forward terms, 0 disables it
+    float outMin;               //%
+    float outMax;               //%
+} MC_Tuning_t;
+
+typedef struct{
+    MC_Tuning_t tuning;
+    float integral;             //% contributed by the integral term
+    float lastRpm;
+    float output;               //%
+    unsigned primed;            //lastRpm is valid
+    int saturated;              //1 if the last output was limited by outMax, -1 by outMin, 0 otherwise
+} MC_Controller_t;
+
+void MC_init(MC_Controller_t * mc, const MC_Tuning_t * tuning);
+void MC_setTuning(MC_Controller_t * mc, const MC_Tuning_t * tuning);
+void MC_reset(MC_Controller_t * mc, float target);
+float MC_update(MC_Controller_t * mc, float target, float rpm, float dt);
+
+#endif
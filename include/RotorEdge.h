@@ -0,0 +1,45 @@
+#ifndef RE_include
+#define RE_include
+#include <stdint.h>
+
+/*
+    Rotor edge filter and period measurement
+
+    Every edge of the interrupter is timestamped by the capture unit into a free running 32 bit counter, this module only
+    sees the captured timestamps and the edge polarity. Differences are taken modulo 2^32, so the counter overflowing
+    doesn't matter as long as a single period is shorter than a full counter cycle.
+
+    An edge is rejected if
+    - it has the same polarity as the last accepted one (the other edge of a glitch or a bounce)
+    - it comes sooner than 1/16 of the last period after the last accepted edge, like the old ISR did
+
+    A period is four accepted edges (two revolutions) and always starts on a rising edge, so it lines up with the rotorPos = 1
+    segment. A gap longer than half a period between two accepted edges (twice the expected quarter) means the rotor
+    stalled or an edge was missed, the measurement restarts on the next rising edge instead of reporting a wrong period.
+
+    host/edge_replay runs edge traces through it, host/traces has one with a bounce and a missing edge as a test.
+*/
+
+#define RE_EDGES_PER_PERIOD 4
+
+typedef enum{
+    RE_REJECTED,                //glitch or repeated polarity, ignore the edge
+    RE_EDGE,                    //valid edge, rotorPos changed
+    RE_PERIOD                   //valid edge that completed a period, see period
+} RE_Result_t;
+
+typedef struct{
+    uint32_t lastEdge;          //timestamp of the last accepted edge
+    uint32_t periodStart;       //timestamp of the rising edge that started the current period
+    uint32_t period;            //last complete period in timer ticks, 0 while there is none
+    uint32_t edgeCount;         //accepted edges in the current period, 0 while waiting for a rising edge to start one
+    unsigned level;             //polarity of the last accepted edge, the current rotorPos
+    unsigned started;           //at least one edge was accepted
+    uint32_t rejected;          //number of rejected edges
+    uint32_t restarts;          //number of measurements that were dropped because of a gap
+} RE_Filter_t;
+
+void RE_init(RE_Filter_t * re);
+RE_Result_t RE_addEdge(RE_Filter_t * re, uint32_t timestamp, unsigned level);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef RP_include
+#define RP_include
+#include <stdint.h>
+
+/*
+    Rotor phase prediction for the ADC scheduling
+
+    The ADC burst of every segment is started by a one shot alarm relative to the rotor edge. From the measured rotor period
+    the length of the next segment is predicted and the usable window between the two deadtimes is calculated. The burst is
+    sized so it fits completely into that window and centered in it, where the signal is the flattest:
+
+    edge |<- deadtime ->|<- pad ->|<- burstLen * convTicks ->|<- pad ->|<- deadtime ->| edge
+
+    The deadtime is set in permille of the segment, the fringing at the edges depends on the rotor angle and not on time.
+    While a sweep is set the deadtime is ignored and the burst moves from the start to the end of the whole segment in
+    sweepSteps steps, one per RP_nextSweep(), so the edges of the segment can be profiled.
+
+    All divisions happen here once per rotor period (or per burst for the conversion time), nothing is calculated per sample.
+    While sweeping, the consumer blanks the samples itself with RP_isInWindow() and the deadtime of the segment length it
+    knows, which RP_deadtimeTicks() converts once per block of samples.
+    host/rotorphase_check covers the edge cases: a stopped rotor, bursts that don't fit, the limits, the sweep wrap and
+    the window borders.
+*/
+
+typedef struct{
+    uint32_t startOffset;       //ticks from the segment edge to the first conversion
+    uint32_t burstLen;          //number of conversions that fit into the usable window, 0 if there is none
+    uint32_t convTicks;         //ticks one conversion takes
+} RP_Schedule_t;
+
+typedef struct{
+    uint32_t timerHz;           //frequency of the timer all ticks are counted in
+    uint32_t deadtimePermille;  //part of each segment that is blanked at both ends
+    uint32_t deadtime;          //deadtimePermille of the predicted segment in ticks
+    uint32_t sweepSteps;        //0 = burst centered in the window, otherwise the number of burst positions to sweep
+    uint32_t sweepPos;
+    uint32_t maxBurst;          //size of the sample buffer
+    uint32_t maxSampleRate;     //upper limit for the average number of conversions per second
+    uint32_t segmentTicks;      //predicted length of the next segment
+    uint32_t convTicks;         //measured duration of one conversion
+} RP_Predictor_t;
+
+void RP_init(RP_Predictor_t * rp, uint32_t timerHz, uint32_t deadtimePermille, uint32_t maxBurst, uint32_t maxSampleRate);
+void RP_updatePeriod(RP_Predictor_t * rp, uint64_t periodTicks);
+void RP_updateConversionTime(RP_Predictor_t * rp, uint32_t burstTicks, uint32_t burstLen);
+void RP_setDeadtime(RP_Predictor_t * rp, uint32_t deadtimePermille);
+void RP_setSweep(RP_Predictor_t * rp, uint32_t sweepSteps);
+void RP_nextSweep(RP_Predictor_t * rp);
+void RP_schedule(const RP_Predictor_t * rp, RP_Schedule_t * out);
+uint32_t RP_deadtimeTicks(uint32_t segmentTicks, uint32_t deadtimePermille);
+
+//a sample is usable if it is outside of the deadtime at both ends of its segment, see RP_deadtimeTicks()
+static inline unsigned RP_isInWindow(uint32_t edgeOffset, uint32_t segmentTicks, uint32_t deadtimeTicks){
+    return edgeOffset >= deadtimeTicks && edgeOffset + deadtimeTicks < segmentTicks;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SR_include
+#define SR_include
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+    Lock-free single-producer/single-consumer ring buffer
+
+    Exactly one task may write to the ring and exactly one task may read from it. Head and tail are free running counters that
+    are only ever written by one side, so no critical section is needed. Elements that don't fit into the ring are not written
+    and counted in overruns instead of disappearing silently.
+
+    The consumer can either copy elements out with SR_read() or work on them in place: SR_peek() returns the longest contiguous
+    block of readable elements and SR_consume() hands it back to the producer afterwards.
+
+    Only C11 atomics are used. host/ring_stress runs a producer and a consumer thread against each other and checks the
+    sequence of the elements and the overrun count, also under the thread sanitizer.
+*/
+
+typedef struct{
+    uint8_t * buffer;
+    uint32_t elemSize;
+    uint32_t mask;                  //depth - 1, depth has to be a power of two
+    _Atomic uint32_t head;          //total number of elements written by the producer
+    _Atomic uint32_t tail;          //total number of elements read by the consumer
+    _Atomic uint32_t overruns;      //elements dropped because the ring was full
+    _Atomic uint32_t highWater;     //highest fill level seen by the producer
+} SR_Ring_t;
+
+int SR_init(SR_Ring_t * ring, void * buffer, uint32_t elemSize, uint32_t depth);
+uint32_t SR_write(SR_Ring_t * ring, const void * elems, uint32_t count);
+uint32_t SR_read(SR_Ring_t * ring, void * elems, uint32_t maxCount);
+uint32_t SR_peek(SR_Ring_t * ring, void ** elems);
+void SR_consume(SR_Ring_t * ring, uint32_t count);
+uint32_t SR_fillLevel(SR_Ring_t * ring);
+
+#endif
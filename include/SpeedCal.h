@@ -0,0 +1,24 @@
+#ifndef SC_include
+#define SC_include
+#include <stdint.h>
+
+/*
+    Automatic motor speed compensation calibration
+
+    With a static field applied to the mill, GET /speedcal/start?low=3300&high=3900&steps=5&settle=5000&dwell=3000 steps the
+    target speed from low to high. At every step the motor gets settle ms to reach the speed and the reading to follow, then
+    the uncompensated readings and speeds are averaged over dwell ms. A line out = a + b * (n - ref) is fitted through the
+    points and y = b / a is stored as FM_speedGain with ref as FM_speedRefRPM. ref defaults to the configured target speed.
+
+    GET /speedcal/status returns the state, the measured points and the result. The target speed and the previous
+    compensation are restored when the calibration ends, also if it fails. While it runs the settings from the web UI are
+    refused, loading them would set the target speed and the compensation back in the middle of a step.
+*/
+
+#define SC_MAX_STEPS 16
+#define SC_MIN_SIGNAL 20.0f     //readings with a smaller intercept can't be calibrated, the applied field is too weak
+
+void SC_init();
+unsigned SC_isRunning();
+
+#endif
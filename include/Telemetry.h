@@ -0,0 +1,36 @@
+#ifndef TM_include
+#define TM_include
+#include <stdint.h>
+
+/*
+    Telemetry batches
+
+    Readings are collected and published as one MQTT message per batch to <MQTT_topic>/readings. Every reading carries the
+    time it was taken in ms since boot.
+
+    json: [[time,field,raw,rpm],...]
+    cbor: the same structure as a CBOR array of arrays, field is a float32, the other values are integers
+
+    The encoders only write into the buffer they're given, so this file doesn't depend on the rest of the firmware.
+*/
+
+#define TM_MAX_BATCH 100
+#define TM_MAX_READING_LENGTH 56    //longest json encoding of a single reading including the separator
+#define TM_MAX_MESSAGE (TM_MAX_BATCH * TM_MAX_READING_LENGTH + 2)
+
+typedef struct{
+    uint32_t time;
+    float field;
+    int32_t raw;
+    uint32_t rpm;
+} TM_Reading_t;
+
+typedef enum{
+    TM_FORMAT_JSON,
+    TM_FORMAT_CBOR
+} TM_Format_t;
+
+TM_Format_t TM_parseFormat(const char * name);
+uint32_t TM_encode(const TM_Reading_t * readings, uint32_t count, TM_Format_t format, uint8_t * buffer, uint32_t size);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef TR_include
+#define TR_include
+#include <stdint.h>
+
+/*
+    Fast transient (field change) detector
+
+    Runs on the unfiltered reading of every revolution, in parallel to the filtered output. The rate of change is the slope
+    over the last slopeWindow readings:
+
+        rate = (field[n] - field[n - slopeWindow]) / (time[n] - time[n - slopeWindow])
+
+    An event triggers when |rate| reaches rateThreshold or |field| reaches levelThreshold (0 disables either). All readings
+    go into a ring, the event window is the pre readings before the trigger, the trigger itself and the post readings after
+    it. TR_addReading() returns TR_TRIGGER right away so an alert can go out before the window is complete, and
+    TR_COMPLETE once the post readings are in. A new event can only trigger after the window is complete and both values
+    dropped below their thresholds again, so a slow field above the level doesn't trigger over and over.
+
+    TR_lastTrigger() and TR_copyWindow() hand out the last event, callers don't need to look into the ring.
+
+    host/signal_bench times it on the calibrated readings of a simulated run as the events stage.
+*/
+
+#define TR_RING 256                 //readings kept, power of two
+#define TR_MAX_WINDOW 64            //limit for pre and post each
+
+typedef enum{
+    TR_NONE,
+    TR_TRIGGER,                     //an event triggered with this reading
+    TR_COMPLETE                     //the post trigger readings of the event are complete
+} TR_Result_t;
+
+#define TR_CAUSE_RATE 0x01
+#define TR_CAUSE_LEVEL 0x02
+
+typedef struct{
+    uint64_t time;                  //us
+    float field;
+} TR_Reading_t;
+
+typedef struct{
+    uint32_t event;                 //number of the event, counts from 1
+    uint64_t time;                  //us, of the trigger reading
+    float field;
+    float rate;                     //rate at the trigger reading
+    unsigned cause;                 //TR_CAUSE_*
+} TR_Trigger_t;
+
+typedef struct{
+    TR_Reading_t ring[TR_RING];
+    uint32_t head;                  //total number of readings written
+    uint32_t slopeWindow;
+    float rateThreshold;            //field units per second
+    float levelThreshold;
+    uint32_t pre;
+    uint32_t post;
+    float rate;                     //rate of the last reading
+    unsigned armed;
+    unsigned recording;
+    uint32_t remaining;             //post readings still missing
+    uint32_t triggerHead;           //head at the trigger reading
+    TR_Trigger_t trigger;           //the last event
+    uint32_t events;
+} TR_Detector_t;
+
+void TR_init(TR_Detector_t * tr);
+void TR_configure(TR_Detector_t * tr, uint32_t slopeWindow, float rateThreshold, float levelThreshold, uint32_t pre, uint32_t post);
+TR_Result_t TR_addReading(TR_Detector_t * tr, uint64_t time, float field);
+void TR_lastTrigger(const TR_Detector_t * tr, TR_Trigger_t * trigger);
+uint32_t TR_copyWindow(const TR_Detector_t * tr, TR_Reading_t * out, uint32_t * triggerIndex);
+
+//the post readings of the last event are in (or there are none), TR_copyWindow() returns all of its window
+static inline unsigned TR_windowComplete(const TR_Detector_t * tr){
+    return tr->events > 0 && !tr->recording;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef WF_include
+#define WF_include
+#include <stdint.h>
+
+/*
+    Rotor synchronous waveform averager
+
+    Every sample is put into one of WF_BINS phase bins of the rotor cycle by its time since the segment edge: the first half
+    of the bins covers the rotorPos = 1 segment, the second half the rotorPos = 0 segment. Each bin keeps an exponential
+    average and variance of its samples, so averaging over many revolutions shows the induced waveform with the noise
+    averaged out. A contaminated electrode or a bent rotor shows up as asymmetric segments or uneven plateaus.
+
+    WF_update() derives the template from the averages. The plateaus are the central halves of the two segments, offset is
+    their midpoint and amplitude half their difference, which is the scale of the lock-in reading. The template is
+
+        shape = (mean - offset) / amplitude
+
+    +1 on the positive plateau, -1 on the negative one and smaller towards the edges. The shape only depends on the
+    geometry, so it is kept while the amplitude is too small to measure it (no field on the mill). The matched filter weight
+    of a bin is shape / variance with the variance relative to the average of all bins. Noisy bins and bins where the
+    signal is weak count less, as LI_addWeightedSample() expects.
+
+    host/signal_bench learns the template on simulated hardware and compares the matched filter readings with the plain
+    lock-in.
+*/
+
+#define WF_BINS 64
+#define WF_NO_BIN WF_BINS       //returned by WF_bin() for samples outside of the predicted segment
+
+typedef struct{
+    float mean[WF_BINS];        //average sample value of every bin
+    float var[WF_BINS];         //variance of the samples around the mean
+    uint32_t count[WF_BINS];    //samples that went into each bin
+    float shape[WF_BINS];       //template, +-1 on the plateaus
+    float weight[WF_BINS];      //matched filter weight, 0 for bins without enough samples
+    float norm[WF_BINS];        //shape * weight
+    float offset;               //midpoint of the two plateaus
+    float amplitude;            //half the difference of the two plateaus
+    float alpha;
+    uint32_t minCount;          //samples a bin needs to be used
+    float minAmplitude;         //smallest amplitude the shape is updated with
+    unsigned ready;             //a template was found, the weights can be used
+} WF_Averager_t;
+
+void WF_init(WF_Averager_t * wf, uint32_t averagingSamples, uint32_t minCount, float minAmplitude);
+uint32_t WF_bin(unsigned rotorPos, uint32_t edgeOffset, uint32_t segmentTicks);
+void WF_addSample(WF_Averager_t * wf, uint32_t bin, int32_t value);
+void WF_update(WF_Averager_t * wf);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_crc.h"
+#include "esp_partition.h"
+
+#include "AssetBundle.h"
+
+//has to match MIME_TYPES in tools/pack_assets.py
+static const char * AB_mimeTypes[] = {
+    "text/plain",
+    "text/html",
+    "text/css",
+    "text/javascript",
+    "image/x-icon",
+    "image/jpeg",
+    "application/pdf",
+    "image/svg+xml",
+    "image/png"
+};
+#define AB_MIME_COUNT (sizeof(AB_mimeTypes) / sizeof(AB_mimeTypes[0]))
+
+static const uint8_t * AB_bundle = NULL;
+static const AB_Entry_t * AB_index = NULL;
+static uint32_t AB_count = 0;
+static spi_flash_mmap_handle_t AB_mapHandle;
+
+static const char *TAG = "AssetBundle";
+
+static uint32_t AB_hash(const char * path, uint32_t length){
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < length; i++){
+        hash ^= (uint8_t) path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//maps the assets partition, returns an error and leaves the bundle disabled if it's missing or damaged
+esp_err_t AB_init(){
+    const esp_partition_t * partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, AB_PARTITION_SUBTYPE, "assets");
+    if(partition == NULL){
+        ESP_LOGW(TAG, "no assets partition, serving the web UI from SPIFFS");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void * mapped;
+    esp_err_t ret = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &AB_mapHandle);
+    if(ret != ESP_OK){
+        ESP_LOGE(TAG, "mapping the assets partition failed (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    const AB_Header_t * header = (const AB_Header_t *) mapped;
+    uint32_t indexEnd = sizeof(AB_Header_t) + header->count * sizeof(AB_Entry_t);
+    if(header->magic != AB_MAGIC || header->version != AB_VERSION || header->length > partition->size || header->length < indexEnd){
+        ESP_LOGW(TAG, "assets partition holds no valid bundle, serving the web UI from SPIFFS");
+        spi_flash_munmap(AB_mapHandle);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    uint32_t crc = esp_crc32_le(0, (const uint8_t *) mapped + sizeof(AB_Header_t), header->length - sizeof(AB_Header_t));
+    if(crc != header->crc){
+        ESP_LOGE(TAG, "asset bundle is damaged, serving the web UI from SPIFFS");
+        spi_flash_munmap(AB_mapHandle);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    //every entry has to point into the bundle, after this the request path doesn't need to check anything
+    const AB_Entry_t * index = (const AB_Entry_t *) (header + 1);
+    for(uint32_t i = 0; i < header->count; i++){
+        const AB_Entry_t * entry = &index[i];
+        if(entry->pathOffset + entry->pathLength > header->length || entry->offset + entry->length > header->length ||
+           entry->gzipOffset + entry->gzipLength > header->length || (i > 0 && index[i - 1].hash >= entry->hash)){
+            ESP_LOGE(TAG, "asset bundle index is invalid, serving the web UI from SPIFFS");
+            spi_flash_munmap(AB_mapHandle);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    AB_bundle = (const uint8_t *) mapped;
+    AB_index = index;
+    AB_count = header->count;
+    ESP_LOGI(TAG, "mapped %u assets (%u bytes)", AB_count, header->length);
+    return ESP_OK;
+}
+
+//looks up a path like "/readout.html", the path doesn't have to be zero terminated
+unsigned AB_find(const char * path, uint32_t pathLength, AB_Asset_t * asset){
+    if(AB_bundle == NULL) return 0;
+
+    uint32_t hash = AB_hash(path, pathLength);
+    uint32_t low = 0;
+    uint32_t high = AB_count;
+    while(low < high){
+        uint32_t mid = (low + high) >> 1;
+        if(AB_index[mid].hash < hash) low = mid + 1;
+        else high = mid;
+    }
+    if(low >= AB_count || AB_index[low].hash != hash) return 0;
+
+    const AB_Entry_t * entry = &AB_index[low];
+    if(entry->pathLength != pathLength || memcmp(AB_bundle + entry->pathOffset, path, pathLength) != 0) return 0;
+
+    asset->data = (const char *) AB_bundle + entry->offset;
+    asset->length = entry->length;
+    asset->gzipData = (const char *) AB_bundle + entry->gzipOffset;
+    asset->gzipLength = entry->gzipLength;
+    asset->mime = AB_mimeTypes[(entry->mime < AB_MIME_COUNT) ? entry->mime : 0];
+    sprintf(asset->etag, "\"%08x\"", entry->crc);
+    sprintf(asset->gzipEtag, "\"%08x\"", entry->gzipCrc);
+    return 1;
+}
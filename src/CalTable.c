@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "CalTable.h"
+#include "JsonTok.h"
+
+#define CT_LOADER_INITIAL_POINTS 32
+
+//returns NULL if there are less than two points or the allocation failed
+CT_Table_t * CT_build(const CT_Point_t * points, uint32_t count){
+    if(points == 0 || count < 2) return 0;
+
+    uint32_t searchSize = 1;
+    while(searchSize < count) searchSize <<= 1;
+
+    //header and all three arrays are kept in one allocation
+    CT_Table_t * table = malloc(sizeof(CT_Table_t) + sizeof(float) * (searchSize + count * 2));
+    if(table == 0) return 0;
+    table->count = count;
+    table->searchSize = searchSize;
+    table->reading = (float *) (table + 1);
+    table->field = table->reading + searchSize;
+    table->slope = table->field + count;
+
+    //insertion sort by sensor reading, calibration sets are small and usually sorted already
+    for(uint32_t i = 0; i < count; i++){
+        float x = (float) points[i].sensorReading;
+        float y = points[i].appliedField;
+        uint32_t j = i;
+        while(j > 0 && table->reading[j - 1] > x){
+            table->reading[j] = table->reading[j - 1];
+            table->field[j] = table->field[j - 1];
+            j--;
+        }
+        table->reading[j] = x;
+        table->field[j] = y;
+    }
+    for(uint32_t i = count; i < searchSize; i++) table->reading[i] = FLT_MAX;
+
+    for(uint32_t i = 0; i < count - 1; i++){
+        float dx = table->reading[i + 1] - table->reading[i];
+        table->slope[i] = (dx != 0.0f) ? (table->field[i + 1] - table->field[i]) / dx : 0.0f;
+    }
+    table->slope[count - 1] = table->slope[count - 2];
+
+    return table;
+}
+
+void CT_free(CT_Table_t * table){
+    free(table);
+}
+
+float CT_scale(const CT_Table_t * table, float reading){
+    const float * x = table->reading;
+    uint32_t i = 0;
+
+    //find the last segment starting at or below the reading, i stays 0 if the reading is below the first point
+    for(uint32_t step = table->searchSize >> 1; step > 0; step >>= 1){
+        i += (x[i + step] <= reading) ? step : 0;
+    }
+
+    return table->field[i] + (reading - x[i]) * table->slope[i];
+}
+
+//tokens aren't terminated, numbers are copied so strtof() can be used. Returns 0 if the number is too long to make sense
+static unsigned CT_tokenToFloat(const JT_Token_t * token, float * value){
+    char buffer[32];
+    if(token->length >= sizeof(buffer)) return 0;
+    memcpy(buffer, token->start, token->length);
+    buffer[token->length] = 0;
+    *value = strtof(buffer, NULL);
+    return 1;
+}
+
+static int CT_loaderToken(void * ctx, const JT_Token_t * token){
+    CT_Loader_t * loader = ctx;
+
+    if(token->depth == 0) return !(token->type == JT_OBJECT_START || token->type == JT_OBJECT_END);
+    if(token->depth == 1){
+        if(token->type == JT_KEY) loader->inDatapoints = JT_equals(token, "Datapoints");
+        return 0;
+    }
+    if(!loader->inDatapoints) return 0;
+
+    if(token->depth == 2){
+        if(token->type == JT_ARRAY_START){
+            loader->pointValues = 0;
+            return 0;
+        }
+        if(token->type != JT_ARRAY_END || loader->pointValues != 2) return 1;
+
+        if(loader->count >= loader->capacity){
+            CT_Point_t * points = realloc(loader->points, sizeof(CT_Point_t) * loader->capacity * 2);
+            if(points == 0){
+                loader->outOfMemory = 1;
+                return 1;
+            }
+            loader->points = points;
+            loader->capacity *= 2;
+        }
+        loader->points[loader->count++] = loader->point;
+        return 0;
+    }
+
+    float value;
+    if(token->depth != 3 || token->type != JT_NUMBER || loader->pointValues >= 2 || !CT_tokenToFloat(token, &value)) return 1;
+    if(loader->pointValues == 0) loader->point.sensorReading = (int32_t) value;
+    else loader->point.appliedField = value;
+    loader->pointValues++;
+    return 0;
+}
+
+//returns NULL if the allocation failed
+CT_Loader_t * CT_createLoader(){
+    CT_Loader_t * loader = malloc(sizeof(CT_Loader_t));
+    CT_Point_t * points = malloc(sizeof(CT_Point_t) * CT_LOADER_INITIAL_POINTS);
+    if(loader == 0 || points == 0){
+        free(loader); free(points);
+        return 0;
+    }
+    memset(loader, 0, sizeof(CT_Loader_t));
+    loader->points = points;
+    loader->capacity = CT_LOADER_INITIAL_POINTS;
+    JT_init(&loader->parser, CT_loaderToken, loader);
+    return loader;
+}
+
+//ends the document, the points and count are only valid if JT_OK is returned
+JT_Result_t CT_finishLoader(CT_Loader_t * loader){
+    return JT_finish(&loader->parser);
+}
+
+//frees the loader and the points it still owns, set points to NULL before to keep them
+void CT_freeLoader(CT_Loader_t * loader){
+    free(loader->points);
+    free(loader);
+}
@@ -0,0 +1,224 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+
+#include "Capture.h"
+#include "FieldMill.h"
+#include "server.h"
+
+/*
+    The buffer is used as a ring of CAP_length records while the capture is armed, so the records from before the trigger
+    are always the newest ones. Once the capture is done the value task doesn't touch the buffer anymore and it can be sent
+    without holding the lock. Start and download are both http handlers and never run at the same time.
+*/
+static CAP_Record_t * CAP_buffer = NULL;
+static uint32_t CAP_capacity = 0;       //records the buffer holds, 0 without a buffer
+static volatile CAP_State_t CAP_state = CAP_IDLE;
+static portMUX_TYPE CAP_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t CAP_length = 0;         //records in the current capture
+static uint32_t CAP_preRecords = 0;     //records to keep from before the trigger
+static uint32_t CAP_writeIndex = 0;
+static uint32_t CAP_written = 0;        //records written since the capture was started
+static uint32_t CAP_remaining = 0;      //records still to be written before the capture is done
+static uint32_t CAP_triggerSlot = 0;
+static int32_t CAP_level = 0;
+static uint32_t CAP_lastTime = 0;
+
+#define CAP_LOCK_CHUNK 16               //samples written per critical section
+
+static const char *TAG = "Capture";
+
+//writes one record, the caller holds CAP_lock
+static inline void CAP_addSample(const ADC_Sample_t * sample){
+    uint32_t slot = CAP_writeIndex;
+    CAP_Record_t * record = &CAP_buffer[slot];
+
+    uint32_t time = (uint32_t) sample->sampleTime;
+    int32_t value = sample->value;
+    if(value > INT16_MAX) value = INT16_MAX;
+    if(value < INT16_MIN) value = INT16_MIN;
+    record->sampleTime = time;
+    record->value = (int16_t) value;
+    record->rotorPos = sample->rotorPos;
+    record->edgeOffset = sample->edgeOffset;
+    record->flags = (CAP_written > 0 && time < CAP_lastTime) ? CAP_FLAG_TIMER_RESTART : 0;
+    CAP_lastTime = time;
+
+    CAP_writeIndex = (slot + 1 == CAP_length) ? 0 : slot + 1;
+    CAP_written++;
+
+    if(CAP_state == CAP_ARMED){
+        //the trigger is only checked once there's enough history in the buffer
+        if(CAP_written <= CAP_preRecords || abs(value) < CAP_level) return;
+        record->flags |= CAP_FLAG_TRIGGER;
+        CAP_triggerSlot = slot;
+        CAP_remaining = CAP_length - CAP_preRecords - 1;
+        CAP_state = (CAP_remaining == 0) ? CAP_DONE : CAP_RECORDING;
+    }else if(--CAP_remaining == 0){
+        CAP_state = CAP_DONE;
+    }
+}
+
+/*
+    called by the value task for every block of samples it takes from the ADC. The lock is only held for
+    CAP_LOCK_CHUNK samples at a time so the ADC and capture interrupts on this core aren't held off for a whole block.
+    A capture restarted between two chunks just continues with the next sample.
+*/
+void CAP_addSamples(const ADC_Sample_t * samples, uint32_t count){
+    CAP_State_t state = CAP_state;
+    if(state != CAP_ARMED && state != CAP_RECORDING) return;
+
+    uint32_t i = 0;
+    while(i < count){
+        uint32_t end = (count - i > CAP_LOCK_CHUNK) ? i + CAP_LOCK_CHUNK : count;
+        portENTER_CRITICAL(&CAP_lock);
+        state = CAP_state;
+        for(; i < end && (state == CAP_ARMED || state == CAP_RECORDING); i++){
+            CAP_addSample(&samples[i]);
+            state = CAP_state;
+        }
+        portEXIT_CRITICAL(&CAP_lock);
+        if(state != CAP_ARMED && state != CAP_RECORDING) return;
+    }
+}
+
+static const char * CAP_stateName(CAP_State_t state){
+    switch(state){
+        case CAP_IDLE: return "idle";
+        case CAP_ARMED: return "armed";
+        case CAP_RECORDING: return "recording";
+        case CAP_DONE: return "done";
+    }
+    return "unknown";
+}
+
+static esp_err_t CAP_statusHandler(httpd_req_t *req){
+    char buff[96];
+    uint32_t records = (CAP_written < CAP_length) ? CAP_written : CAP_length;
+    snprintf(buff, sizeof(buff), "{\"state\":\"%s\",\"records\":%d,\"capacity\":%d}", CAP_stateName(CAP_state), records, CAP_capacity);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buff);
+}
+
+static esp_err_t CAP_sendUnavailable(httpd_req_t *req){
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "no memory for the capture buffer");
+}
+
+static esp_err_t CAP_startHandler(httpd_req_t *req){
+    if(CAP_buffer == NULL) return CAP_sendUnavailable(req);
+
+    uint32_t duration = 500;
+    int32_t level = 0;
+    uint32_t pre = 0;
+
+    char query[96];
+    char value[16];
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK){
+        if(httpd_query_key_value(query, "duration", value, sizeof(value)) == ESP_OK) duration = strtoul(value, NULL, 10);
+        if(httpd_query_key_value(query, "level", value, sizeof(value)) == ESP_OK) level = strtol(value, NULL, 10);
+        if(httpd_query_key_value(query, "pre", value, sizeof(value)) == ESP_OK) pre = strtoul(value, NULL, 10);
+    }
+
+    //the duration is converted at the maximum sample rate, a capture at a lower rate covers more time
+    if(duration > 60000) duration = 60000;
+    uint32_t length = duration * (FM_CONF_MAX_SAMPLERATE / 1000);
+    if(length < 1) length = 1;
+    if(length > CAP_capacity) length = CAP_capacity;
+
+    uint32_t preRecords = 0;
+    if(level > 0){
+        if(pre > 100) pre = 100;
+        preRecords = length * pre / 100;
+        if(preRecords >= length) preRecords = length - 1;
+    }
+
+    portENTER_CRITICAL(&CAP_lock);
+    CAP_length = length;
+    CAP_preRecords = preRecords;
+    CAP_level = level;
+    CAP_writeIndex = 0;
+    CAP_written = 0;
+    CAP_triggerSlot = 0;
+    CAP_remaining = length;
+    CAP_state = (level > 0) ? CAP_ARMED : CAP_RECORDING;
+    portEXIT_CRITICAL(&CAP_lock);
+
+    ESP_LOGI(TAG, "capturing %d records, trigger level %d, %d before the trigger", length, level, preRecords);
+    return CAP_statusHandler(req);
+}
+
+static esp_err_t CAP_downloadHandler(httpd_req_t *req){
+    if(CAP_buffer == NULL) return CAP_sendUnavailable(req);
+    if(CAP_state != CAP_DONE){
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No finished capture");
+        return ESP_OK;
+    }
+
+    //if the ring wrapped the oldest record is the one that would have been overwritten next
+    uint32_t count = (CAP_written < CAP_length) ? CAP_written : CAP_length;
+    uint32_t first = (CAP_written < CAP_length) ? 0 : CAP_writeIndex;
+
+    CAP_FileHeader_t header = {
+        .magic = CAP_FILE_MAGIC,
+        .version = CAP_FILE_VERSION,
+        .recordSize = sizeof(CAP_Record_t),
+        .recordCount = count,
+        .triggerIndex = (CAP_level > 0) ? (CAP_triggerSlot + CAP_length - first) % CAP_length : 0,
+        .timerHz = TIMER_BASE_CLK / 2,
+        .triggerLevel = CAP_level
+    };
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"capture.bin\"");
+    if(httpd_resp_send_chunk(req, (const char *) &header, sizeof(header)) != ESP_OK) return ESP_FAIL;
+
+    uint32_t tail = (first + count > CAP_length) ? CAP_length - first : count;
+    if(httpd_resp_send_chunk(req, (const char *) &CAP_buffer[first], tail * sizeof(CAP_Record_t)) != ESP_OK) return ESP_FAIL;
+    if(count > tail && httpd_resp_send_chunk(req, (const char *) CAP_buffer, (count - tail) * sizeof(CAP_Record_t)) != ESP_OK) return ESP_FAIL;
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void CAP_init(){
+    //without PSRAM the heap is fragmented enough that the full buffer often doesn't fit in one block
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t capacity = (largest > CAP_HEAP_RESERVE) ? (largest - CAP_HEAP_RESERVE) / sizeof(CAP_Record_t) : 0;
+    if(capacity > CAP_MAX_RECORDS) capacity = CAP_MAX_RECORDS;
+    if(capacity >= CAP_MIN_RECORDS) CAP_buffer = malloc(sizeof(CAP_Record_t) * capacity);
+
+    if(CAP_buffer == NULL){
+        ESP_LOGE(TAG, "no memory for the capture buffer, capturing is disabled");
+    }else{
+        CAP_capacity = capacity;
+        ESP_LOGI(TAG, "capture buffer holds %d records", capacity);
+    }
+
+    httpd_handle_t server = SERVER_getServer();
+
+    httpd_uri_t start = {
+        .uri       = "/capture/start",
+        .method    = HTTP_GET,
+        .handler   = CAP_startHandler
+    };
+    httpd_register_uri_handler(server, &start);
+
+    httpd_uri_t status = {
+        .uri       = "/capture/status",
+        .method    = HTTP_GET,
+        .handler   = CAP_statusHandler
+    };
+    httpd_register_uri_handler(server, &status);
+
+    httpd_uri_t download = {
+        .uri       = "/capture.bin",
+        .method    = HTTP_GET,
+        .handler   = CAP_downloadHandler
+    };
+    httpd_register_uri_handler(server, &download);
+}
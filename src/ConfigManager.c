@@ -1,355 +1,585 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <math.h>
 
+#include "freertos/FreeRTOS.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_crc.h"
+#include "nvs.h"
 #include "ConfigManager.h"
+#include "CalTable.h"
+#include "JsonTok.h"
 #include "FieldMill.h"
+#include "SpeedCal.h"
 #include "esp_http_server.h"
 #include "WiFi.h"
 
 static const char *TAG = "config_manager";
 
-CalPoint * calData = NULL;
-uint32_t calDataCount = 0;
+static void CFM_syncFile(const char * path, void (*print)(FILE *));
+static void CFM_printSettings(FILE * sf);
+static void CFM_printCal(FILE * cf);
 
-SettingsItem * settings = NULL;
-uint32_t settingsCount = 0;
+CT_Point_t * calData = NULL;
+uint32_t calDataCount = 0;
 
-SettingsItem* CFM_getSetting(char* key){
-    for (uint32_t i = 0; i < settingsCount; i++){
-        if(settings[i].key == 0) continue;
-        if(strcmp(settings[i].key, key) == 0 && strlen(key) == strlen(settings[i].key)) return &settings[i];
-    }
-    return 0;
+//compiled from calData whenever a new calibration is loaded, swapped under the lock so readers never see a freed table
+static CT_Table_t * calTable = NULL;
+static portMUX_TYPE calTableLock = portMUX_INITIALIZER_UNLOCKED;
+
+#define CFM_DESC_INT(name, def, min, max) {#name, CFM_TYPE_INT, offsetof(CFM_Settings_t, name), sizeof(int32_t), min, max, def, NULL},
+#define CFM_DESC_FLOAT(name, def, min, max) {#name, CFM_TYPE_FLOAT, offsetof(CFM_Settings_t, name), sizeof(float), min, max, def, NULL},
+#define CFM_DESC_BOOL(name, def) {#name, CFM_TYPE_BOOL, offsetof(CFM_Settings_t, name), sizeof(uint8_t), 0, 1, def, NULL},
+#define CFM_DESC_STRING(name, def, len) {#name, CFM_TYPE_STRING, offsetof(CFM_Settings_t, name), len + 1, 0, len, 0, def},
+static const CFM_SettingDesc_t settingsDesc[CFM_SETTINGS_COUNT] = {
+    CFM_SETTINGS_LIST(CFM_DESC_INT, CFM_DESC_FLOAT, CFM_DESC_BOOL, CFM_DESC_STRING)
+};
+
+static CFM_Settings_t settings;
+
+//set when the web UI reports changed network settings in a POST, these are never stored
+static unsigned settingsWifiChanged = 0;
+static unsigned settingsMqttChanged = 0;
+
+/*
+    Keys are looked up with a perfect hash. At startup a seed is searched that maps every key into its own slot of the
+    table, after that finding a key takes one hash and one compare.
+*/
+#define CFM_HASH_SIZE 256
+#define CFM_HASH_MAX_SEEDS 10000
+static uint8_t settingsHash[CFM_HASH_SIZE];     //index + 1 of the setting in each slot, 0 if the slot is empty
+static uint32_t settingsHashSeed = 0;
+static unsigned settingsHashValid = 0;
+
+/*
+    Binary records in NVS
+
+    Settings and calibration are stored as a versioned record with a checksum in the nvs partition, so booting doesn't
+    require reading and parsing the JSON files from SPIFFS. Each record consists of two blobs, the header (<name>Hdr) and
+    the payload (<name>). The payload is written first, if power is lost before the header is updated the checksum won't
+    match and the JSON file is imported again.
+
+    settings record: CFM_Settings_t. The header carries a hash of the key, type, offset and size of every setting, a record
+                     with a different layout (settings were added, removed, reordered or changed their type) is imported
+                     from JSON again. The values of a record are clamped to their limits like the ones from JSON
+    cal record: array of CT_Point_t, with a hash of the point layout
+*/
+#define CFM_NVS_NAMESPACE "fieldmill"
+#define CFM_RECORD_MAGIC 0x46434d46 //"FMCF"
+#define CFM_RECORD_VERSION 3
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t layout;        //hash of the structure of the payload
+} CFM_RecordHeader_t;
+
+const CFM_Settings_t * CFM_getSettings(){
+    return &settings;
 }
 
-float CFM_scaleMeasurement(int32_t reading){
-    if(calDataCount < 2) return -1;
+const CFM_SettingDesc_t * CFM_getSettingDesc(CFM_Setting_t setting){
+    if(setting >= CFM_SETTINGS_COUNT) return NULL;
+    return &settingsDesc[setting];
+}
 
-    if(reading < calData[0].sensorReading){
-        int32_t base = reading - calData[0].sensorReading;
-        float ret = calData[0].appliedField + (float) base * calData[0].inclination;
-        //ESP_LOGI(TAG, "apply cal: %d => %f (i=%d SR=%d AF=%f incl=%f)", reading, ret, i, calData[i].sensorReading, calData[i].appliedField, calData[i].inclination);
-        return ret;
+static uint32_t CFM_hashKey(const char * key, uint32_t length, uint32_t seed){
+    uint32_t hash = 2166136261u ^ seed;
+    for(uint32_t i = 0; i < length; i++){
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
     }
+    return (hash ^ (hash >> 16)) & (CFM_HASH_SIZE - 1);
+}
 
-    uint32_t i = calDataCount-1;
-    for (; i >= 0; i--){
-        if(reading > calData[i].sensorReading){
-            int32_t base = reading - calData[i].sensorReading;
-            float ret = calData[i].appliedField + (float) base * calData[(i == calDataCount - 1) ? (i-1) : i].inclination;
-            //ESP_LOGI(TAG, "apply cal: %d => %f (i=%d SR=%d AF=%f incl=%f)", reading, ret, i, calData[i].sensorReading, calData[i].appliedField, calData[i].inclination);
-            return ret;
+static void CFM_buildSettingsHash(){
+    for(uint32_t seed = 0; seed < CFM_HASH_MAX_SEEDS; seed++){
+        memset(settingsHash, 0, sizeof(settingsHash));
+        unsigned collision = 0;
+        for(uint32_t i = 0; i < CFM_SETTINGS_COUNT; i++){
+            uint32_t slot = CFM_hashKey(settingsDesc[i].key, strlen(settingsDesc[i].key), seed);
+            if(settingsHash[slot] != 0){
+                collision = 1;
+                break;
+            }
+            settingsHash[slot] = i + 1;
+        }
+        if(!collision){
+            settingsHashSeed = seed;
+            settingsHashValid = 1;
+            return;
         }
     }
+    ESP_LOGE(TAG, "no perfect hash found for the settings, falling back to a linear search");
+}
+
+//returns the index of the setting with the given key or -1. The key doesn't have to be zero terminated
+static int32_t CFM_findSetting(const char * key, uint32_t length){
+    if(settingsHashValid){
+        uint8_t index = settingsHash[CFM_hashKey(key, length, settingsHashSeed)];
+        if(index == 0) return -1;
+        const char * candidate = settingsDesc[index - 1].key;
+        return (strncmp(candidate, key, length) == 0 && candidate[length] == 0) ? index - 1 : -1;
+    }
 
+    for(uint32_t i = 0; i < CFM_SETTINGS_COUNT; i++){
+        if(strncmp(settingsDesc[i].key, key, length) == 0 && settingsDesc[i].key[length] == 0) return i;
+    }
     return -1;
 }
 
-static void CFM_loadCal(char * data){
-    if(data == 0) return;
-    ESP_LOGI(TAG, "loading");
+static void CFM_setDefaults(CFM_Settings_t * target){
+    memset(target, 0, sizeof(CFM_Settings_t));
+    for(uint32_t i = 0; i < CFM_SETTINGS_COUNT; i++){
+        const CFM_SettingDesc_t * desc = &settingsDesc[i];
+        uint8_t * value = (uint8_t *) target + desc->offset;
+        switch(desc->type){
+            case CFM_TYPE_INT: *(int32_t *) value = (int32_t) desc->def; break;
+            case CFM_TYPE_FLOAT: *(float *) value = desc->def; break;
+            case CFM_TYPE_BOOL: *value = desc->def != 0.0f; break;
+            case CFM_TYPE_STRING: strlcpy((char *) value, desc->defString, desc->size); break;
+        }
+    }
+}
+
+//converts the value to the type of the setting and clamps it to the limits. Unknown keys are ignored
+static void CFM_setValue(CFM_Settings_t * target, const char * key, uint32_t keyLength, const char * value, uint32_t valueLength){
+    int32_t index = CFM_findSetting(key, keyLength);
+    if(index < 0){
+        if(keyLength == strlen("WIFICHANGED") && strncmp(key, "WIFICHANGED", keyLength) == 0) settingsWifiChanged = 1;
+        else if(keyLength == strlen("MQTTCHANGED") && strncmp(key, "MQTTCHANGED", keyLength) == 0) settingsMqttChanged = 1;
+        else ESP_LOGI(TAG, "ignoring unknown setting \"%.*s\"", keyLength, key);
+        return;
+    }
 
-    char * values = CFM_parseJSON(data, "Datapoints");
-    if(values == 0) return;
+    const CFM_SettingDesc_t * desc = &settingsDesc[index];
+    uint8_t * dest = (uint8_t *) target + desc->offset;
+    if(desc->type == CFM_TYPE_STRING){
+        uint32_t length = (valueLength < desc->size - 1) ? valueLength : desc->size - 1;
+        memcpy(dest, value, length);
+        dest[length] = 0;
+        return;
+    }
 
-    if(calData != 0) free(calData);
-    calData = malloc(sizeof(CalPoint) * 100);
-    memset(calData, 0, sizeof(CalPoint) * 100);
-    uint32_t currData = 0;
+    //numbers are short, copy them so the conversion functions get a terminated string
+    char buffer[32];
+    uint32_t length = (valueLength < sizeof(buffer) - 1) ? valueLength : sizeof(buffer) - 1;
+    memcpy(buffer, value, length);
+    buffer[length] = 0;
 
-    char * start = strchr(values, '[') + 1;
-    if(start == 0){
-        free(values);
+    if(desc->type == CFM_TYPE_BOOL){
+        *dest = (strcmp(buffer, "true") == 0 || strcmp(buffer, "1") == 0);
         return;
-    } 
+    }
 
-    while(1){
-        start = strchr(start, '[');
-        if(start == 0){
-            free(values);
-            return;
-        } 
-        start++;
-        char * end = strchr(start, ']');
-        char * sep = strchr(start, ',');
-
-        if(sep > end || end == 0 || sep == 0){
-            ESP_LOGI(TAG, "got weird data for calbration! %s", start);
-            free(values);
-            return;
+    if(desc->type == CFM_TYPE_INT){
+        int32_t number = (int32_t) strtol(buffer, NULL, 10);
+        if(number < (int32_t) desc->min) number = (int32_t) desc->min;
+        if(number > (int32_t) desc->max) number = (int32_t) desc->max;
+        *(int32_t *) dest = number;
+    }else{
+        float number = strtof(buffer, NULL);
+        if(number < desc->min) number = desc->min;
+        if(number > desc->max) number = desc->max;
+        *(float *) dest = number;
+    }
+}
+
+//puts every value into the limits CFM_setValue() enforces, for settings that didn't come through it
+static void CFM_clampSettings(CFM_Settings_t * target){
+    for(uint32_t i = 0; i < CFM_SETTINGS_COUNT; i++){
+        const CFM_SettingDesc_t * desc = &settingsDesc[i];
+        uint8_t * value = (uint8_t *) target + desc->offset;
+        switch(desc->type){
+            case CFM_TYPE_INT:{
+                int32_t * number = (int32_t *) value;
+                if(*number < (int32_t) desc->min) *number = (int32_t) desc->min;
+                if(*number > (int32_t) desc->max) *number = (int32_t) desc->max;
+                break;
+            }
+            case CFM_TYPE_FLOAT:{
+                float * number = (float *) value;
+                if(isnan(*number)) *number = desc->def;
+                if(*number < desc->min) *number = desc->min;
+                if(*number > desc->max) *number = desc->max;
+                break;
+            }
+            case CFM_TYPE_BOOL: *value = (*value != 0); break;
+            case CFM_TYPE_STRING: value[desc->size - 1] = 0; break;
         }
+    }
+}
+
+float CFM_scaleMeasurement(float reading){
+    float ret = -1;
+    portENTER_CRITICAL(&calTableLock);
+    if(calTable != NULL) ret = CT_scale(calTable, reading);
+    portEXIT_CRITICAL(&calTableLock);
+    return ret;
+}
 
-        uint32_t yLen = end - 1 - sep;
-        char * yChar = malloc(yLen + 1);
-        memcpy(yChar, sep + 1, yLen);
-        yChar[yLen] = 0;
+static void CFM_buildCalTable(){
+    CT_Table_t * newTable = CT_build(calData, calDataCount);
+    if(newTable == NULL) ESP_LOGI(TAG, "calibration needs at least two points, readings won't be scaled");
 
-        uint32_t xLen = sep - start;
-        char * xChar = malloc(xLen + 1);
-        memcpy(xChar, start, xLen);
-        xChar[xLen] = 0;
+    portENTER_CRITICAL(&calTableLock);
+    CT_Table_t * oldTable = calTable;
+    calTable = newTable;
+    portEXIT_CRITICAL(&calTableLock);
 
-        calData[currData].appliedField = atof(yChar);
-        calData[currData].sensorReading = (uint32_t) atof(xChar);
+    CT_free(oldTable);
+}
 
-        if(currData > 0){
-            int32_t dx = (calData[currData].sensorReading - calData[currData - 1].sensorReading);
-            float dy = (calData[currData].appliedField - calData[currData - 1].appliedField);
-            calData[currData-1].inclination = dy / (float) dx;
-            ESP_LOGI(TAG, "Got new calibration data: %f %d incl %f (dX = %d, dY = %f)", calData[currData-1].appliedField, calData[currData-1].sensorReading, calData[currData-1].inclination, dx, dy);
+/*
+    Loaders
+
+    Both JSON documents are tokenized with JsonTok and converted straight into a staging copy, the live data is only
+    replaced once the whole document was parsed without error. A broken upload leaves the old settings and calibration
+    untouched.
+*/
+typedef struct{
+    JT_Parser_t parser;
+    CFM_Settings_t staged;
+    char key[32];
+    uint32_t keyLength;
+} CFM_SettingsLoader_t;
+
+//every member of the top level object is a setting, nested values are skipped
+static int CFM_settingsToken(void * ctx, const JT_Token_t * token){
+    CFM_SettingsLoader_t * loader = ctx;
+
+    if(token->depth == 0) return !(token->type == JT_OBJECT_START || token->type == JT_OBJECT_END);
+    if(token->depth > 1) return 0;
+
+    if(token->type == JT_KEY){
+        //keys longer than the buffer can't belong to a setting
+        if(token->length >= sizeof(loader->key)){
+            loader->keyLength = 0;
+        }else if(token->escaped){
+            loader->keyLength = JT_unescape(token->start, token->length, loader->key, sizeof(loader->key));
+        }else{
+            memcpy(loader->key, token->start, token->length);
+            loader->keyLength = token->length;
         }
-        currData++;
+        return 0;
+    }
 
-        free(xChar); free(yChar);
+    char buffer[JT_MAX_TOKEN];
+    const char * value = token->start;
+    uint32_t length = token->length;
+    switch(token->type){
+        case JT_STRING:
+            if(token->escaped){
+                length = JT_unescape(token->start, token->length, buffer, sizeof(buffer));
+                value = buffer;
+            }
+            break;
+        case JT_NUMBER: break;
+        case JT_TRUE: value = "true"; length = 4; break;
+        case JT_FALSE: value = "false"; length = 5; break;
+        default: return 0;
+    }
 
-        if(strchr(end, ',') == 0) break;
-    } 
-    
-    free(values);
-    calDataCount = currData;
-    ESP_LOGI(TAG, "loaded %d datapoints", calDataCount);
+    if(loader->keyLength > 0) CFM_setValue(&loader->staged, loader->key, loader->keyLength, value, length);
+    return 0;
 }
 
-esp_err_t CFM_init(){
-    ESP_LOGI(TAG, "Starting CFM");
+static CFM_SettingsLoader_t * CFM_createSettingsLoader(){
+    CFM_SettingsLoader_t * loader = malloc(sizeof(CFM_SettingsLoader_t));
+    if(loader == NULL) return NULL;
+
+    //keys missing from the document keep their current value
+    loader->staged = settings;
+    loader->keyLength = 0;
+    JT_init(&loader->parser, CFM_settingsToken, loader);
+    return loader;
+}
+
+//applies the staged settings if the whole document was valid and frees the loader
+static esp_err_t CFM_commitSettingsLoader(CFM_SettingsLoader_t * loader){
+    JT_Result_t result = JT_finish(&loader->parser);
+    if(result == JT_OK) settings = loader->staged;
+    else ESP_LOGE(TAG, "settings rejected: %s at byte %d", JT_errorString(result), loader->parser.position);
 
-    uint32_t settingsSize, calSize;
+    free(loader);
+    return (result == JT_OK) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t CFM_loadAllSettings(const char * data, uint32_t length){
+    CFM_SettingsLoader_t * loader = CFM_createSettingsLoader();
+    if(loader == NULL) return ESP_ERR_NO_MEM;
+    JT_feed(&loader->parser, data, length);
+    return CFM_commitSettingsLoader(loader);
+}
 
-    FILE * settings = fopen("/spiffs/settings.json", "r");
-    if(settings == NULL){
-        ESP_LOGI(TAG, "settings.json could not be found!");
+//replaces the calibration if the whole document was valid and frees the loader
+static esp_err_t CFM_commitCalLoader(CT_Loader_t * loader){
+    JT_Result_t result = CT_finishLoader(loader);
+    if(result != JT_OK){
+        if(loader->outOfMemory) ESP_LOGE(TAG, "out of memory after %d calibration points", loader->count);
+        ESP_LOGE(TAG, "calibration rejected: %s at byte %d", JT_errorString(result), loader->parser.position);
+        CT_freeLoader(loader);
         return ESP_FAIL;
     }
 
-    fseek(settings, 0, SEEK_END);
-    settingsSize = ftell(settings);
-    fseek(settings, 0, SEEK_SET);
-    ESP_LOGI(TAG, "found settings.json with size %d", (uint32_t) settingsSize);
+    free(calData);
+    calData = loader->points;
+    calDataCount = loader->count;
+    loader->points = NULL;
+    CT_freeLoader(loader);
 
-    if(settingsSize > 0){
-        char * settingsString = malloc(settingsSize+1);
-        memset(settingsString, 0, settingsSize + 1);
-        fread(settingsString, 1, settingsSize, settings);
-        CFM_loadAllSettings(settingsString);
-        fclose(settings);
-        free(settingsString);
+    CFM_buildCalTable();
+    ESP_LOGI(TAG, "loaded %d datapoints", calDataCount);
+    return ESP_OK;
+}
+
+static esp_err_t CFM_loadCal(const char * data, uint32_t length){
+    CT_Loader_t * loader = CT_createLoader();
+    if(loader == NULL) return ESP_ERR_NO_MEM;
+    JT_feed(&loader->parser, data, length);
+    return CFM_commitCalLoader(loader);
+}
+
+/*
+    Request bodies are received in small chunks and fed straight into the parser, so uploads of any size are handled with
+    the same amount of memory. A timeout on a slow connection is retried a few times before the upload is given up.
+*/
+#define CFM_RECV_CHUNK 512
+#define CFM_RECV_RETRIES 5
+
+static esp_err_t CFM_receiveJSON(httpd_req_t * req, JT_Parser_t * parser){
+    char * buffer = malloc(CFM_RECV_CHUNK);
+    if(buffer == NULL) return ESP_ERR_NO_MEM;
+
+    esp_err_t ret = ESP_OK;
+    uint32_t remaining = req->content_len;
+    uint32_t retries = 0;
+    while(remaining > 0){
+        int received = httpd_req_recv(req, buffer, (remaining < CFM_RECV_CHUNK) ? remaining : CFM_RECV_CHUNK);
+        if(received == HTTPD_SOCK_ERR_TIMEOUT && retries++ < CFM_RECV_RETRIES) continue;
+        if(received <= 0){
+            //make sure the loader doesn't commit whatever arrived so far
+            ESP_LOGE(TAG, "upload aborted with %d bytes missing", remaining);
+            parser->error = JT_ERR_INCOMPLETE;
+            ret = ESP_FAIL;
+            break;
+        }
+        retries = 0;
+        remaining -= received;
+
+        //no point in receiving the rest once the parser failed, the server drops what's left of the body
+        if(JT_feed(parser, buffer, received) != JT_OK) break;
     }
 
-    FILE * cal = fopen("/spiffs/cal.json", "r");
-    if(cal == NULL){
-        ESP_LOGI(TAG, "cal.json could not be found!");
-        return ESP_FAIL;
+    free(buffer);
+    return ret;
+}
+
+static uint32_t CFM_hashBytes(uint32_t hash, const void * data, uint32_t length){
+    const uint8_t * bytes = data;
+    for(uint32_t i = 0; i < length; i++){
+        hash ^= bytes[i];
+        hash *= 16777619u;
     }
-    
-    fseek(cal, 0, SEEK_END);
-    calSize = ftell(cal);
-    fseek(cal, 0, SEEK_SET);
-    ESP_LOGI(TAG, "found cal.json with size %d", (uint32_t) calSize);
-
-    if(calSize > 0){
-        char * calString = malloc(calSize+1);
-        memset(calString, 0, calSize + 1);
-        fread(calString, 1, calSize, cal);
-        ESP_LOGI(TAG, "%s", calString);
-        CFM_loadCal(calString);
-        free(calString);
-        fclose(cal);
+    return hash;
+}
+
+//hash of the key, type, position and size of every setting, changes whenever CFM_SETTINGS_LIST changes the struct
+static uint32_t CFM_settingsLayout(){
+    uint32_t hash = 2166136261u;
+    uint32_t size = sizeof(CFM_Settings_t);
+    hash = CFM_hashBytes(hash, &size, sizeof(size));
+    for(uint32_t i = 0; i < CFM_SETTINGS_COUNT; i++){
+        const CFM_SettingDesc_t * desc = &settingsDesc[i];
+        uint32_t fields[3] = {desc->type, desc->offset, desc->size};
+        hash = CFM_hashBytes(hash, desc->key, strlen(desc->key) + 1);
+        hash = CFM_hashBytes(hash, fields, sizeof(fields));
     }
+    return hash;
+}
 
-    return ESP_OK;
+static uint32_t CFM_calLayout(){
+    static const char types[] = "int32_t sensorReading, float appliedField";
+    uint32_t fields[3] = {sizeof(CT_Point_t), offsetof(CT_Point_t, sensorReading), offsetof(CT_Point_t, appliedField)};
+    return CFM_hashBytes(CFM_hashBytes(2166136261u, types, sizeof(types)), fields, sizeof(fields));
 }
 
-char* CFM_parseJSON(char* data, char* propertyToFind){
-    if(data == 0 || propertyToFind == 0) return 0;
-
-    char * currPos = strchr(data, '{')+1;
-    if(currPos == NULL) return 0;
-    unsigned fileDone = 0;
-
-    char * keyStart = currPos;
-
-    while(!fileDone){
-        char * keyEnd = strchr(keyStart, ':');
-        if(currPos == NULL) break;
-        char * propertyStart = keyEnd;
-        while(*(++propertyStart) == ' ');
-        char * propertyEnd = propertyStart;
-
-        if(*propertyEnd == '{'){
-            uint32_t currLevel = 1;
-            while(currLevel){
-                propertyEnd ++;
-                if(*propertyEnd == 0){
-                    fileDone = 1;
-                    break;
-                }else if(*propertyEnd == '{'){
-                    currLevel ++;
-                }else if(*propertyEnd == '}'){
-                    currLevel --;
-                }
-            }
-        }else if(*propertyEnd == '['){
-            uint32_t currLevel = 1;
-            while(currLevel){
-                propertyEnd ++;
-                if(*propertyEnd == 0){
-                    fileDone = 1;
-                    break;
-                }else if(*propertyEnd == '['){
-                    currLevel ++;
-                }else if(*propertyEnd == ']'){
-                    currLevel --;
-                }
-            }
-        }else if(*propertyEnd == ','){
-            //handle empty property
-        }
+static esp_err_t CFM_writeRecord(const char * name, const void * data, uint32_t length, uint32_t layout){
+    char headerKey[16];
+    snprintf(headerKey, sizeof(headerKey), "%sHdr", name);
+    CFM_RecordHeader_t header = {.magic = CFM_RECORD_MAGIC, .version = CFM_RECORD_VERSION, .length = length, .crc = esp_crc32_le(0, data, length), .layout = layout};
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(CFM_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if(ret != ESP_OK) return ret;
+
+    ret = nvs_set_blob(nvs, name, data, length);
+    if(ret == ESP_OK) ret = nvs_set_blob(nvs, headerKey, &header, sizeof(header));
+    if(ret == ESP_OK) ret = nvs_commit(nvs);
+
+    //the old record would still be valid and win over the json file at the next boot, so it has to go
+    if(ret != ESP_OK){
+        ESP_LOGE(TAG, "failed to store %s record (%s), erasing it", name, esp_err_to_name(ret));
+        nvs_erase_key(nvs, headerKey);
+        nvs_erase_key(nvs, name);
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return ret;
+}
 
-        while(1){
-            propertyEnd++;
-            if(*propertyEnd == ',') break;
-            if(*propertyEnd == '}' || *propertyEnd == 0){
-                fileDone = 1;
-                break;
-            }
-        }
+//opens the nvs namespace and reads the header of the record. The handle is only left open if ESP_OK is returned
+static esp_err_t CFM_openRecord(const char * name, nvs_handle_t * nvs, CFM_RecordHeader_t * header){
+    char headerKey[16];
+    snprintf(headerKey, sizeof(headerKey), "%sHdr", name);
 
-        keyStart = strchr(keyStart, '"');
-        if(keyStart == 0) return 0;
-        int32_t keyLength = keyEnd - keyStart - 1;
-        int32_t propLength = propertyEnd - propertyStart;
-        if(keyLength > 0 && propLength > 0){
-            char * key = malloc(keyLength);
-            memcpy(key, keyStart + 1, keyLength - 1);
-            key[keyLength-1] = 0;
-
-            char * property = malloc(propLength + 1);
-            memcpy(property, propertyStart, propLength);
-            property[propLength-1] = 0;
-
-            if(strcmp(key, propertyToFind) == 0){
-                free(key);
-                return property;
-            }
+    esp_err_t ret = nvs_open(CFM_NVS_NAMESPACE, NVS_READONLY, nvs);
+    if(ret != ESP_OK) return ret;
 
-            free(key); free(property);
-        }
-        keyStart = propertyEnd + 1;
+    size_t length = sizeof(CFM_RecordHeader_t);
+    ret = nvs_get_blob(*nvs, headerKey, header, &length);
+    if(ret == ESP_OK && (length != sizeof(CFM_RecordHeader_t) || header->magic != CFM_RECORD_MAGIC || header->version != CFM_RECORD_VERSION)){
+        ESP_LOGI(TAG, "%s record is from an incompatible version", name);
+        ret = ESP_ERR_INVALID_VERSION;
     }
+    if(ret != ESP_OK) nvs_close(*nvs);
+    return ret;
+}
 
-    return 0;
+//reads the payload of a record opened with CFM_openRecord() into dest and closes the handle
+static esp_err_t CFM_readRecordData(nvs_handle_t nvs, const char * name, const CFM_RecordHeader_t * header, void * dest){
+    size_t length = header->length;
+    esp_err_t ret = nvs_get_blob(nvs, name, dest, &length);
+    nvs_close(nvs);
+    if(ret != ESP_OK) return ret;
+
+    if(length != header->length || esp_crc32_le(0, dest, length) != header->crc){
+        ESP_LOGI(TAG, "%s record is corrupt", name);
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
 }
 
-void CFM_loadAllSettings(char* data){
-    if(data == 0) return;
+static esp_err_t CFM_saveSettingsRecord(){
+    return CFM_writeRecord("settings", &settings, sizeof(CFM_Settings_t), CFM_settingsLayout());
+}
 
-    char * currPos = strchr(data, '{')+1;
-    if(currPos == NULL) return;
-    unsigned fileDone = 0;
+static esp_err_t CFM_loadSettingsRecord(){
+    nvs_handle_t nvs;
+    CFM_RecordHeader_t header;
+    if(CFM_openRecord("settings", &nvs, &header) != ESP_OK) return ESP_FAIL;
+    if(header.length != sizeof(CFM_Settings_t) || header.layout != CFM_settingsLayout()){
+        ESP_LOGI(TAG, "settings record has a different layout");
+        nvs_close(nvs);
+        return ESP_FAIL;
+    }
 
-    char * keyStart = currPos;
+    //read into a copy so a corrupt record doesn't overwrite the defaults
+    static CFM_Settings_t loaded;
+    if(CFM_readRecordData(nvs, "settings", &header, &loaded) != ESP_OK) return ESP_FAIL;
+    CFM_clampSettings(&loaded);
+    settings = loaded;
 
-    if(settings != NULL){
-        for(int32_t i = 0; i < settingsCount; i ++){
-            free(settings[i].key);
-            free(settings[i].value);
-        }
-        free(settings);
-    } 
-    settings = malloc(sizeof(SettingsItem) * 100);
-    if(settings == 0) return;
-    settingsCount = 0;
-    memset(settings, 0, sizeof(SettingsItem) * 100);        
-
-    while(!fileDone){
-        char * keyEnd = strchr(keyStart, ':');
-        if(keyEnd == NULL) break;
-        char * propertyStart = keyEnd;
-        while(*(++propertyStart) == ' ');
-        char * propertyEnd = propertyStart;
-
-        if(*propertyEnd == '{'){
-            uint32_t currLevel = 1;
-            while(currLevel){
-                propertyEnd ++;
-                if(*propertyEnd == 0){
-                    fileDone = 1;
-                    break;
-                }else if(*propertyEnd == '{'){
-                    currLevel ++;
-                }else if(*propertyEnd == '}'){
-                    currLevel --;
-                }
-            }
-        }else if(*propertyEnd == '['){
-            uint32_t currLevel = 1;
-            while(currLevel){
-                propertyEnd ++;
-                if(*propertyEnd == 0){
-                    fileDone = 1;
-                    break;
-                }else if(*propertyEnd == '['){
-                    currLevel ++;
-                }else if(*propertyEnd == ']'){
-                    currLevel --;
-                }
-            }
-        }else if(*propertyEnd == ','){
-            //handle empty property
-        }
+    ESP_LOGI(TAG, "loaded settings from nvs");
+    return ESP_OK;
+}
 
-        while(1){
-            propertyEnd++;
-            if(*propertyEnd == ',') break;
-            if(*propertyEnd == '}' || *propertyEnd == 0){
-                fileDone = 1;
-                break;
-            }
-        }
+static esp_err_t CFM_saveCalRecord(){
+    if(calData == NULL) return ESP_FAIL;
+    return CFM_writeRecord("cal", calData, sizeof(CT_Point_t) * calDataCount, CFM_calLayout());
+}
 
-        keyStart = strchr(keyStart, '"');
-        if(keyStart == 0) return;
-        int32_t keyLength = keyEnd - keyStart - 1;
-        int32_t propLength = propertyEnd - propertyStart;
-        if(keyLength > 0 && propLength > 0){
-            char * key = malloc(keyLength);
-            memcpy(key, keyStart + 1, keyLength - 1);
-            key[keyLength-1 ] = 0;
-
-            char * property = malloc(propLength + 1);
-            memcpy(property, propertyStart, propLength);
-            property[propLength] = 0;
-
-            char * start = strchr(property, '"');
-            if(start != 0){
-                start++;
-                char * end = strchr(start, '"');
-                propLength = end - start;
-                char * temp = malloc(propLength + 1);
-                memcpy(temp, start, propLength);
-                temp[propLength] = 0;
-                free(property);
-                property = temp;
-            }
+static esp_err_t CFM_loadCalRecord(){
+    nvs_handle_t nvs;
+    CFM_RecordHeader_t header;
+    if(CFM_openRecord("cal", &nvs, &header) != ESP_OK) return ESP_FAIL;
+    if(header.length == 0 || (header.length % sizeof(CT_Point_t)) != 0 || header.layout != CFM_calLayout()){
+        nvs_close(nvs);
+        return ESP_FAIL;
+    }
 
-            settings[settingsCount].key = key;
-            settings[settingsCount].value = property;
-            settingsCount ++;
-        }
-        keyStart = propertyEnd + 1;
+    CT_Point_t * points = malloc(header.length);
+    if(points == NULL){
+        nvs_close(nvs);
+        return ESP_ERR_NO_MEM;
+    }
+    if(CFM_readRecordData(nvs, "cal", &header, points) != ESP_OK){
+        free(points);
+        return ESP_FAIL;
     }
 
-    return;
+    free(calData);
+    calData = points;
+    calDataCount = header.length / sizeof(CT_Point_t);
+    CFM_buildCalTable();
+    ESP_LOGI(TAG, "loaded %d calibration points from nvs", calDataCount);
+    return ESP_OK;
 }
 
-static void CFM_saveCalFile(){
-    unlink("/spiffs/cal.json");
-    FILE* cf = fopen("/spiffs/cal.json", "w");
-    if(cf == 0) return;
+//returns the zero terminated content of the file or NULL, the caller has to free it
+static char * CFM_readFile(const char * path, uint32_t * length){
+    FILE * file = fopen(path, "r");
+    if(file == NULL){
+        ESP_LOGI(TAG, "%s could not be found!", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint32_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    ESP_LOGI(TAG, "found %s with size %d", path, size);
+
+    char * content = malloc(size + 1);
+    if(content != NULL){
+        *length = fread(content, 1, size, file);
+        content[*length] = 0;
+    }
+    fclose(file);
+    return content;
+}
+
+esp_err_t CFM_init(){
+    ESP_LOGI(TAG, "Starting CFM");
+    esp_err_t ret = ESP_OK;
+
+    CFM_buildSettingsHash();
+    CFM_setDefaults(&settings);
+
+    //the json files are only imported if the records are missing, after that they're just kept in sync for the web UI
+    if(CFM_loadSettingsRecord() != ESP_OK){
+        uint32_t length;
+        char * settingsString = CFM_readFile("/spiffs/settings.json", &length);
+        if(settingsString != NULL && CFM_loadAllSettings(settingsString, length) == ESP_OK){
+            CFM_saveSettingsRecord();
+        }else{
+            ret = ESP_FAIL;
+        }
+        free(settingsString);
+    }
 
+    if(CFM_loadCalRecord() != ESP_OK){
+        uint32_t length;
+        char * calString = CFM_readFile("/spiffs/cal.json", &length);
+        if(calString != NULL && CFM_loadCal(calString, length) == ESP_OK){
+            CFM_saveCalRecord();
+        }else{
+            ret = ESP_FAIL;
+        }
+        free(calString);
+    }
+
+    CFM_syncFile("/spiffs/settings.json", CFM_printSettings);
+    if(calData != NULL) CFM_syncFile("/spiffs/cal.json", CFM_printCal);
+    return ret;
+}
+
+static void CFM_printCal(FILE * cf){
     fprintf(cf, "{\r\n");
     fprintf(cf, "\t\"Datapoints\":[\r\n");
 
@@ -358,76 +588,148 @@ static void CFM_saveCalFile(){
     }
 
     fprintf(cf, "\t]\r\n}");
+}
+
+static void CFM_saveCalFile(){
+    unlink("/spiffs/cal.json");
+    FILE* cf = fopen("/spiffs/cal.json", "w");
+    if(cf == 0) return;
+    CFM_printCal(cf);
     fclose(cf);
 }
 
 esp_err_t CFM_processNewCalData(httpd_req_t *req){
-    char * data = malloc(2048);
-    memset(data, 0, 2048);
-    httpd_req_recv(req, data, 2048);
-
-    CFM_loadCal(data);
+    CT_Loader_t * loader = CT_createLoader();
+    if(loader == NULL) return ESP_ERR_NO_MEM;
+
+    //the loader is committed in any case so it gets freed, a failed upload leaves the parser in an error state
+    CFM_receiveJSON(req, &loader->parser);
+    if(CFM_commitCalLoader(loader) != ESP_OK){
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid calibration data");
+        return ESP_OK;
+    }
     CFM_saveCalFile();
-
-    free(data);
+    if(CFM_saveCalRecord() != ESP_OK){
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Calibration applied but could not be stored in nvs, it is imported from cal.json at the next boot");
+        return ESP_OK;
+    }
 
     httpd_resp_set_status(req, "200 OK");
     httpd_resp_sendstr(req, "yeah man");
     return ESP_OK;
 }
 
-static void CFM_saveSettingsFile(){
-    unlink("/spiffs/settings.json");
-    FILE* sf = fopen("/spiffs/settings.json", "w");
-    if(sf == 0) return;
-
+static void CFM_printSettings(FILE * sf){
     fprintf(sf, "{");
 
-    for(int32_t i = 0; i < settingsCount; i ++){
-        if(settings[i].skip) continue;
-        fprintf(sf, "\t%c\r\n\"%s\":\"%s\"", ((i > 0) ? ',' : ' '), settings[i].key, settings[i].value);
+    //everything is written as string to keep the format the web UI expects
+    for(int32_t i = 0; i < CFM_SETTINGS_COUNT; i ++){
+        const CFM_SettingDesc_t * desc = &settingsDesc[i];
+        const uint8_t * value = (const uint8_t *) &settings + desc->offset;
+        fprintf(sf, "\t%c\r\n\"%s\":\"", ((i > 0) ? ',' : ' '), desc->key);
+        switch(desc->type){
+            case CFM_TYPE_INT: fprintf(sf, "%d", *(const int32_t *) value); break;
+            case CFM_TYPE_FLOAT: fprintf(sf, "%g", *(const float *) value); break;
+            case CFM_TYPE_BOOL: fprintf(sf, "%s", *value ? "true" : "false"); break;
+            case CFM_TYPE_STRING: fprintf(sf, "%s", (const char *) value); break;
+        }
+        fprintf(sf, "\"");
     }
 
     fprintf(sf, "\r\n}");
+}
+
+static void CFM_saveSettingsFile(){
+    unlink("/spiffs/settings.json");
+    FILE* sf = fopen("/spiffs/settings.json", "w");
+    if(sf == 0) return;
+    CFM_printSettings(sf);
     fclose(sf);
 }
 
-esp_err_t CFM_processNewSettingsData(httpd_req_t *req){
-    char * data = malloc(2048);
-    memset(data, 0, 2048);
-    httpd_req_recv(req, data, 2048);
+/*
+    The web UI reads the settings and the calibration from the JSON files, but the device runs on the NVS records. A
+    file that is missing (SPIFFS was formatted or a new image was uploaded) or doesn't match the record is written
+    again from it, otherwise the next save from the web UI would store whatever the stale file says
+*/
+static void CFM_syncFile(const char * path, void (*print)(FILE *)){
+    char * expected = NULL;
+    size_t expectedLength = 0;
+    FILE * memory = open_memstream(&expected, &expectedLength);
+    if(memory == NULL) return;
+    print(memory);
+    fclose(memory);
+
+    uint32_t length = 0;
+    char * current = CFM_readFile(path, &length);
+    if(current == NULL || length != expectedLength || memcmp(current, expected, length) != 0){
+        ESP_LOGI(TAG, "%s doesn't match the stored record, writing it again", path);
+        unlink(path);
+        FILE * file = fopen(path, "w");
+        if(file != NULL){
+            fwrite(expected, 1, expectedLength, file);
+            fclose(file);
+        }
+    }
+    free(current);
+    free(expected);
+}
 
-    CFM_loadAllSettings(data);
+esp_err_t CFM_processNewSettingsData(httpd_req_t *req){
+    if(SC_isRunning()){
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "speed calibration running, try again when it is done");
+        return ESP_OK;
+    }
 
-    unsigned wifiRestartRequired = 0;
-    SettingsItem * wfc = CFM_getSetting("WIFICHANGED");
-    if(wfc != 0){
-        wifiRestartRequired = 1;
-        ESP_LOGI(TAG, "wifiRestartString = %s", wfc->value);
-        wfc->skip = 1;
-    } 
+    CFM_SettingsLoader_t * loader = CFM_createSettingsLoader();
+    if(loader == NULL) return ESP_ERR_NO_MEM;
 
-    unsigned mqttRestartRequired = 0;
-    SettingsItem * mqc = CFM_getSetting("MQTTCHANGED");
-    if(mqc != 0) {
-        mqttRestartRequired = 1;
-        ESP_LOGI(TAG, "mqttRestartString = %s", mqc->value);
-        mqc->skip = 1;
+    settingsWifiChanged = 0;
+    settingsMqttChanged = 0;
+    CFM_receiveJSON(req, &loader->parser);
+    if(CFM_commitSettingsLoader(loader) != ESP_OK){
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid settings");
+        return ESP_OK;
     }
 
+    unsigned wifiRestartRequired = settingsWifiChanged;
+    unsigned mqttRestartRequired = settingsMqttChanged;
     ESP_LOGI(TAG, "wifiRestart = %d mqttRestart = %d", wifiRestartRequired, mqttRestartRequired);
 
 
+    //the settings are applied either way, a failed record is erased so settings.json is imported at the next boot
     CFM_saveSettingsFile();
-
-    free(data);
-
-    httpd_resp_set_status(req, "200 OK");
-    httpd_resp_sendstr(req, "yeah man");
+    if(CFM_saveSettingsRecord() != ESP_OK){
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Settings applied but could not be stored in nvs, they are imported from settings.json at the next boot");
+    }else{
+        httpd_resp_set_status(req, "200 OK");
+        httpd_resp_sendstr(req, "yeah man");
+    }
 
     FM_loadSettings();
     if(wifiRestartRequired) WIFI_init();
-    //if(mqttRestartRequired) MQTT_init();
+    //the MQTT client is only reconnected by FM_loadSettings() if broker or credentials changed
     return ESP_OK;
 }
 
+/*
+    changes a numeric setting from the firmware and stores it the same way as settings from the web UI. Nothing is
+    reloaded, the caller applies the new value itself. The value stays in use if it can't be stored, the error is
+    returned and the stale record is erased so settings.json is imported at the next boot. Settings are only ever written by the httpd task, so this must
+    be called from there as well (see httpd_queue_work)
+*/
+esp_err_t CFM_setNumber(CFM_Setting_t setting, float value){
+    if(setting >= CFM_SETTINGS_COUNT) return ESP_ERR_INVALID_ARG;
+    const CFM_SettingDesc_t * desc = &settingsDesc[setting];
+    if(desc->type != CFM_TYPE_INT && desc->type != CFM_TYPE_FLOAT) return ESP_ERR_INVALID_ARG;
+
+    if(value < desc->min) value = desc->min;
+    if(value > desc->max) value = desc->max;
+    uint8_t * dest = (uint8_t *) &settings + desc->offset;
+    if(desc->type == CFM_TYPE_INT) *(int32_t *) dest = (int32_t) value;
+    else *(float *) dest = value;
+
+    CFM_saveSettingsFile();
+    return CFM_saveSettingsRecord();
+}
\ No newline at end of file
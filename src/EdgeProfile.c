@@ -0,0 +1,70 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "EdgeProfile.h"
+
+void EP_init(EP_Profile_t * ep, uint32_t minCount, float tolerance, float minStep){
+    memset(ep, 0, sizeof(EP_Profile_t));
+    ep->minCount = (minCount > 0) ? minCount : 1;
+    ep->tolerance = tolerance;
+    ep->minStep = minStep;
+}
+
+void EP_reset(EP_Profile_t * ep){
+    memset(ep->sum, 0, sizeof(ep->sum));
+    memset(ep->count, 0, sizeof(ep->count));
+}
+
+//samples outside of the predicted segment (the rotor sped up or slowed down) are ignored
+void EP_addSample(EP_Profile_t * ep, int32_t value, unsigned rotorPos, uint32_t edgeOffset, uint32_t segmentTicks){
+    if(segmentTicks == 0 || edgeOffset >= segmentTicks) return;
+    unsigned pos = rotorPos ? 1 : 0;
+    uint32_t bin = (uint32_t) (((uint64_t) edgeOffset * EP_BINS) / segmentTicks);
+    ep->sum[pos][bin] += value;
+    ep->count[pos][bin] ++;
+}
+
+unsigned EP_isComplete(const EP_Profile_t * ep){
+    for(uint32_t pos = 0; pos < 2; pos++){
+        for(uint32_t bin = 0; bin < EP_BINS; bin++){
+            if(ep->count[pos][bin] < ep->minCount) return 0;
+        }
+    }
+    return 1;
+}
+
+EP_Result_t EP_evaluate(const EP_Profile_t * ep, uint32_t * deadtimePermille){
+    if(!EP_isComplete(ep)) return EP_INCOMPLETE;
+
+    float mean[2][EP_BINS];
+    float plateau[2] = {0.0f, 0.0f};
+    for(uint32_t pos = 0; pos < 2; pos++){
+        for(uint32_t bin = 0; bin < EP_BINS; bin++){
+            mean[pos][bin] = (float) ep->sum[pos][bin] / (float) ep->count[pos][bin];
+            if(bin >= EP_BINS * 3 / 8 && bin < EP_BINS * 5 / 8) plateau[pos] += mean[pos][bin];
+        }
+        plateau[pos] /= (float) (EP_BINS / 4);
+    }
+
+    float step = fabsf(plateau[1] - plateau[0]);
+    if(step < ep->minStep) return EP_NO_SIGNAL;
+    float limit = step * ep->tolerance;
+
+    unsigned usable[EP_BINS];
+    for(uint32_t bin = 0; bin < EP_BINS; bin++){
+        usable[bin] = fabsf(mean[0][bin] - plateau[0]) <= limit && fabsf(mean[1][bin] - plateau[1]) <= limit;
+    }
+
+    //grow the window outwards from the two centre bins, if even those are off the profile is too noisy to use
+    uint32_t first = EP_BINS / 2 - 1;
+    uint32_t last = EP_BINS / 2;
+    if(!usable[first] || !usable[last]) return EP_NO_SIGNAL;
+    while(first > 0 && usable[first - 1]) first--;
+    while(last < EP_BINS - 1 && usable[last + 1]) last++;
+
+    uint32_t blanked = first;
+    if(EP_BINS - 1 - last > blanked) blanked = EP_BINS - 1 - last;
+    *deadtimePermille = blanked * 1000 / EP_BINS;
+    return EP_OK;
+}
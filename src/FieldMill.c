@@ -1,4 +1,6 @@
+#include <math.h>
 #include <stdint.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -11,37 +13,136 @@
 #include "driver/timer.h"
 #include "driver/mcpwm.h"
 #include "soc/mcpwm_periph.h"
+#include "soc/mcpwm_struct.h"
 #include "mqtt_client.h"
+#include "esp_timer.h"
 
 #include "MCP3301.h"
+#include "LockIn.h"
+#include "Capture.h"
+#include "History.h"
+#include "Telemetry.h"
+#include "MotorCtrl.h"
+#include "RotorEdge.h"
+#include "RotorPhase.h"
+#include "SpeedCal.h"
+#include "EdgeProfile.h"
+#include "Waveform.h"
+#include "FilterChain.h"
+#include "Transient.h"
 
 static void FM_motorCountTask(void * taskData);
 static esp_err_t FM_getMeasurementHandler(httpd_req_t *req);
+static esp_err_t FM_getWaveformHandler(httpd_req_t *req);
+static esp_err_t FM_getEventsHandler(httpd_req_t *req);
+static void FM_eventTask(void * param);
 static void FM_valueTask(void * taskData);
 static void FM_initMotorSubSystem();
 
 static uint32_t FM_currRpm = 0;
 static uint32_t FM_motorSensorValid = 0;
-static float FM_motorPower = 0;
 static unsigned FM_motorEnabled = 1;
-static uint64_t FM_lastZC = 0;
-static uint64_t FM_lastPeriod = 0;
-static float FM_currAVG = 0;
-static float FM_currAVGField = 0;
+static volatile uint32_t FM_segmentTicks = 0;    //length of the last rotor segment in ADC timer ticks, 0 while stopped
+
+//rotor edges are timestamped by the MCPWM capture unit, only the capture interrupt touches the filter
+static RE_Filter_t FM_edgeFilter;
+static uint64_t FM_captureOffset = 0;       //ADC timer value at capture counter 0, see FM_syncCaptureClock()
+static uint64_t FM_lastEdgeTime = 0;        //last accepted rotor edge in ADC timer ticks
+
+//seqlock: FM_measurementSequence & 1 selects the slot readers copy, the writer fills the other one first
+static FM_Measurement_t FM_measurements[2];
+static uint32_t FM_measurementSequence = 0;
 
 static const char *TAG = "FieldMill";
 
 static xQueueHandle FM_Motor_ISR_queue = NULL;
 
-char * FM_mqttTopic = NULL;
+//the settings are overwritten in place by the httpd task, so the event and MQTT tasks copy the topic under FM_mqttLock
+static char FM_mqttTopic[sizeof(((CFM_Settings_t *) 0)->MQTT_topic)];
+static portMUX_TYPE FM_mqttLock = portMUX_INITIALIZER_UNLOCKED;
 uint32_t FM_mqttPeriod = 0;
+uint32_t FM_mqttBatchSize = 1;
+uint32_t FM_mqttMaxLatency = 0;
+int FM_mqttQos = 1;
+TM_Format_t FM_mqttFormat = TM_FORMAT_JSON;
 
-float FM_motorTuneP = 0.001f;
-float FM_motorTuneD = -0.001f;
 uint32_t FM_motorTargetRPM = 3600;
-int32_t FM_lastRPMError = 0;
 unsigned FM_rotorPos = 0;
 
+//the controller runs in the motor count task, the tuning is changed from the httpd task
+static MC_Controller_t FM_motorCtrl;
+static portMUX_TYPE FM_motorLock = portMUX_INITIALIZER_UNLOCKED;
+
+//read by the value task once per revolution, see the motor speed compensation in FieldMill.h
+static float FM_speedGain = 0.0f;
+static uint32_t FM_speedRefRPM = 3600;
+static portMUX_TYPE FM_speedLock = portMUX_INITIALIZER_UNLOCKED;
+
+//the edge profile is only touched by the value task, the settings are changed from the httpd task
+static EP_Profile_t FM_edgeProfile;
+static unsigned FM_profiling = 0;
+static uint32_t FM_profileStart = 0;            //s since boot
+static uint32_t FM_profileLast = 0;
+static unsigned FM_profileRequested = 1;
+static uint32_t FM_deadtime = 90;               //permille of every segment
+static unsigned FM_autoDeadtime = 1;
+static uint32_t FM_learnedDeadtime = 0;
+
+//the averager belongs to the value task, it publishes a copy for the waveform endpoint every FM_CONF_LOCKIN_CYCLES
+static WF_Averager_t FM_waveform;
+static WF_Averager_t FM_waveformCopy;
+static portMUX_TYPE FM_waveformLock = portMUX_INITIALIZER_UNLOCKED;
+static unsigned FM_matchedFilter = 1;
+
+/*
+    rebuilt by the value task when the description or the reading rate (target speed) changed, rebuilding restarts it.
+    The httpd task writes the description and speed under FM_filterLock, the value task copies them out under it
+*/
+static FC_Chain_t FM_filter;
+static volatile unsigned FM_filterChanged = 1;
+static char FM_filterDescription[sizeof(((CFM_Settings_t *) 0)->FM_filterChain)];
+static uint32_t FM_filterRPM = 0;
+static portMUX_TYPE FM_filterLock = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+    transient events: the value task runs the detector and hands alerts and finished windows to the event task, which
+    does nothing but publish them. The window buffer belongs to the event task while FM_eventWindowBusy is set
+*/
+#define FM_EVENT_ALERT 0x01
+#define FM_EVENT_WINDOW 0x02
+
+static TR_Detector_t FM_transient;
+static volatile unsigned FM_transientChanged = 1;
+static TaskHandle_t FM_eventTaskHandle = NULL;
+static TR_Trigger_t FM_eventAlert;
+static TR_Reading_t FM_eventWindow[2 * TR_MAX_WINDOW + 1];
+static uint32_t FM_eventWindowCount = 0;
+static uint32_t FM_eventWindowTrigger = 0;
+static uint32_t FM_eventWindowEvent = 0;
+static unsigned FM_eventWindowBusy = 0;
+static portMUX_TYPE FM_eventLock = portMUX_INITIALIZER_UNLOCKED;
+static char FM_eventMessage[64 + 24 * (2 * TR_MAX_WINDOW + 1)];
+
+//latency from the trigger reading until the alert was handed to the network, written by the event task
+static uint32_t FM_eventsPublished = 0;
+static uint32_t FM_eventLatencyLast = 0;
+static uint32_t FM_eventLatencyMax = 0;
+static uint32_t FM_eventsLate = 0;
+static uint32_t FM_eventsDropped = 0;
+
+/*
+    there is only ever one MQTT client, FM_mqttHandle. It is created the first time MQTT is enabled and only stopped and
+    reconfigured when the connection settings change, so the handle the tasks use stays valid. FM_mqttClient is the same
+    handle while connected and NULL otherwise
+*/
+static esp_mqtt_client_handle_t FM_mqttHandle = NULL;
+static esp_mqtt_client_handle_t FM_mqttClient = NULL;
+static TaskHandle_t FM_mqttTaskHandle = NULL;
+static unsigned FM_mqttRunning = 0;
+static char FM_mqttBroker[sizeof(((CFM_Settings_t *) 0)->MQTT_brokerURI)];
+static char FM_mqttUser[sizeof(((CFM_Settings_t *) 0)->MQTT_user)];
+static char FM_mqttPassword[sizeof(((CFM_Settings_t *) 0)->MQTT_password)];
+
 void FM_initMQTT();
 
 void FM_init(){
@@ -54,111 +155,411 @@ void FM_init(){
     };
     httpd_register_uri_handler(server, &measuredData);
 
+    httpd_uri_t waveform = {
+        .uri       = "/waveform.json",
+        .method    = HTTP_GET,
+        .handler   = FM_getWaveformHandler
+    };
+    httpd_register_uri_handler(server, &waveform);
+
+    httpd_uri_t events = {
+        .uri       = "/events.json",
+        .method    = HTTP_GET,
+        .handler   = FM_getEventsHandler
+    };
+    httpd_register_uri_handler(server, &events);
+
     FM_loadSettings();
 
-    xQueueHandle adcQueue = ADC_init(1000);
-    xTaskCreate(FM_valueTask, "fm value task", configMINIMAL_STACK_SIZE + 4000, adcQueue, tskIDLE_PRIORITY + 1, 0);
+    CAP_init();
+    HI_init();
+    SC_init();
+    SR_Ring_t * adcRing = ADC_init(FM_CONF_MAX_SAMPLERATE, FM_deadtime);
+    xTaskCreate(FM_eventTask, "fm event task", configMINIMAL_STACK_SIZE + 3000, NULL, tskIDLE_PRIORITY + 4, &FM_eventTaskHandle);
+    xTaskCreate(FM_valueTask, "fm value task", configMINIMAL_STACK_SIZE + 4000, adcRing, tskIDLE_PRIORITY + 1, 0);
 
     FM_initMotorSubSystem();
 }
 
 void FM_loadSettings(){
-    SettingsItem * cs = CFM_getSetting("FM_targetRPM");
-    if(cs != 0) FM_motorTargetRPM = atoi(cs->value);
-    if(cs != 0) ESP_LOGI(TAG, "set target RPM to %d (%s)", FM_motorTargetRPM, cs->value);
-    
-    cs = CFM_getSetting("FM_motorTuneP");
-    if(cs != 0) FM_motorTuneP = atof(cs->value);
-    if(cs != 0) ESP_LOGI(TAG, "set tune i to %.5f (%s)", FM_motorTuneP, cs->value);
-    
-    cs = CFM_getSetting("FM_motorTuneD");
-    if(cs != 0) FM_motorTuneD = atof(cs->value);
-    if(cs != 0) ESP_LOGI(TAG, "set tune d to %.5f (%s)", FM_motorTuneD, cs->value);
-    
-    cs = CFM_getSetting("MQTT_period");
-    if(cs != 0) FM_mqttPeriod = atoi(cs->value);
-    
-    cs = CFM_getSetting("MQTT_topic");
-    if(cs != 0) FM_mqttTopic = cs->value;
+    const CFM_Settings_t * settings = CFM_getSettings();
+
+    MC_Tuning_t tuning = {
+        .kp = settings->FM_motorKp,
+        .ki = settings->FM_motorKi,
+        .kd = settings->FM_motorKd,
+        .feedForward = settings->FM_motorFeedForward,
+        .slewRate = settings->FM_motorSlewRate,
+        .integralBand = FM_CONF_MOTOR_INTEGRAL_BAND,
+        .outMin = 0.0f,
+        .outMax = 100.0f
+    };
+    portENTER_CRITICAL(&FM_motorLock);
+    FM_motorTargetRPM = settings->FM_targetRPM;
+    MC_setTuning(&FM_motorCtrl, &tuning);
+    portEXIT_CRITICAL(&FM_motorLock);
+    ESP_LOGI(TAG, "set target RPM to %d", FM_motorTargetRPM);
+    ESP_LOGI(TAG, "motor tuning kp %.5f ki %.5f kd %.5f ff %.5f slew %.1f%%/s", tuning.kp, tuning.ki, tuning.kd, tuning.feedForward, tuning.slewRate);
+    FM_setSpeedCompensation(settings->FM_speedGain, settings->FM_speedRefRPM);
+
+    FM_deadtime = settings->FM_deadtime;
+    ADC_setDeadtime(FM_deadtime);
+    if(settings->FM_autoDeadtime && !FM_autoDeadtime) FM_profileRequested = 1;
+    FM_autoDeadtime = settings->FM_autoDeadtime;
+    FM_matchedFilter = settings->FM_matchedFilter;
+    //only the httpd task writes the snapshot, so comparing against it needs no lock
+    if(strcmp(settings->FM_filterChain, FM_filterDescription) != 0 || (uint32_t) settings->FM_targetRPM != FM_filterRPM){
+        portENTER_CRITICAL(&FM_filterLock);
+        strlcpy(FM_filterDescription, settings->FM_filterChain, sizeof(FM_filterDescription));
+        FM_filterRPM = settings->FM_targetRPM;
+        FM_filterChanged = 1;
+        portEXIT_CRITICAL(&FM_filterLock);
+    }
+    FM_transientChanged = 1;
+
+    FM_mqttPeriod = settings->MQTT_period;
+    portENTER_CRITICAL(&FM_mqttLock);
+    strlcpy(FM_mqttTopic, settings->MQTT_topic, sizeof(FM_mqttTopic));
+    portEXIT_CRITICAL(&FM_mqttLock);
+    FM_mqttBatchSize = settings->MQTT_batchSize;
+    FM_mqttMaxLatency = settings->MQTT_maxLatency;
+    FM_mqttQos = settings->MQTT_qos;
+    FM_mqttFormat = TM_parseFormat(settings->MQTT_format);
 
     FM_initMQTT();
 }
 
-unsigned FM_isSampleUsable(uint64_t time){
-    if(FM_lastZC == 0) return 0;
-    uint32_t phaseTime = time % (FM_lastZC>>2);
-    //ESP_LOGI(TAG, "time = %d, segment = %d, comp = %d", (uint32_t) time, phaseTime, (uint32_t) (FM_lastZC>>2));
-    return (phaseTime > FM_CONF_DEADTIME) && (phaseTime < (FM_lastZC>>2) - FM_CONF_DEADTIME);
+//overrides the target speed until the settings are loaded again, used by the speed calibration
+void FM_setTargetRPM(uint32_t rpm){
+    portENTER_CRITICAL(&FM_motorLock);
+    FM_motorTargetRPM = rpm;
+    portEXIT_CRITICAL(&FM_motorLock);
+}
+
+void FM_setSpeedCompensation(float gain, uint32_t refRpm){
+    portENTER_CRITICAL(&FM_speedLock);
+    FM_speedGain = gain;
+    FM_speedRefRPM = refRpm;
+    portEXIT_CRITICAL(&FM_speedLock);
+    ESP_LOGI(TAG, "speed compensation %.7f/rpm around %d rpm", gain, refRpm);
+}
+
+//out@n0 = out(n) / (1 + y * dn), only valid close to n0 so the correction is limited to a factor of two
+static float FM_speedCompensation(uint32_t rpm){
+    portENTER_CRITICAL(&FM_speedLock);
+    float gain = FM_speedGain;
+    float dn = (float) rpm - (float) FM_speedRefRPM;
+    portEXIT_CRITICAL(&FM_speedLock);
+    if(gain == 0.0f || rpm == 0) return 1.0f;
+
+    float ratio = 1.0f + gain * dn;
+    if(ratio < 0.5f) ratio = 0.5f;
+    if(ratio > 2.0f) ratio = 2.0f;
+    return 1.0f / ratio;
+}
+
+//only called from the value task, there must never be a second writer
+static void FM_publishMeasurement(float field, float reading){
+    uint32_t sequence = FM_measurementSequence + 1;
+    //a reader still copying this slot must see the previous sequence once it sees new data. A release fence doesn't keep
+    //the plain slot stores below from moving ahead of it, a full fence does
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    FM_Measurement_t * slot = &FM_measurements[sequence & 1];
+    slot->sequence = sequence;
+    slot->time = (uint32_t) (esp_timer_get_time() / 1000);
+    slot->field = field;
+    slot->reading = reading;
+    slot->raw = (int32_t) lroundf(reading);
+    slot->rpm = FM_currRpm;
+    __atomic_store_n(&FM_measurementSequence, sequence, __ATOMIC_RELEASE);
+}
+
+/*
+    The writer only touches the slot a reader copies after it has published the other one, so the copy is valid if the
+    sequence didn't change while copying. A writer preempted halfway through never blocks a reader, the slot it's filling
+    isn't the published one.
+*/
+void FM_getMeasurement(FM_Measurement_t * measurement){
+    uint32_t sequence;
+    do{
+        sequence = __atomic_load_n(&FM_measurementSequence, __ATOMIC_ACQUIRE);
+        *measurement = FM_measurements[sequence & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while(__atomic_load_n(&FM_measurementSequence, __ATOMIC_RELAXED) != sequence);
 }
 
-static int32_t scaleForMotorSpeed(int32_t value){
-    return value;
-    int32_t error = 3600 - FM_getMotorRPM();
-    if(abs(error) < 3) return value;
+//runs on the httpd task like every other change of the settings
+static void FM_storeDeadtime(void * arg){
+    if(CFM_setNumber(CFM_FM_deadtime, FM_learnedDeadtime) != ESP_OK) ESP_LOGW(TAG, "learned deadtime could not be stored");
+    FM_deadtime = CFM_getSettings()->FM_deadtime;
+    ADC_setDeadtime(FM_deadtime);
+}
 
-    //out@n0 = out * 1/(1 + dn*y)
-    return (int32_t) ((float) value * (1.0f / (1.0f + (float) error * FM_CONF_MOTORSPEED_GAIN)));
+static unsigned FM_motorAtSpeed(){
+    uint32_t target = FM_motorTargetRPM;
+    uint32_t rpm = FM_currRpm;
+    uint32_t error = (rpm > target) ? rpm - target : target - rpm;
+    return rpm != 0 && error < target / 50;
+}
+
+static void FM_startEdgeProfile(uint32_t now){
+    EP_reset(&FM_edgeProfile);
+    ADC_setSweep(FM_CONF_PROFILE_SWEEP);
+    FM_profiling = 1;
+    FM_profileStart = now;
+    FM_profileRequested = 0;
+    ESP_LOGI(TAG, "learning the segment edge profile");
+}
+
+static void FM_finishEdgeProfile(uint32_t now){
+    ADC_setSweep(0);
+    FM_profiling = 0;
+    FM_profileLast = now;
+
+    uint32_t deadtime;
+    EP_Result_t result = EP_evaluate(&FM_edgeProfile, &deadtime);
+    if(result == EP_INCOMPLETE){
+        ESP_LOGW(TAG, "edge profile timed out, keeping the deadtime at %d permille", FM_deadtime);
+        return;
+    }else if(result == EP_NO_SIGNAL){
+        ESP_LOGW(TAG, "no field to learn the edge profile with, keeping the deadtime at %d permille", FM_deadtime);
+        return;
+    }
+
+    ESP_LOGI(TAG, "edge profile: deadtime %d permille (was %d)", deadtime, FM_deadtime);
+    if(deadtime == FM_deadtime) return;
+    FM_learnedDeadtime = deadtime;
+    if(httpd_queue_work(SERVER_getServer(), FM_storeDeadtime, NULL) != ESP_OK) ESP_LOGW(TAG, "couldn't store the deadtime");
+}
+
+/*
+    The edge profile is learned once the motor is at speed after boot and then every FM_CONF_PROFILE_INTERVAL. While it is
+    learned the ADC sweeps the whole segment, every sample goes into the profile but only the ones inside the current
+    window are demodulated, so the readings stay valid.
+*/
+static void FM_updateEdgeProfile(const ADC_Sample_t * samples, uint32_t count, uint32_t segmentTicks){
+    uint32_t now = (uint32_t) (esp_timer_get_time() / 1000000);
+    if(!FM_profiling){
+        if(FM_autoDeadtime && FM_motorAtSpeed() && (FM_profileRequested || now - FM_profileLast >= FM_CONF_PROFILE_INTERVAL)){
+            FM_startEdgeProfile(now);
+        }
+        return;
+    }
+
+    for(uint32_t i = 0; i < count; i++){
+        EP_addSample(&FM_edgeProfile, samples[i].value, samples[i].rotorPos, samples[i].edgeOffset, segmentTicks);
+    }
+    if(EP_isComplete(&FM_edgeProfile) || now - FM_profileStart >= FM_CONF_PROFILE_TIMEOUT) FM_finishEdgeProfile(now);
+}
+
+//the chain gets one reading per revolution, a broken description keeps the running chain
+static void FM_configureFilter(){
+    char description[sizeof(FM_filterDescription)];
+    portENTER_CRITICAL(&FM_filterLock);
+    memcpy(description, FM_filterDescription, sizeof(description));
+    uint32_t rpm = FM_filterRPM;
+    FM_filterChanged = 0;
+    portEXIT_CRITICAL(&FM_filterLock);
+
+    int stages = FC_configure(&FM_filter, description, (float) rpm / 60.0f);
+    if(stages < 0) ESP_LOGW(TAG, "invalid filter chain \"%s\", keeping the last one", description);
+    else ESP_LOGI(TAG, "filter chain \"%s\" with %d stages", description, stages);
+}
+
+static void FM_configureTransient(){
+    const CFM_Settings_t * settings = CFM_getSettings();
+    FM_transientChanged = 0;
+    TR_configure(&FM_transient, settings->FM_eventSlope, settings->FM_eventRate, settings->FM_eventLevel, settings->FM_eventPre, settings->FM_eventPost);
+}
+
+//called by the value task, never waits for the event task
+static void FM_handleTransient(TR_Result_t result){
+    TR_Trigger_t trigger;
+    TR_lastTrigger(&FM_transient, &trigger);
+    if(result == TR_TRIGGER){
+        portENTER_CRITICAL(&FM_eventLock);
+        FM_eventAlert = trigger;
+        portEXIT_CRITICAL(&FM_eventLock);
+        xTaskNotify(FM_eventTaskHandle, FM_EVENT_ALERT, eSetBits);
+        if(!TR_windowComplete(&FM_transient)) return;
+    }
+
+    //the window is complete, without post readings that's already the case at the trigger
+    if(__atomic_load_n(&FM_eventWindowBusy, __ATOMIC_ACQUIRE)){
+        FM_eventsDropped ++;
+        return;
+    }
+    FM_eventWindowCount = TR_copyWindow(&FM_transient, FM_eventWindow, &FM_eventWindowTrigger);
+    FM_eventWindowEvent = trigger.event;
+    __atomic_store_n(&FM_eventWindowBusy, 1, __ATOMIC_RELEASE);
+    xTaskNotify(FM_eventTaskHandle, FM_EVENT_WINDOW, eSetBits);
 }
 
 static void FM_valueTask(void * taskData){
-    xQueueHandle adcQueue = (xQueueHandle) taskData;
-    ADC_Sample_t currSample;
-    uint16_t count = 0;
+    SR_Ring_t * adcRing = (SR_Ring_t *) taskData;
+    LI_Demodulator_t demod;
+    LI_init(&demod, FM_CONF_LOCKIN_CYCLES);
+    EP_init(&FM_edgeProfile, FM_CONF_PROFILE_MIN_COUNT, FM_CONF_PROFILE_TOLERANCE, FM_CONF_PROFILE_MIN_STEP);
+    WF_init(&FM_waveform, FM_CONF_WAVEFORM_SAMPLES, FM_CONF_WAVEFORM_MIN_COUNT, FM_CONF_WAVEFORM_MIN_AMPLITUDE);
+    FC_configure(&FM_filter, "", 1.0f);
+    TR_init(&FM_transient);
+    ADC_registerConsumer();
     while(1){
-        if(xQueueReceive(adcQueue, &currSample, 1000/portTICK_PERIOD_MS)){
+        if(ulTaskNotifyTake(pdTRUE, 1000/portTICK_PERIOD_MS)){
             /*
             why the deadtime anyway?
                 due to field fringing at the edge of the rotor the output voltage is more similar to a sine wave that the expected square. 
                 During these slow falling edges the data is not valid and needs to be ignored.
             */
-            int32_t reading = (int32_t) (currSample.rotorPos ? currSample.value : -currSample.value);
-            //int32_t readingMotorCal = scaleForMotorSpeed(reading);
-            FM_currAVG = (FM_currAVG * 9999.0f + (float) reading) / 10000.0f;
-            FM_currAVGField = CFM_scaleMeasurement(FM_currAVG);
-            if(count++ == 1000){
-                count = 0;
-                ESP_LOGI(TAG, "currAvg = %+5.5f -> field %.2f", FM_currAVG, FM_currAVGField);
+            ADC_Sample_t * samples;
+            uint32_t count;
+            while((count = SR_peek(adcRing, (void **) &samples)) > 0){
+                CAP_addSamples(samples, count);
+                uint32_t segmentTicks = FM_segmentTicks;
+                unsigned profiling = FM_profiling;
+                //while the bursts sweep through the whole segment the deadtime has to be applied here
+                uint32_t deadtime = RP_deadtimeTicks(segmentTicks, FM_deadtime);
+                FM_updateEdgeProfile(samples, count, segmentTicks);
+                unsigned matched = FM_matchedFilter && FM_waveform.ready;
+                for(uint32_t i = 0; i < count; i++){
+                    const ADC_Sample_t * sample = &samples[i];
+                    uint32_t bin = WF_bin(sample->rotorPos, sample->edgeOffset, segmentTicks);
+                    WF_addSample(&FM_waveform, bin, sample->value);
+                    if(profiling && !RP_isInWindow(sample->edgeOffset, segmentTicks, deadtime)) continue;
+
+                    //the template of the sample's phase weights it, samples outside of the predicted segment aren't weighted
+                    unsigned revolution;
+                    if(matched && bin != WF_NO_BIN){
+                        LI_Weight_t weight = {FM_waveform.weight[bin], FM_waveform.norm[bin], FM_waveform.offset};
+                        revolution = LI_addWeightedSample(&demod, sample->value, sample->rotorPos, &weight);
+                    }else{
+                        revolution = LI_addSample(&demod, sample->value, sample->rotorPos);
+                    }
+                    if(!revolution) continue;
+                    LI_setGain(&demod, FM_speedCompensation(FM_currRpm));
+                    WF_update(&FM_waveform);
+                    if((demod.cycleCount % FM_CONF_LOCKIN_CYCLES) == 0){
+                        ESP_LOGI(TAG, "lock-in avg = %+5.5f (last rev %+5.5f, %d dropped, %d matched)", demod.average, demod.inPhase, demod.droppedCycles, demod.matchedCycles);
+                        ESP_LOGI(TAG, "sample ring: %d overruns, max fill %d/%d", adcRing->overruns, adcRing->highWater, ADC_RING_DEPTH);
+                        portENTER_CRITICAL(&FM_waveformLock);
+                        FM_waveformCopy = FM_waveform;
+                        portEXIT_CRITICAL(&FM_waveformLock);
+                    }
+
+                    //the fast path sees every revolution before it is filtered
+                    if(FM_transientChanged) FM_configureTransient();
+                    TR_Result_t transient = TR_addReading(&FM_transient, esp_timer_get_time(), CFM_scaleMeasurement(demod.inPhase));
+                    if(transient != TR_NONE) FM_handleTransient(transient);
+
+                    if(FM_filterChanged) FM_configureFilter();
+                    float reading = demod.inPhase;
+                    if(!FC_process(&FM_filter, &reading)) continue;
+                    float field = CFM_scaleMeasurement(reading);
+                    FM_publishMeasurement(field, reading);
+                    HI_addValue(field, (uint32_t) (esp_timer_get_time() / 1000000));
+                }
+                SR_consume(adcRing, count);
             }
         }else{
+            LI_reset(&demod);
+            FC_reset(&FM_filter);
+            //keep the snapshot moving so readers see the rotor stop
+            FM_Measurement_t last;
+            FM_getMeasurement(&last);
+            FM_publishMeasurement(last.field, last.reading);
             ESP_LOGI(TAG, "ADC is too slow :(");
         }
     }
 }
 
-uint32_t FM_edgeCount = 0;
-uint64_t FM_lt = 0;
-static void IRAM_ATTR FM_motorISR(void* arg){
-    FM_rotorPos = gpio_get_level(FM_INTERRUPTER_PIN);
-    uint64_t buff = 0;
-    timer_get_counter_value(TIMER_GROUP_0, 0, &buff);
-    if((buff - FM_lt) < (FM_lastZC >> 4)) return;
-    if(FM_edgeCount == 3){
-        FM_edgeCount = 0;
-        FM_lastZC = buff;
-        timer_set_counter_value(TIMER_GROUP_0, 0, 0);
-        xQueueSendFromISR(FM_Motor_ISR_queue, &buff, NULL);
-        buff = 0;
-    }else{
-        FM_edgeCount ++;
+/*
+    The capture unit latches its free running counter on every interrupter edge, so the timestamp doesn't depend on the
+    interrupt latency and no timer is read or reset here. The capture counter runs on the APB clock, twice the rate of the
+    ADC timer, the edge is placed on the ADC timer through the offset measured by FM_syncCaptureClock()
+*/
+static void IRAM_ATTR FM_captureISR(void * arg){
+    if(!MCPWM0.int_st.cap0_int_st) return;
+    uint32_t timestamp = MCPWM0.cap_val_ch[0];
+    unsigned level = MCPWM0.cap_status.cap0_edge ? 0 : 1;     //0 = rising edge
+    MCPWM0.int_clr.cap0_int_clr = 1;
+
+    RE_Result_t result = RE_addEdge(&FM_edgeFilter, timestamp, level);
+    if(result == RE_REJECTED) return;
+    FM_rotorPos = level;
+
+    timer_spinlock_take(TIMER_GROUP_0);
+    uint64_t now = timer_group_get_counter_value_in_isr(TIMER_GROUP_0, 1);
+    timer_spinlock_give(TIMER_GROUP_0);
+    uint32_t age = (uint32_t) ((now - FM_captureOffset) << 1) - timestamp;
+    FM_lastEdgeTime = now - (age >> 1);
+    ADC_segmentStartFromISR(FM_lastEdgeTime);
+
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if(result == RE_PERIOD){
+        uint64_t period = FM_edgeFilter.period >> 1;
+        xQueueSendFromISR(FM_Motor_ISR_queue, &period, &xHigherPriorityTaskWoken);
     }
-    gpio_set_level(5, FM_rotorPos);
-    FM_lt = buff;
+    gpio_set_level(5, level);
+    if(xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
+
+//relates the capture counter to the ADC timer with a software capture on the otherwise unused channel 1
+static void FM_syncCaptureClock(){
+    uint64_t before, after;
+    portENTER_CRITICAL(&FM_motorLock);
+    timer_get_counter_value(TIMER_GROUP_0, 1, &before);
+    MCPWM0.cap_cfg_ch[1].sw = 1;
+    timer_get_counter_value(TIMER_GROUP_0, 1, &after);
+    portEXIT_CRITICAL(&FM_motorLock);
+    FM_captureOffset = ((before + after) >> 1) - (MCPWM0.cap_val_ch[1] >> 1);
 }
 
+//sets the duty and logs when the controller runs into or out of the power limit
+static void FM_applyMotorPower(float power, int saturated, int lastSaturated){
+    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, power);
+    if(saturated > 0 && lastSaturated <= 0 && power >= 100.0f){
+        ESP_LOGW(TAG, "Motor power range exauhsted! (100%% ; is %d rpm)", FM_currRpm);
+    }else if(saturated == 0 && lastSaturated > 0){
+        ESP_LOGI(TAG, "Motor power back in range (%.2f%%)", power);
+    }
+}
+
+/*
+    every rotor period that is measured runs one step of the speed controller, so the loop rate follows the rotor. If no
+    period arrives the controller is restarted from the feed forward duty, which also spins the motor up after a stall
+*/
 static void FM_motorCountTask(void * taskData){
     uint64_t data = 0;
     while(1){
         if(xQueueReceive(FM_Motor_ISR_queue, &data, 1000/portTICK_PERIOD_MS)){
             uint64_t dT = data;
-            uint32_t rpm = (uint32_t) (4800000000 / dT);
+            uint32_t rpm = (uint32_t) ((uint64_t) FM_TIMER_HZ * FM_CONF_REVS_PER_PERIOD * 60 / dT);
             FM_currRpm = rpm;
-            FM_lastPeriod = dT;
+            FM_segmentTicks = (uint32_t) (dT / 4);
+            ADC_setRotorPeriod(dT);
             FM_motorSensorValid = 1;
             gpio_set_level(2, 1);
+
+            if(FM_motorEnabled){
+                portENTER_CRITICAL(&FM_motorLock);
+                int lastSaturated = FM_motorCtrl.saturated;
+                float power = MC_update(&FM_motorCtrl, FM_motorTargetRPM, rpm, (float) dT / (float) FM_TIMER_HZ);
+                int saturated = FM_motorCtrl.saturated;
+                portEXIT_CRITICAL(&FM_motorLock);
+                FM_applyMotorPower(power, saturated, lastSaturated);
+            }
         }else{
             if(FM_motorSensorValid == 0){
                 FM_currRpm = 0;
+                FM_segmentTicks = 0;
+                ADC_setRotorPeriod(0);
                 gpio_set_level(2, 0);
+
+                portENTER_CRITICAL(&FM_motorLock);
+                MC_reset(&FM_motorCtrl, FM_motorTargetRPM);
+                float power = FM_motorCtrl.output;
+                portEXIT_CRITICAL(&FM_motorLock);
+                if(FM_motorEnabled) mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, power);
             }else{
                 FM_motorSensorValid = 0;
             }
@@ -166,79 +567,37 @@ static void FM_motorCountTask(void * taskData){
     }
 }
 
-static void FM_motorCtrlTask(void * taskData){
-    while(1){
-        if(FM_motorSensorValid && FM_motorEnabled){
-            int32_t error = FM_motorTargetRPM - FM_getMotorRPM();
-            if(abs(error) < 2) error = 0;
-
-            if(error != 0){
-                FM_motorPower += (float) error * FM_motorTuneP + (float) (error - FM_lastRPMError) * FM_motorTuneD;
-                FM_lastRPMError = error;
-                if(FM_motorPower < 0.0f) FM_motorPower = 0.0f;
-
-                if(FM_motorPower >= 100.0){
-                    FM_motorPower = 100.0f;
-                    ESP_LOGW(TAG, "Motor power range exauhsted! (100%% ; error = %d rpm (is %d rpm))", error, FM_getMotorRPM());
-                }else if(FM_motorPower > 93.0){
-                    ESP_LOGW(TAG, "Motor is getting close to its power limit! (%.2f%%)", FM_motorPower);
-                }/*else{
-                    ESP_LOGW(TAG, "Motor power = %.2f%% error = %d rpm (is %d rpm)", FM_motorPower, error, FM_getMotorRPM());
-                }*/
-                mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, FM_motorPower);  //turn off motor if error occours
-            }
-        }else{
-            if(FM_currRpm == 0){
-                mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, 50.0);  //turn off motor if error occours
-            }
-        }
-        vTaskDelay(100/portTICK_PERIOD_MS);
-    }
-}
-
-float FM_getField(){
-    return FM_currAVGField;
-}
-
-uint32_t FM_getMotorRPM(){
-    return FM_currRpm;
-}
-
-int32_t FM_getRaw(){
-    return FM_currAVG;
-}
-
 static void FM_initMotorSubSystem(){
 
     FM_Motor_ISR_queue = xQueueCreate(10, sizeof(uint64_t));  
     
-    //initialize the counter timer used to measure time between interrupter pulses
-    timer_config_t config = {
-        .divider = 2,
-        .counter_dir = TIMER_COUNT_UP,
-        .counter_en = TIMER_START,
-        .alarm_en = TIMER_ALARM_DIS,
-        .auto_reload = TIMER_AUTORELOAD_EN,
-    };
-    timer_init(TIMER_GROUP_0, 0, &config);
-    timer_start(TIMER_GROUP_0, 0);
-
     gpio_config_t io_conf;
-    io_conf.intr_type = GPIO_INTR_ANYEDGE;
+    io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.pin_bit_mask = (1ULL<<FM_INTERRUPTER_PIN);
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pull_up_en = 0; //pullup is done in hardware to allow for faster and more consistent edges
+    io_conf.pull_down_en = 0;
     gpio_config(&io_conf);
-    gpio_set_intr_type(FM_INTERRUPTER_PIN, GPIO_INTR_ANYEDGE);
 
-    gpio_install_isr_service(0);
-    uint64_t * timerBuffer = malloc(sizeof(uint64_t)); 
-    gpio_isr_handler_add(FM_INTERRUPTER_PIN, FM_motorISR, timerBuffer);
+    //both edges of the interrupter are captured on channel 0, channel 1 has no input and is only triggered by software
+    RE_init(&FM_edgeFilter);
+    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM_CAP_0, FM_INTERRUPTER_PIN);
+    mcpwm_capture_enable(MCPWM_UNIT_0, MCPWM_SELECT_CAP0, MCPWM_BOTH_EDGE, 0);
+    mcpwm_capture_enable(MCPWM_UNIT_0, MCPWM_SELECT_CAP1, MCPWM_POS_EDGE, 0);
+    FM_syncCaptureClock();
+    MCPWM0.int_ena.cap1_int_ena = 0;
+    MCPWM0.int_ena.cap0_int_ena = 1;
+    mcpwm_isr_register(MCPWM_UNIT_0, FM_captureISR, NULL, 0, NULL);
 
     mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0B, FM_Motor_PIN);
     mcpwm_config_t pwm_config = {.frequency = 1000, .cmpr_b = 0, .counter_mode = MCPWM_UP_COUNTER, .duty_mode = MCPWM_DUTY_MODE_0};
     mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_0, &pwm_config);
-    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, 0.0);
+    //start from the feed forward duty, the controller takes over with the first measured period
+    portENTER_CRITICAL(&FM_motorLock);
+    MC_reset(&FM_motorCtrl, FM_motorTargetRPM);
+    float power = FM_motorCtrl.output;
+    portEXIT_CRITICAL(&FM_motorLock);
+    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, FM_motorEnabled ? power : 0.0f);
 
     ESP_LOGI(TAG, "motor ready! 0x%08x", (uint32_t) FM_Motor_ISR_queue);
     gpio_set_direction(2, GPIO_MODE_OUTPUT);
@@ -246,12 +605,14 @@ static void FM_initMotorSubSystem(){
     gpio_set_direction(22, GPIO_MODE_OUTPUT);
     gpio_set_direction(23, GPIO_MODE_OUTPUT);
     xTaskCreate(FM_motorCountTask, "MotorCountTask", configMINIMAL_STACK_SIZE + 4000, 0, tskIDLE_PRIORITY + 3, 0);
-    xTaskCreate(FM_motorCtrlTask, "MotorCtrlTask", configMINIMAL_STACK_SIZE + 4000, 0, tskIDLE_PRIORITY + 3, 0);
 }
 
 static esp_err_t FM_getMeasurementHandler(httpd_req_t *req){
-    char * buff = malloc(128);
-    sprintf(buff, "{\"measuredField\": %f,\r\n\"sensorReading\": %d,\r\n\"motorRPM\": %d\r\n}", FM_getField(), FM_getRaw(), FM_getMotorRPM());
+    FM_Measurement_t measurement;
+    FM_getMeasurement(&measurement);
+    char * buff = malloc(160);
+    sprintf(buff, "{\"measuredField\": %f,\r\n\"sensorReading\": %d,\r\n\"motorRPM\": %d,\r\n\"time\": %u,\r\n\"sequence\": %u\r\n}",
+        measurement.field, measurement.raw, measurement.rpm, measurement.time, measurement.sequence);
     httpd_resp_set_type(req, "application/json");
     httpd_resp_sendstr_chunk(req, buff);
     free(buff);
@@ -259,32 +620,175 @@ static esp_err_t FM_getMeasurementHandler(httpd_req_t *req){
     return ESP_OK;
 }
 
+/*
+    the averaged rotor waveform, one entry per phase bin: [mean, standard deviation, samples, template shape, weight].
+    Bins without samples are null, the edge bins only get samples while the edge profile is learned
+*/
+static esp_err_t FM_getWaveformHandler(httpd_req_t *req){
+    WF_Averager_t * wf = malloc(sizeof(WF_Averager_t));
+    if(wf == NULL){
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+        return ESP_OK;
+    }
+    portENTER_CRITICAL(&FM_waveformLock);
+    *wf = FM_waveformCopy;
+    portEXIT_CRITICAL(&FM_waveformLock);
+
+    char buff[128];
+    httpd_resp_set_type(req, "application/json");
+    snprintf(buff, sizeof(buff), "{\"binsPerSegment\":%d,\"segmentTicks\":%u,\"offset\":%.3f,\"amplitude\":%.3f,\"ready\":%s,\"bins\":[",
+        WF_BINS / 2, FM_segmentTicks, wf->offset, wf->amplitude, wf->ready ? "true" : "false");
+    httpd_resp_sendstr_chunk(req, buff);
+    for(uint32_t bin = 0; bin < WF_BINS; bin++){
+        const char * separator = (bin > 0) ? "," : "";
+        if(wf->count[bin] == 0){
+            snprintf(buff, sizeof(buff), "%snull", separator);
+        }else{
+            snprintf(buff, sizeof(buff), "%s[%.3f,%.3f,%u,%.4f,%.4f]", separator, wf->mean[bin], sqrtf(wf->var[bin]), wf->count[bin], wf->shape[bin], wf->weight[bin]);
+        }
+        httpd_resp_sendstr_chunk(req, buff);
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    free(wf);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t FM_getEventsHandler(httpd_req_t *req){
+    char buff[192];
+    snprintf(buff, sizeof(buff), "{\"events\":%u,\"published\":%u,\"rate\":%.2f,\"lastLatencyUs\":%u,\"maxLatencyUs\":%u,\"late\":%u,\"droppedWindows\":%u}",
+        FM_transient.events, FM_eventsPublished, FM_transient.rate, FM_eventLatencyLast, FM_eventLatencyMax, FM_eventsLate, FM_eventsDropped);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buff);
+}
 
+static const char * FM_eventCause(unsigned cause){
+    if(cause == (TR_CAUSE_RATE | TR_CAUSE_LEVEL)) return "rate+level";
+    return (cause & TR_CAUSE_RATE) ? "rate" : "level";
+}
+
+/*
+    The alert is published with QoS 0 the moment the trigger arrives, it never waits behind the periodic readings. The
+    client's network timeout bounds how long a publish can block, alerts slower than FM_CONF_EVENT_MAX_LATENCY are
+    counted as late. The window follows with the configured QoS once the post trigger readings are in.
+*/
+static void FM_getMqttTopic(char * topic){
+    portENTER_CRITICAL(&FM_mqttLock);
+    memcpy(topic, FM_mqttTopic, sizeof(FM_mqttTopic));
+    portEXIT_CRITICAL(&FM_mqttLock);
+}
+
+static void FM_eventTask(void * param){
+    char baseTopic[sizeof(FM_mqttTopic)];
+    char topic[80];
+    while(1){
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        esp_mqtt_client_handle_t client = FM_mqttClient;
+
+        if(bits & FM_EVENT_ALERT){
+            TR_Trigger_t alert;
+            portENTER_CRITICAL(&FM_eventLock);
+            alert = FM_eventAlert;
+            portEXIT_CRITICAL(&FM_eventLock);
+
+            uint32_t queued = (uint32_t) (esp_timer_get_time() - alert.time);
+            int len = snprintf(FM_eventMessage, sizeof(FM_eventMessage), "{\"event\":%u,\"time\":%u,\"field\":%.2f,\"rate\":%.1f,\"cause\":\"%s\",\"queuedUs\":%u}",
+                alert.event, (uint32_t) (alert.time / 1000), alert.field, alert.rate, FM_eventCause(alert.cause), queued);
+            if(client != NULL){
+                FM_getMqttTopic(baseTopic);
+                snprintf(topic, sizeof(topic), "%s/events", baseTopic);
+                esp_mqtt_client_publish(client, topic, FM_eventMessage, len, 0, 0);
+
+                uint32_t latency = (uint32_t) (esp_timer_get_time() - alert.time);
+                FM_eventLatencyLast = latency;
+                if(latency > FM_eventLatencyMax) FM_eventLatencyMax = latency;
+                if(latency > FM_CONF_EVENT_MAX_LATENCY){
+                    FM_eventsLate ++;
+                    ESP_LOGW(TAG, "event %u took %u us to publish", alert.event, latency);
+                }
+                FM_eventsPublished ++;
+            }
+            ESP_LOGI(TAG, "event %u: %s, field %.2f rate %.1f/s", alert.event, FM_eventCause(alert.cause), alert.field, alert.rate);
+        }
+
+        if(bits & FM_EVENT_WINDOW){
+            uint64_t triggerTime = FM_eventWindow[FM_eventWindowTrigger].time;
+            uint32_t len = snprintf(FM_eventMessage, sizeof(FM_eventMessage), "{\"event\":%u,\"time\":%u,\"readings\":[", FM_eventWindowEvent, (uint32_t) (triggerTime / 1000));
+            for(uint32_t i = 0; i < FM_eventWindowCount && len < sizeof(FM_eventMessage); i++){
+                //ms relative to the trigger reading
+                float offset = (float) ((int64_t) (FM_eventWindow[i].time - triggerTime)) / 1000.0f;
+                len += snprintf(FM_eventMessage + len, sizeof(FM_eventMessage) - len, "%s[%.1f,%.2f]", (i > 0) ? "," : "", offset, FM_eventWindow[i].field);
+            }
+            __atomic_store_n(&FM_eventWindowBusy, 0, __ATOMIC_RELEASE);
+            if(len < sizeof(FM_eventMessage)) len += snprintf(FM_eventMessage + len, sizeof(FM_eventMessage) - len, "]}");
+            if(client != NULL && len < sizeof(FM_eventMessage)){
+                FM_getMqttTopic(baseTopic);
+                snprintf(topic, sizeof(topic), "%s/events/window", baseTopic);
+                esp_mqtt_client_publish(client, topic, FM_eventMessage, len, FM_mqttQos, 0);
+            }
+        }
+    }
+}
+
+//the task runs as long as the firmware, the buffers are static to keep them off its stack
+static TM_Reading_t FM_mqttBatch[TM_MAX_BATCH];
+static uint8_t FM_mqttMessage[TM_MAX_MESSAGE];
+
+/*
+    takes a reading every MQTT_period and publishes them in batches of MQTT_batchSize. A batch is sent early if waiting for
+    the next reading would make its oldest reading older than MQTT_maxLatency. Nothing is collected while disconnected.
+    Period, batch size, latency, QoS, format and topic are read for every batch, so changing them needs no reconnect
+*/
 static void FM_MQTTTask(void * param){
-    esp_mqtt_client_handle_t client = (esp_mqtt_client_handle_t) param;
-    char buff[1024];
-    char fieldChannel[512];
-    sprintf(fieldChannel, "%s/reading", FM_mqttTopic);
-    while(1){ 
-        uint32_t len = sprintf(buff, "{\"measuredField\": %f,\r\n\"sensorReading\": %d,\r\n\"motorRPM\": %d\r\n}", FM_getField(), FM_getRaw(), FM_getMotorRPM());
-        esp_mqtt_client_publish(client, fieldChannel, buff, len, 1, 0);
-        vTaskDelay(FM_mqttPeriod / portTICK_PERIOD_MS);
+    char baseTopic[sizeof(FM_mqttTopic)];
+    char fieldChannel[80];
+
+    uint32_t count = 0;
+    uint32_t lastSequence = 0;
+    TickType_t batchStart = 0;
+    TickType_t lastWake = xTaskGetTickCount();
+    while(1){
+        //a period shorter than a rotor revolution would otherwise send the same reading several times
+        esp_mqtt_client_handle_t client = FM_mqttClient;
+        FM_Measurement_t measurement;
+        FM_getMeasurement(&measurement);
+        if(client == NULL){
+            count = 0;
+        }else if(measurement.sequence != lastSequence){
+            lastSequence = measurement.sequence;
+            TM_Reading_t * reading = &FM_mqttBatch[count++];
+            reading->time = measurement.time;
+            reading->field = measurement.field;
+            reading->raw = measurement.raw;
+            reading->rpm = measurement.rpm;
+            if(count == 1) batchStart = xTaskGetTickCount();
+        }
+
+        TickType_t age = xTaskGetTickCount() - batchStart;
+        unsigned full = count >= FM_mqttBatchSize || count >= TM_MAX_BATCH;
+        if(count > 0 && (full || age + pdMS_TO_TICKS(FM_mqttPeriod) > pdMS_TO_TICKS(FM_mqttMaxLatency))){
+            FM_getMqttTopic(baseTopic);
+            snprintf(fieldChannel, sizeof(fieldChannel), "%s/readings", baseTopic);
+            uint32_t len = TM_encode(FM_mqttBatch, count, FM_mqttFormat, FM_mqttMessage, TM_MAX_MESSAGE);
+            if(len > 0) esp_mqtt_client_publish(client, fieldChannel, (const char *) FM_mqttMessage, len, FM_mqttQos, 0);
+            count = 0;
+        }
+        vTaskDelayUntil(&lastWake, FM_mqttPeriod / portTICK_PERIOD_MS);
     }
 }
 
-TaskHandle_t FM_MqttTaskHandle = NULL;
 static void FM_MQTTHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data){
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
-        if(FM_MqttTaskHandle != NULL) vTaskDelete(FM_MqttTaskHandle);
-        xTaskCreate(FM_MQTTTask, "MQTT task", configMINIMAL_STACK_SIZE + 4000, client, tskIDLE_PRIORITY + 1, &FM_MqttTaskHandle);
+        FM_mqttClient = client;
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
         break;
     case MQTT_EVENT_DISCONNECTED:
-        if(FM_MqttTaskHandle != NULL) vTaskDelete(FM_MqttTaskHandle);
+        //the client reconnects on its own
+        FM_mqttClient = NULL;
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
         break;
     default:
@@ -292,22 +796,52 @@ static void FM_MQTTHandler(void *handler_args, esp_event_base_t base, int32_t ev
     }
 }
 
+//called by FM_loadSettings() on the httpd task, only touches the client if the connection settings changed
 void FM_initMQTT(){
-    SettingsItem * enabled = CFM_getSetting("MQTT_clientEnabled");
-    if(enabled == 0) return;
-    if(strcmp(enabled->value, "true") != 0) return;
+    const CFM_Settings_t * settings = CFM_getSettings();
+    unsigned enable = settings->MQTT_clientEnabled;
+    if(enable && settings->MQTT_brokerURI[0] == 0){
+        ESP_LOGW(TAG, "MQTT is enabled but no broker is configured");
+        enable = 0;
+    }
+
+    unsigned changed = strcmp(settings->MQTT_brokerURI, FM_mqttBroker) != 0 || strcmp(settings->MQTT_user, FM_mqttUser) != 0
+        || strcmp(settings->MQTT_password, FM_mqttPassword) != 0;
+    if(enable == FM_mqttRunning && (!enable || !changed)) return;
 
-    char * bUri = CFM_getSetting("MQTT_brokerURI")->value;
-    char * user = CFM_getSetting("MQTT_user")->value;
-    char * password = CFM_getSetting("MQTT_password")->value;
+    if(FM_mqttRunning){
+        FM_mqttClient = NULL;
+        esp_mqtt_client_stop(FM_mqttHandle);
+        FM_mqttRunning = 0;
+        ESP_LOGI(TAG, "MQTT client stopped");
+    }
+    if(!enable) return;
+
+    strlcpy(FM_mqttBroker, settings->MQTT_brokerURI, sizeof(FM_mqttBroker));
+    strlcpy(FM_mqttUser, settings->MQTT_user, sizeof(FM_mqttUser));
+    strlcpy(FM_mqttPassword, settings->MQTT_password, sizeof(FM_mqttPassword));
     esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = bUri,
-        .username = user,
-        .password = password,
+        .uri = FM_mqttBroker,
+        .username = FM_mqttUser,
+        .password = FM_mqttPassword,
+        .network_timeout_ms = FM_CONF_EVENT_NETWORK_TIMEOUT,
     };
 
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
-    /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, FM_MQTTHandler, NULL);
-    esp_mqtt_client_start(client);
+    if(FM_mqttHandle == NULL){
+        FM_mqttHandle = esp_mqtt_client_init(&mqtt_cfg);
+        if(FM_mqttHandle == NULL){
+            ESP_LOGE(TAG, "couldn't create the MQTT client");
+            return;
+        }
+        esp_mqtt_client_register_event(FM_mqttHandle, ESP_EVENT_ANY_ID, FM_MQTTHandler, NULL);
+        xTaskCreate(FM_MQTTTask, "MQTT task", configMINIMAL_STACK_SIZE + 4000, NULL, tskIDLE_PRIORITY + 1, &FM_mqttTaskHandle);
+    }else{
+        esp_mqtt_set_config(FM_mqttHandle, &mqtt_cfg);
+    }
+    if(esp_mqtt_client_start(FM_mqttHandle) != ESP_OK){
+        ESP_LOGE(TAG, "couldn't start the MQTT client");
+        return;
+    }
+    FM_mqttRunning = 1;
+    ESP_LOGI(TAG, "MQTT client started for %s", FM_mqttBroker);
 }
\ No newline at end of file
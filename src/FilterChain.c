@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FilterChain.h"
+
+#define FC_PI 3.14159265f
+#define FC_BUTTERWORTH_Q 0.70710678f
+
+typedef enum{
+    FC_MEDIAN,
+    FC_AVERAGE,
+    FC_LOWPASS,
+    FC_DECIMATE
+} FC_StageType_t;
+
+typedef struct{
+    FC_StageType_t type;
+    float param;
+} FC_StageSpec_t;
+
+static const struct{
+    const char * name;
+    FC_StageType_t type;
+} FC_stageNames[] = {
+    {"median", FC_MEDIAN},
+    {"avg", FC_AVERAGE},
+    {"lowpass", FC_LOWPASS},
+    {"decimate", FC_DECIMATE},
+};
+
+/*
+    The window is a ring of the last N readings, a sorted copy gives the median. With N a constant the insertion sort
+    unrolls into a fixed sequence of compares, one function is instantiated for every supported size
+*/
+#define FC_MEDIAN_FUNCTION(N)                                                   \
+static unsigned FC_median##N(FC_Stage_t * stage, float * value){               \
+    float * history = stage->history;                                          \
+    if(!stage->primed){                                                        \
+        for(uint32_t i = 0; i < N; i++) history[i] = *value;                   \
+        stage->primed = 1;                                                     \
+    }                                                                          \
+    history[stage->index] = *value;                                            \
+    if(++stage->index == N) stage->index = 0;                                  \
+                                                                               \
+    float sorted[N];                                                           \
+    for(uint32_t i = 0; i < N; i++){                                           \
+        float v = history[i];                                                  \
+        uint32_t j = i;                                                        \
+        for(; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];      \
+        sorted[j] = v;                                                         \
+    }                                                                          \
+    *value = sorted[N / 2];                                                    \
+    return 1;                                                                  \
+}
+
+FC_MEDIAN_FUNCTION(3)
+FC_MEDIAN_FUNCTION(5)
+FC_MEDIAN_FUNCTION(7)
+FC_MEDIAN_FUNCTION(9)
+
+//the running sum is rebuilt from the window whenever the ring wraps, so float rounding can't accumulate
+static unsigned FC_average(FC_Stage_t * stage, float * value){
+    float * history = stage->history;
+    if(!stage->primed){
+        for(uint32_t i = 0; i < stage->length; i++) history[i] = *value;
+        stage->sum = *value * (float) stage->length;
+        stage->primed = 1;
+    }
+    stage->sum += *value - history[stage->index];
+    history[stage->index] = *value;
+    if(++stage->index == stage->length){
+        stage->index = 0;
+        float sum = 0.0f;
+        for(uint32_t i = 0; i < stage->length; i++) sum += history[i];
+        stage->sum = sum;
+    }
+    *value = stage->sum * stage->scale;
+    return 1;
+}
+
+static unsigned FC_lowpass(FC_Stage_t * stage, float * value){
+    float x = *value;
+    if(!stage->primed){
+        //steady state for a constant input x
+        stage->z1 = (1.0f - stage->b0) * x;
+        stage->z2 = (stage->b2 - stage->a2) * x;
+        stage->primed = 1;
+    }
+    float y = stage->b0 * x + stage->z1;
+    stage->z1 = stage->b1 * x - stage->a1 * y + stage->z2;
+    stage->z2 = stage->b2 * x - stage->a2 * y;
+    *value = y;
+    return 1;
+}
+
+static unsigned FC_decimate(FC_Stage_t * stage, float * value){
+    (void) value;
+    uint32_t index = stage->index;
+    stage->index = (index + 1 == stage->length) ? 0 : index + 1;
+    return index == 0;
+}
+
+//RBJ cookbook low-pass, the Q of a 2nd order Butterworth filter
+static void FC_designLowpass(FC_Stage_t * stage, float cutoff, float sampleRate){
+    float w0 = 2.0f * FC_PI * cutoff / sampleRate;
+    float cosW0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * FC_BUTTERWORTH_Q);
+    float a0 = 1.0f + alpha;
+    stage->b0 = (1.0f - cosW0) * 0.5f / a0;
+    stage->b1 = (1.0f - cosW0) / a0;
+    stage->b2 = stage->b0;
+    stage->a1 = -2.0f * cosW0 / a0;
+    stage->a2 = (1.0f - alpha) / a0;
+}
+
+//reads "name:param" up to the next comma, returns the position after it or NULL if the stage is invalid
+static const char * FC_parseStage(const char * pos, FC_StageSpec_t * spec){
+    while(*pos == ' ') pos++;
+    const char * colon = strchr(pos, ':');
+    if(colon == NULL) return NULL;
+
+    uint32_t nameLength = colon - pos;
+    unsigned found = 0;
+    for(uint32_t i = 0; i < sizeof(FC_stageNames) / sizeof(FC_stageNames[0]); i++){
+        if(strlen(FC_stageNames[i].name) == nameLength && strncmp(pos, FC_stageNames[i].name, nameLength) == 0){
+            spec->type = FC_stageNames[i].type;
+            found = 1;
+            break;
+        }
+    }
+    if(!found) return NULL;
+
+    char * end;
+    spec->param = strtof(colon + 1, &end);
+    if(end == colon + 1) return NULL;
+    while(*end == ' ') end++;
+    if(*end == ',') return end + 1;
+    return (*end == 0) ? end : NULL;
+}
+
+/*
+    sampleRate is the rate of readings going into the chain, it is only needed for the cutoff of low-pass stages. The
+    chain is only changed if the whole description is valid, returns the number of stages or -1
+*/
+int FC_configure(FC_Chain_t * chain, const char * description, float sampleRate){
+    FC_StageSpec_t specs[FC_MAX_STAGES];
+    uint32_t count = 0;
+    uint32_t historyUsed = 0;
+    float rate = sampleRate;
+
+    const char * pos = description;
+    while(*pos == ' ') pos++;
+    while(*pos != 0){
+        if(count == FC_MAX_STAGES) return -1;
+        FC_StageSpec_t * spec = &specs[count];
+        pos = FC_parseStage(pos, spec);
+        if(pos == NULL || spec->param < 0.0f || spec->param > 65535.0f) return -1;
+
+        uint32_t length = (uint32_t) spec->param;
+        switch(spec->type){
+            case FC_MEDIAN:
+                if(spec->param != (float) length || (length != 3 && length != 5 && length != 7 && length != 9)) return -1;
+                historyUsed += length;
+                break;
+            case FC_AVERAGE:
+                if(spec->param != (float) length || length < 1 || length > FC_MAX_WINDOW) return -1;
+                historyUsed += length;
+                break;
+            case FC_LOWPASS:
+                if(!(spec->param > 0.0f) || spec->param >= rate * 0.5f) return -1;
+                break;
+            case FC_DECIMATE:
+                if(spec->param != (float) length || length < 1) return -1;
+                rate /= (float) length;
+                break;
+        }
+        if(historyUsed > FC_MAX_HISTORY) return -1;
+        count++;
+    }
+
+    memset(chain, 0, sizeof(FC_Chain_t));
+    float * history = chain->history;
+    rate = sampleRate;
+    for(uint32_t i = 0; i < count; i++){
+        FC_Stage_t * stage = &chain->stages[i];
+        stage->length = (uint32_t) specs[i].param;
+        switch(specs[i].type){
+            case FC_MEDIAN:
+                stage->process = (stage->length == 3) ? FC_median3 : (stage->length == 5) ? FC_median5 : (stage->length == 7) ? FC_median7 : FC_median9;
+                stage->history = history;
+                history += stage->length;
+                break;
+            case FC_AVERAGE:
+                stage->process = FC_average;
+                stage->scale = 1.0f / (float) stage->length;
+                stage->history = history;
+                history += stage->length;
+                break;
+            case FC_LOWPASS:
+                stage->process = FC_lowpass;
+                FC_designLowpass(stage, specs[i].param, rate);
+                break;
+            case FC_DECIMATE:
+                stage->process = FC_decimate;
+                rate /= (float) stage->length;
+                break;
+        }
+    }
+    chain->count = count;
+    return (int) count;
+}
+
+//forgets all readings, the next one primes the stages again
+void FC_reset(FC_Chain_t * chain){
+    for(uint32_t i = 0; i < chain->count; i++){
+        chain->stages[i].primed = 0;
+        chain->stages[i].index = 0;
+        chain->stages[i].z1 = chain->stages[i].z2 = 0.0f;
+    }
+}
@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+
+#include "History.h"
+#include "server.h"
+
+typedef struct{
+    uint32_t seconds;       //length of a bucket
+    uint32_t length;        //number of buckets in the ring
+    HI_Entry_t * entries;
+    uint32_t head;          //slot of the newest closed bucket
+    uint32_t filled;
+    uint32_t newestTime;    //start of the newest closed bucket
+
+    //bucket that is still being accumulated
+    unsigned started;
+    uint32_t currentTime;
+    float min;
+    float max;
+    double sum;
+    uint32_t count;
+} HI_Tier_t;
+
+#define HI_CHUNK 32     //entries formatted and sent at once
+
+static HI_Entry_t HI_storage[HI_TOTAL_ENTRIES];
+static HI_Tier_t HI_tiers[HI_TIER_COUNT];
+static portMUX_TYPE HI_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *TAG = "History";
+
+static void HI_tierAdd(uint32_t tierIndex, uint32_t time, float min, float max, double sum, uint32_t count);
+
+//stores the open bucket in the ring, hands it to the next tier and starts the following one
+static void HI_closeBucket(uint32_t tierIndex){
+    HI_Tier_t * tier = &HI_tiers[tierIndex];
+
+    //the stored buckets have to be consecutive, after a gap longer than the ring they are all out of its reach
+    if(tier->filled > 0 && tier->currentTime != tier->newestTime + tier->seconds) tier->filled = 0;
+
+    tier->head = (tier->head + 1 == tier->length) ? 0 : tier->head + 1;
+    HI_Entry_t * entry = &tier->entries[tier->head];
+    entry->count = tier->count;
+    entry->min = (tier->count > 0) ? tier->min : 0.0f;
+    entry->max = (tier->count > 0) ? tier->max : 0.0f;
+    entry->mean = (tier->count > 0) ? (float) (tier->sum / tier->count) : 0.0f;
+    if(tier->filled < tier->length) tier->filled++;
+    tier->newestTime = tier->currentTime;
+
+    if(tier->count > 0 && tierIndex + 1 < HI_TIER_COUNT) HI_tierAdd(tierIndex + 1, tier->currentTime, tier->min, tier->max, tier->sum, tier->count);
+
+    tier->currentTime += tier->seconds;
+    tier->count = 0;
+    tier->sum = 0.0;
+}
+
+static void HI_tierAdd(uint32_t tierIndex, uint32_t time, float min, float max, double sum, uint32_t count){
+    HI_Tier_t * tier = &HI_tiers[tierIndex];
+    uint32_t bucket = time - time % tier->seconds;
+
+    if(!tier->started){
+        tier->started = 1;
+        tier->currentTime = bucket;
+    }
+
+    //close the open bucket and add empty ones for a gap, a gap longer than the ring clears it and keeps only the open one
+    if(bucket > tier->currentTime){
+        uint32_t steps = (bucket - tier->currentTime) / tier->seconds;
+        if(steps > tier->length){
+            tier->filled = 0;
+            HI_closeBucket(tierIndex);
+            tier->currentTime = bucket;
+        }else{
+            for(uint32_t i = 0; i < steps; i++) HI_closeBucket(tierIndex);
+        }
+    }else if(bucket < tier->currentTime){
+        return;
+    }
+    if(count == 0) return;
+
+    if(tier->count == 0){
+        tier->min = min;
+        tier->max = max;
+    }else{
+        if(min < tier->min) tier->min = min;
+        if(max > tier->max) tier->max = max;
+    }
+    tier->sum += sum;
+    tier->count += count;
+}
+
+void HI_addValue(float value, uint32_t time){
+    portENTER_CRITICAL(&HI_lock);
+    HI_tierAdd(0, time, value, value, value, 1);
+    portEXIT_CRITICAL(&HI_lock);
+}
+
+/*
+    closes every bucket that ended before time even if no reading arrived since, so the last buckets show up after the
+    rotor stopped. A reading that arrives later for a closed bucket is dropped like any other late one
+*/
+void HI_advance(uint32_t time){
+    portENTER_CRITICAL(&HI_lock);
+    for(uint32_t i = 0; i < HI_TIER_COUNT; i++){
+        if(HI_tiers[i].started) HI_tierAdd(i, time, 0.0f, 0.0f, 0.0, 0);
+    }
+    portEXIT_CRITICAL(&HI_lock);
+}
+
+//copies up to maxEntries closed buckets starting at or after fromTime, oldest first. Returns the number of entries
+uint32_t HI_read(uint32_t tierIndex, uint32_t fromTime, HI_Entry_t * entries, uint32_t * times, uint32_t maxEntries){
+    if(tierIndex >= HI_TIER_COUNT) return 0;
+    HI_Tier_t * tier = &HI_tiers[tierIndex];
+    uint32_t count = 0;
+
+    portENTER_CRITICAL(&HI_lock);
+    if(tier->filled > 0){
+        uint32_t oldestTime = tier->newestTime - (tier->filled - 1) * tier->seconds;
+        uint32_t skip = (fromTime > oldestTime) ? (fromTime - oldestTime + tier->seconds - 1) / tier->seconds : 0;
+        if(skip < tier->filled){
+            count = tier->filled - skip;
+            if(count > maxEntries) count = maxEntries;
+
+            uint32_t slot = (tier->head + tier->length - (tier->filled - 1) + skip) % tier->length;
+            for(uint32_t i = 0; i < count; i++){
+                entries[i] = tier->entries[slot];
+                times[i] = oldestTime + (skip + i) * tier->seconds;
+                slot = (slot + 1 == tier->length) ? 0 : slot + 1;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&HI_lock);
+
+    return count;
+}
+
+typedef struct{
+    HI_Entry_t entries[HI_CHUNK];
+    uint32_t times[HI_CHUNK];
+    char text[HI_CHUNK * 64];
+} HI_ResponseBuffer_t;
+
+static esp_err_t HI_historyHandler(httpd_req_t *req){
+    uint32_t tierIndex = 0;
+    uint32_t fromTime = 0;
+
+    char query[64];
+    char value[16];
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK){
+        if(httpd_query_key_value(query, "tier", value, sizeof(value)) == ESP_OK) tierIndex = strtoul(value, NULL, 10);
+        if(httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK) fromTime = strtoul(value, NULL, 10) + 1;
+    }
+    if(tierIndex >= HI_TIER_COUNT){
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid tier");
+        return ESP_OK;
+    }
+    HI_Tier_t * tier = &HI_tiers[tierIndex];
+    HI_advance((uint32_t) (esp_timer_get_time() / 1000000));
+
+    HI_ResponseBuffer_t * buffer = malloc(sizeof(HI_ResponseBuffer_t));
+    if(buffer == NULL) return ESP_ERR_NO_MEM;
+
+    httpd_resp_set_type(req, "application/json");
+    snprintf(buffer->text, sizeof(buffer->text), "{\"tier\":%d,\"bucket\":%d,\"newest\":%d,\"entries\":[", tierIndex, tier->seconds, tier->newestTime);
+    esp_err_t ret = httpd_resp_sendstr_chunk(req, buffer->text);
+
+    //entries are read by time, so buckets closing while the response is sent don't mess up the order
+    unsigned first = 1;
+    while(ret == ESP_OK){
+        uint32_t count = HI_read(tierIndex, fromTime, buffer->entries, buffer->times, HI_CHUNK);
+        if(count == 0) break;
+
+        uint32_t length = 0;
+        for(uint32_t i = 0; i < count; i++){
+            const HI_Entry_t * entry = &buffer->entries[i];
+            char * pos = buffer->text + length;
+            uint32_t space = sizeof(buffer->text) - length;
+            if(entry->count > 0) length += snprintf(pos, space, "%s[%d,%g,%g,%g,%d]", first ? "" : ",", buffer->times[i], entry->min, entry->max, entry->mean, entry->count);
+            else length += snprintf(pos, space, "%s[%d,null,null,null,0]", first ? "" : ",", buffer->times[i]);
+            first = 0;
+        }
+        ret = httpd_resp_send_chunk(req, buffer->text, length);
+
+        if(count < HI_CHUNK) break;
+        fromTime = buffer->times[count - 1] + 1;
+    }
+
+    free(buffer);
+    if(ret != ESP_OK) return ret;
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void HI_init(){
+    const uint32_t seconds[HI_TIER_COUNT] = HI_TIER_SECONDS;
+    const uint32_t lengths[HI_TIER_COUNT] = HI_TIER_LENGTH;
+
+    HI_Entry_t * storage = HI_storage;
+    for(uint32_t i = 0; i < HI_TIER_COUNT; i++){
+        HI_tiers[i].seconds = seconds[i];
+        HI_tiers[i].length = lengths[i];
+        HI_tiers[i].entries = storage;
+        HI_tiers[i].head = lengths[i] - 1;
+        storage += lengths[i];
+    }
+    ESP_LOGI(TAG, "keeping %d buckets in %d bytes", HI_TOTAL_ENTRIES, (uint32_t) HI_MEMORY);
+
+    httpd_uri_t history = {
+        .uri       = "/history",
+        .method    = HTTP_GET,
+        .handler   = HI_historyHandler
+    };
+    httpd_register_uri_handler(SERVER_getServer(), &history);
+}
@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "JsonTok.h"
+
+enum{
+    JT_EXPECT_VALUE,
+    JT_EXPECT_VALUE_OR_END,     //right after [
+    JT_EXPECT_KEY,
+    JT_EXPECT_KEY_OR_END,       //right after {
+    JT_EXPECT_COLON,
+    JT_EXPECT_COMMA_OR_END,
+    JT_EXPECT_NOTHING           //the top level value is complete
+};
+
+enum{
+    JT_LEX_NONE,
+    JT_LEX_KEY,
+    JT_LEX_STRING,
+    JT_LEX_NUMBER,
+    JT_LEX_LITERAL
+};
+
+void JT_init(JT_Parser_t * parser, JT_Callback_t callback, void * ctx){
+    memset(parser, 0, sizeof(JT_Parser_t));
+    parser->callback = callback;
+    parser->ctx = ctx;
+    parser->expect = JT_EXPECT_VALUE;
+    parser->lex = JT_LEX_NONE;
+}
+
+static JT_Result_t JT_fail(JT_Parser_t * parser, JT_Result_t error){
+    parser->error = error;
+    return error;
+}
+
+static unsigned JT_inObject(const JT_Parser_t * parser){
+    return parser->depth > 0 && ((parser->objectMask >> (parser->depth - 1)) & 1);
+}
+
+static void JT_valueDone(JT_Parser_t * parser){
+    parser->expect = (parser->depth == 0) ? JT_EXPECT_NOTHING : JT_EXPECT_COMMA_OR_END;
+}
+
+//hands a token to the callback, if parts of it were collected from previous chunks the rest is appended to them first
+static JT_Result_t JT_emit(JT_Parser_t * parser, JT_TokenType_t type, const char * start, uint32_t length){
+    JT_Token_t token = {.type = type, .start = start, .length = length, .depth = parser->depth, .escaped = parser->escaped};
+
+    if(parser->partialLength > 0){
+        if(parser->partialLength + length > JT_MAX_TOKEN) return JT_fail(parser, JT_ERR_TOKEN_TOO_LONG);
+        memcpy(parser->partial + parser->partialLength, start, length);
+        token.start = parser->partial;
+        token.length = parser->partialLength + length;
+        parser->partialLength = 0;
+    }
+
+    if(parser->callback != 0 && parser->callback(parser->ctx, &token) != 0) return JT_fail(parser, JT_ERR_ABORTED);
+    return JT_OK;
+}
+
+static unsigned JT_isDigit(char c){
+    return c >= '0' && c <= '9';
+}
+
+static unsigned JT_isHex(char c){
+    return JT_isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static unsigned JT_isNumberChar(char c){
+    return JT_isDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+//-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static unsigned JT_isValidNumber(const char * s, uint32_t length){
+    uint32_t i = 0;
+    if(i < length && s[i] == '-') i++;
+    if(i >= length || !JT_isDigit(s[i])) return 0;
+    if(s[i] == '0') i++; else while(i < length && JT_isDigit(s[i])) i++;
+    if(i < length && s[i] == '.'){
+        i++;
+        if(i >= length || !JT_isDigit(s[i])) return 0;
+        while(i < length && JT_isDigit(s[i])) i++;
+    }
+    if(i < length && (s[i] == 'e' || s[i] == 'E')){
+        i++;
+        if(i < length && (s[i] == '+' || s[i] == '-')) i++;
+        if(i >= length || !JT_isDigit(s[i])) return 0;
+        while(i < length && JT_isDigit(s[i])) i++;
+    }
+    return i == length;
+}
+
+//ends a number or literal, the token may be partly in parser->partial
+static JT_Result_t JT_endBareToken(JT_Parser_t * parser, const char * start, uint32_t length){
+    if(parser->partialLength > 0){
+        if(parser->partialLength + length > JT_MAX_TOKEN) return JT_fail(parser, JT_ERR_TOKEN_TOO_LONG);
+        memcpy(parser->partial + parser->partialLength, start, length);
+        start = parser->partial;
+        length += parser->partialLength;
+        parser->partialLength = 0;
+    }
+
+    JT_TokenType_t type;
+    if(parser->lex == JT_LEX_NUMBER){
+        if(!JT_isValidNumber(start, length)) return JT_fail(parser, JT_ERR_SYNTAX);
+        type = JT_NUMBER;
+    }else if(length == 4 && memcmp(start, "true", 4) == 0){
+        type = JT_TRUE;
+    }else if(length == 5 && memcmp(start, "false", 5) == 0){
+        type = JT_FALSE;
+    }else if(length == 4 && memcmp(start, "null", 4) == 0){
+        type = JT_NULL;
+    }else{
+        return JT_fail(parser, JT_ERR_SYNTAX);
+    }
+
+    parser->lex = JT_LEX_NONE;
+    JT_Result_t ret = JT_emit(parser, type, start, length);
+    if(ret != JT_OK) return ret;
+    JT_valueDone(parser);
+    return JT_OK;
+}
+
+JT_Result_t JT_feed(JT_Parser_t * parser, const char * data, uint32_t length){
+    if(parser->error != JT_OK) return parser->error;
+
+    //a token that was started in the previous chunk continues at the start of this one
+    const char * tokenStart = data;
+
+    for(uint32_t i = 0; i < length; i++, parser->position++){
+        char c = data[i];
+
+        if(parser->lex == JT_LEX_STRING || parser->lex == JT_LEX_KEY){
+            if(parser->escape == 1){
+                if(c == 'u') parser->escape = 5;
+                else if(c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' || c == 'n' || c == 'r' || c == 't') parser->escape = 0;
+                else return JT_fail(parser, JT_ERR_SYNTAX);
+            }else if(parser->escape > 1){
+                if(!JT_isHex(c)) return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->escape = (parser->escape == 2) ? 0 : parser->escape - 1;
+            }else if(c == '\\'){
+                parser->escape = 1;
+                parser->escaped = 1;
+            }else if(c == '"'){
+                unsigned isKey = parser->lex == JT_LEX_KEY;
+                parser->lex = JT_LEX_NONE;
+                JT_Result_t ret = JT_emit(parser, isKey ? JT_KEY : JT_STRING, tokenStart, data + i - tokenStart);
+                if(ret != JT_OK) return ret;
+                if(isKey) parser->expect = JT_EXPECT_COLON; else JT_valueDone(parser);
+            }else if((uint8_t) c < 0x20){
+                return JT_fail(parser, JT_ERR_SYNTAX);
+            }
+            continue;
+        }
+
+        if(parser->lex == JT_LEX_NUMBER || parser->lex == JT_LEX_LITERAL){
+            if(parser->lex == JT_LEX_NUMBER ? JT_isNumberChar(c) : (c >= 'a' && c <= 'z')) continue;
+            JT_Result_t ret = JT_endBareToken(parser, tokenStart, data + i - tokenStart);
+            if(ret != JT_OK) return ret;
+            //the character that ended the token is handled below
+        }
+
+        switch(c){
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                break;
+
+            case '{':
+            case '[':{
+                if(parser->expect != JT_EXPECT_VALUE && parser->expect != JT_EXPECT_VALUE_OR_END) return JT_fail(parser, JT_ERR_SYNTAX);
+                if(parser->depth >= JT_MAX_DEPTH) return JT_fail(parser, JT_ERR_DEPTH);
+                parser->escaped = 0;
+                JT_Result_t ret = JT_emit(parser, (c == '{') ? JT_OBJECT_START : JT_ARRAY_START, data + i, 1);
+                if(ret != JT_OK) return ret;
+                if(c == '{') parser->objectMask |= (1u << parser->depth); else parser->objectMask &= ~(1u << parser->depth);
+                parser->depth ++;
+                parser->expect = (c == '{') ? JT_EXPECT_KEY_OR_END : JT_EXPECT_VALUE_OR_END;
+                break;
+            }
+
+            case '}':
+            case ']':{
+                unsigned isObject = (c == '}');
+                if(parser->depth == 0 || JT_inObject(parser) != isObject) return JT_fail(parser, JT_ERR_SYNTAX);
+                if(parser->expect != JT_EXPECT_COMMA_OR_END && parser->expect != (isObject ? JT_EXPECT_KEY_OR_END : JT_EXPECT_VALUE_OR_END)) return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->depth --;
+                parser->escaped = 0;
+                JT_Result_t ret = JT_emit(parser, isObject ? JT_OBJECT_END : JT_ARRAY_END, data + i, 1);
+                if(ret != JT_OK) return ret;
+                JT_valueDone(parser);
+                break;
+            }
+
+            case ':':
+                if(parser->expect != JT_EXPECT_COLON) return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->expect = JT_EXPECT_VALUE;
+                break;
+
+            case ',':
+                if(parser->expect != JT_EXPECT_COMMA_OR_END) return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->expect = JT_inObject(parser) ? JT_EXPECT_KEY : JT_EXPECT_VALUE;
+                break;
+
+            case '"':
+                if(parser->expect == JT_EXPECT_KEY || parser->expect == JT_EXPECT_KEY_OR_END) parser->lex = JT_LEX_KEY;
+                else if(parser->expect == JT_EXPECT_VALUE || parser->expect == JT_EXPECT_VALUE_OR_END) parser->lex = JT_LEX_STRING;
+                else return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->escape = 0;
+                parser->escaped = 0;
+                tokenStart = data + i + 1;
+                break;
+
+            default:
+                if(parser->expect != JT_EXPECT_VALUE && parser->expect != JT_EXPECT_VALUE_OR_END) return JT_fail(parser, JT_ERR_SYNTAX);
+                if(c == '-' || JT_isDigit(c)) parser->lex = JT_LEX_NUMBER;
+                else if(c >= 'a' && c <= 'z') parser->lex = JT_LEX_LITERAL;
+                else return JT_fail(parser, JT_ERR_SYNTAX);
+                parser->escaped = 0;
+                tokenStart = data + i;
+                break;
+        }
+    }
+
+    //keep the beginning of an unfinished token, the chunk is gone once we return
+    if(parser->lex != JT_LEX_NONE){
+        uint32_t rest = data + length - tokenStart;
+        if(parser->partialLength + rest > JT_MAX_TOKEN) return JT_fail(parser, JT_ERR_TOKEN_TOO_LONG);
+        memcpy(parser->partial + parser->partialLength, tokenStart, rest);
+        parser->partialLength += rest;
+    }
+    return JT_OK;
+}
+
+//has to be called after the last chunk, a number at the very end can only be completed here
+JT_Result_t JT_finish(JT_Parser_t * parser){
+    if(parser->error != JT_OK) return parser->error;
+    if(parser->lex == JT_LEX_NUMBER || parser->lex == JT_LEX_LITERAL){
+        JT_Result_t ret = JT_endBareToken(parser, "", 0);
+        if(ret != JT_OK) return ret;
+    }
+    if(parser->lex != JT_LEX_NONE || parser->expect != JT_EXPECT_NOTHING) return JT_fail(parser, JT_ERR_INCOMPLETE);
+    return JT_OK;
+}
+
+static uint32_t JT_hexValue(const char * s){
+    uint32_t value = 0;
+    for(uint32_t i = 0; i < 4; i++){
+        char c = s[i];
+        value <<= 4;
+        if(c >= '0' && c <= '9') value |= c - '0';
+        else if(c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+    }
+    return value;
+}
+
+//decodes a raw string token into dest as UTF-8, the result is always zero terminated and cut off if it doesn't fit
+uint32_t JT_unescape(const char * src, uint32_t length, char * dest, uint32_t destSize){
+    if(destSize == 0) return 0;
+    uint32_t out = 0;
+    for(uint32_t i = 0; i < length && out + 1 < destSize; i++){
+        char c = src[i];
+        if(c != '\\' || i + 1 >= length){
+            dest[out++] = c;
+            continue;
+        }
+
+        c = src[++i];
+        switch(c){
+            case 'b': dest[out++] = '\b'; break;
+            case 'f': dest[out++] = '\f'; break;
+            case 'n': dest[out++] = '\n'; break;
+            case 'r': dest[out++] = '\r'; break;
+            case 't': dest[out++] = '\t'; break;
+            case 'u':{
+                if(i + 4 >= length) return (dest[out] = 0, out);
+                uint32_t cp = JT_hexValue(&src[i + 1]);
+                i += 4;
+                //combine surrogate pairs, a lone surrogate is replaced
+                if(cp >= 0xd800 && cp < 0xdc00 && i + 6 < length && src[i + 1] == '\\' && src[i + 2] == 'u'){
+                    uint32_t low = JT_hexValue(&src[i + 3]);
+                    if(low >= 0xdc00 && low < 0xe000){
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        i += 6;
+                    }
+                }
+                if(cp >= 0xd800 && cp < 0xe000) cp = '?';
+
+                uint8_t utf8[4];
+                uint32_t n;
+                if(cp < 0x80){ utf8[0] = cp; n = 1; }
+                else if(cp < 0x800){ utf8[0] = 0xc0 | (cp >> 6); utf8[1] = 0x80 | (cp & 0x3f); n = 2; }
+                else if(cp < 0x10000){ utf8[0] = 0xe0 | (cp >> 12); utf8[1] = 0x80 | ((cp >> 6) & 0x3f); utf8[2] = 0x80 | (cp & 0x3f); n = 3; }
+                else{ utf8[0] = 0xf0 | (cp >> 18); utf8[1] = 0x80 | ((cp >> 12) & 0x3f); utf8[2] = 0x80 | ((cp >> 6) & 0x3f); utf8[3] = 0x80 | (cp & 0x3f); n = 4; }
+                if(out + n + 1 > destSize) return (dest[out] = 0, out);
+                memcpy(&dest[out], utf8, n);
+                out += n;
+                break;
+            }
+            default: dest[out++] = c; break;
+        }
+    }
+    dest[out] = 0;
+    return out;
+}
+
+unsigned JT_equals(const JT_Token_t * token, const char * string){
+    uint32_t length = strlen(string);
+    return token->length == length && memcmp(token->start, string, length) == 0;
+}
+
+const char * JT_errorString(JT_Result_t error){
+    switch(error){
+        case JT_OK: return "ok";
+        case JT_ERR_SYNTAX: return "syntax error";
+        case JT_ERR_DEPTH: return "nested too deep";
+        case JT_ERR_TOKEN_TOO_LONG: return "token too long";
+        case JT_ERR_INCOMPLETE: return "incomplete document";
+        case JT_ERR_ABORTED: return "aborted";
+    }
+    return "unknown error";
+}
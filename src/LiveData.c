@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+
+#include "LiveData.h"
+#include "FieldMill.h"
+#include "server.h"
+
+typedef struct{
+    int fd;                 //-1 if the slot is free
+    TickType_t period;
+    TickType_t lastSent;
+} LD_Client_t;
+
+//one serialized update and the clients it goes to
+typedef struct{
+    uint32_t length;
+    uint32_t fdCount;
+    int fds[LD_MAX_CLIENTS];
+    char payload[LD_MAX_PAYLOAD];
+} LD_Update_t;
+
+static LD_Client_t LD_clients[LD_MAX_CLIENTS];
+static portMUX_TYPE LD_clientLock = portMUX_INITIALIZER_UNLOCKED;
+
+//only one update is in flight at a time, the buffer belongs to the httpd task while LD_updatePending is set
+static LD_Update_t LD_update;
+static volatile unsigned LD_updatePending = 0;
+
+static httpd_handle_t LD_server = NULL;
+
+static const char *TAG = "LiveData";
+
+//returns 0 if all slots are taken
+static unsigned LD_setClientPeriod(int fd, uint32_t periodMs){
+    if(periodMs < LD_TICK_MS) periodMs = LD_TICK_MS;
+    if(periodMs > LD_MAX_PERIOD_MS) periodMs = LD_MAX_PERIOD_MS;
+
+    int32_t slot = -1;
+    portENTER_CRITICAL(&LD_clientLock);
+    for(int32_t i = 0; i < LD_MAX_CLIENTS; i++){
+        if(LD_clients[i].fd == fd){
+            slot = i;
+            break;
+        }
+        if(slot < 0 && LD_clients[i].fd < 0) slot = i;
+    }
+    if(slot >= 0){
+        LD_clients[slot].fd = fd;
+        LD_clients[slot].period = pdMS_TO_TICKS(periodMs);
+        LD_clients[slot].lastSent = 0;
+    }
+    portEXIT_CRITICAL(&LD_clientLock);
+
+    return slot >= 0;
+}
+
+static void LD_removeClient(int fd){
+    portENTER_CRITICAL(&LD_clientLock);
+    for(uint32_t i = 0; i < LD_MAX_CLIENTS; i++){
+        if(LD_clients[i].fd == fd) LD_clients[i].fd = -1;
+    }
+    portEXIT_CRITICAL(&LD_clientLock);
+}
+
+static esp_err_t LD_wsHandler(httpd_req_t *req){
+    int fd = httpd_req_to_sockfd(req);
+
+    //the handler is called once for the handshake of a new connection
+    if(req->method == HTTP_GET){
+        if(!LD_setClientPeriod(fd, LD_DEFAULT_PERIOD_MS)){
+            ESP_LOGW(TAG, "too many live data clients, rejecting %d", fd);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "client %d connected", fd);
+        return ESP_OK;
+    }
+
+    //anything else is a client asking for a different update period or, if empty, a keepalive
+    char buffer[16];
+    httpd_ws_frame_t frame = {0};
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if(ret != ESP_OK) return ret;
+    if(frame.type != HTTPD_WS_TYPE_TEXT || frame.len >= sizeof(buffer)) return ESP_FAIL;
+
+    frame.payload = (uint8_t *) buffer;
+    if(frame.len > 0){
+        ret = httpd_ws_recv_frame(req, &frame, frame.len);
+        if(ret != ESP_OK) return ret;
+    }
+    if(frame.len == 0) return ESP_OK;
+    buffer[frame.len] = 0;
+
+    uint32_t period = strtoul(buffer, NULL, 10);
+    if(!LD_setClientPeriod(fd, period)) return ESP_FAIL;
+    ESP_LOGI(TAG, "client %d requested an update every %d ms", fd, period);
+    return ESP_OK;
+}
+
+//runs in the httpd task
+static void LD_sendUpdate(void * arg){
+    LD_Update_t * update = (LD_Update_t *) arg;
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *) update->payload,
+        .len = update->length
+    };
+
+    for(uint32_t i = 0; i < update->fdCount; i++){
+        int fd = update->fds[i];
+        //the socket might have been closed or reused for a plain http request since the client registered
+        if(httpd_ws_get_fd_info(LD_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET || httpd_ws_send_frame_async(LD_server, fd, &frame) != ESP_OK){
+            ESP_LOGI(TAG, "client %d is gone", fd);
+            LD_removeClient(fd);
+        }
+    }
+
+    LD_updatePending = 0;
+}
+
+static void LD_task(void * param){
+    FM_Measurement_t measurement;
+    uint32_t lastSequence = 0;
+    TickType_t lastWake = xTaskGetTickCount();
+    while(1){
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(LD_TICK_MS));
+        if(LD_updatePending) continue;
+
+        //nothing new was measured, the clients that are due get it on a later tick
+        FM_getMeasurement(&measurement);
+        if(measurement.sequence == lastSequence) continue;
+
+        TickType_t now = xTaskGetTickCount();
+        LD_update.fdCount = 0;
+        portENTER_CRITICAL(&LD_clientLock);
+        for(uint32_t i = 0; i < LD_MAX_CLIENTS; i++){
+            LD_Client_t * client = &LD_clients[i];
+            if(client->fd < 0 || (now - client->lastSent) < client->period) continue;
+            client->lastSent = now;
+            LD_update.fds[LD_update.fdCount++] = client->fd;
+        }
+        portEXIT_CRITICAL(&LD_clientLock);
+        if(LD_update.fdCount == 0) continue;
+        lastSequence = measurement.sequence;
+
+        LD_update.length = snprintf(LD_update.payload, LD_MAX_PAYLOAD, "{\"t\":%u,\"f\":%.2f,\"r\":%d,\"n\":%u}",
+            measurement.time, measurement.field, measurement.raw, measurement.rpm);
+        if(LD_update.length >= LD_MAX_PAYLOAD) LD_update.length = LD_MAX_PAYLOAD - 1;
+
+        LD_updatePending = 1;
+        if(httpd_queue_work(LD_server, LD_sendUpdate, &LD_update) != ESP_OK) LD_updatePending = 0;
+    }
+}
+
+void LD_init(){
+    LD_server = SERVER_getServer();
+    for(uint32_t i = 0; i < LD_MAX_CLIENTS; i++) LD_clients[i].fd = -1;
+
+    httpd_uri_t live = {
+        .uri          = "/live",
+        .method       = HTTP_GET,
+        .handler      = LD_wsHandler,
+        .is_websocket = true
+    };
+    httpd_register_uri_handler(LD_server, &live);
+
+    xTaskCreate(LD_task, "live data task", configMINIMAL_STACK_SIZE + 2000, 0, tskIDLE_PRIORITY + 1, 0);
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "LockIn.h"
+
+void LI_init(LI_Demodulator_t * li, uint32_t averagingCycles){
+    memset(li, 0, sizeof(LI_Demodulator_t));
+    li->alpha = 1.0f / (float) ((averagingCycles > 0) ? averagingCycles : 1);
+    li->gain = 1.0f;
+}
+
+//drops the current segment pair, used when the rotor signal was lost
+void LI_reset(LI_Demodulator_t * li){
+    li->segSum[0] = li->segSum[1] = 0;
+    li->segCount[0] = li->segCount[1] = 0;
+    li->matchedSum = li->matchedNorm = 0.0f;
+    li->matchedCount = 0;
+}
+
+//takes effect with the next completed revolution
+void LI_setGain(LI_Demodulator_t * li, float gain){
+    li->gain = gain;
+}
+
+//returns 1 whenever a revolution was completed and li->inPhase/li->average have been updated
+unsigned LI_addSample(LI_Demodulator_t * li, int32_t value, unsigned rotorPos){
+    return LI_addWeightedSample(li, value, rotorPos, NULL);
+}
+
+//weight may be NULL for an unweighted sample
+unsigned LI_addWeightedSample(LI_Demodulator_t * li, int32_t value, unsigned rotorPos, const LI_Weight_t * weight){
+    unsigned pos = rotorPos ? 1 : 0;
+    unsigned ret = 0;
+
+    //a new revolution starts with the first sample of the positive segment
+    if(pos == 1 && li->lastPos == 0){
+        if(li->segCount[0] != 0 && li->segCount[1] != 0){
+            if(li->matchedCount == li->segCount[0] + li->segCount[1] && li->matchedNorm > 0.0f){
+                li->inPhase = li->matchedSum / li->matchedNorm * li->gain;
+                li->matchedCycles ++;
+            }else{
+                float meanPos = (float) li->segSum[1] / (float) li->segCount[1];
+                float meanNeg = (float) li->segSum[0] / (float) li->segCount[0];
+                li->inPhase = (meanPos - meanNeg) * 0.5f * li->gain;
+            }
+
+            if(li->cycleCount == 0){
+                li->average = li->inPhase;
+            }else{
+                li->average += (li->inPhase - li->average) * li->alpha;
+            }
+            li->cycleCount ++;
+            ret = 1;
+        }else if(li->segCount[0] != 0 || li->segCount[1] != 0){
+            li->droppedCycles ++;
+        }
+        LI_reset(li);
+    }
+
+    li->segSum[pos] += value;
+    li->segCount[pos] ++;
+    if(weight != NULL){
+        li->matchedSum += weight->weight * ((float) value - weight->offset);
+        li->matchedNorm += weight->norm;
+        li->matchedCount ++;
+    }
+    li->lastPos = pos;
+    return ret;
+}
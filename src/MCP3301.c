@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -12,27 +13,58 @@
 
 #include "FieldMill.h"
 #include "MCP3301.h"
+#include "SampleRing.h"
+#include "RotorPhase.h"
+
+typedef struct{
+    uint32_t count;
+    ADC_Sample_t samples[ADC_BURST_LEN];
+} ADC_Block_t;
 
 static void ADC_task(void * harambe);
 
-static xQueueHandle ADC_sampleQue = NULL;
-static xQueueHandle ADC_triggerQue = NULL;
+static SR_Ring_t ADC_sampleRing;
+static TaskHandle_t ADC_taskHandle = NULL;
+static TaskHandle_t ADC_consumerHandle = NULL;
+static RP_Predictor_t ADC_predictor;
+static RP_Schedule_t ADC_schedule;
+static portMUX_TYPE ADC_scheduleLock = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint64_t ADC_segmentEdge = 0;     //edge the current burst belongs to, written by the rotor ISR
 static spi_device_handle_t ADC_devHandle;
 
 static const char *TAG = "ADC";
 
-unsigned state2;
-void ADC_timerISR(void *para){
+//fires once per rotor segment at the start of the predicted burst
+static void IRAM_ATTR ADC_timerISR(void *para){
 	timer_spinlock_take(TIMER_GROUP_0);
 	timer_group_clr_intr_status_in_isr(TIMER_GROUP_0, 1);
-    timer_group_enable_alarm_in_isr(TIMER_GROUP_0, 1);
     timer_spinlock_give(TIMER_GROUP_0);
-	BaseType_t xHigherPriorityTaskWoken;
-    xQueueSendFromISR(ADC_triggerQue, ADC_triggerQue, &xHigherPriorityTaskWoken);
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(ADC_taskHandle, &xHigherPriorityTaskWoken);
     if(xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
 }
 
-xQueueHandle ADC_init(uint32_t samplingRate){
+//called by the rotor ISR on every edge, arms the one shot alarm that starts the burst of the new segment. edgeTime is the
+//captured time of the edge on the ADC timer, so the interrupt latency doesn't shift the burst
+void IRAM_ATTR ADC_segmentStartFromISR(uint64_t edgeTime){
+	ADC_segmentEdge = edgeTime;
+	//the schedule is rewritten by the ADC task and the motor task, offset and length have to come from the same one
+	portENTER_CRITICAL_ISR(&ADC_scheduleLock);
+	uint32_t startOffset = ADC_schedule.startOffset;
+	uint32_t burstLen = ADC_schedule.burstLen;
+	portEXIT_CRITICAL_ISR(&ADC_scheduleLock);
+	if(burstLen == 0) return;
+	uint64_t start = edgeTime + startOffset;
+	timer_spinlock_take(TIMER_GROUP_0);
+	uint64_t now = timer_group_get_counter_value_in_isr(TIMER_GROUP_0, 1);
+	if(start <= now) start = now + 1;
+	timer_group_set_alarm_value_in_isr(TIMER_GROUP_0, 1, start);
+    timer_group_enable_alarm_in_isr(TIMER_GROUP_0, 1);
+    timer_spinlock_give(TIMER_GROUP_0);
+}
+
+//samplingRate is the upper limit for the average number of conversions per second
+SR_Ring_t * ADC_init(uint32_t samplingRate, uint32_t deadtimePermille){
 	spi_bus_config_t buscfg={
 		.miso_io_num	=	FM_ADC_DIN_PIN,
 		.sclk_io_num	=	FM_ADC_CLK_PIN,
@@ -49,7 +81,7 @@ xQueueHandle ADC_init(uint32_t samplingRate){
 		.address_bits 	= 	0,
 		.dummy_bits 	= 	0,
 		.spics_io_num	=	FM_ADC_CS_PIN,
-		.queue_size		=	1,
+		.queue_size		=	ADC_BURST_LEN,	//the whole burst is queued at once and clocked out by the driver
         .flags = SPI_DEVICE_HALFDUPLEX,
 	};
 
@@ -58,60 +90,120 @@ xQueueHandle ADC_init(uint32_t samplingRate){
 	ret=spi_bus_add_device(HSPI_HOST, &devcfg, &ADC_devHandle);
 	ESP_ERROR_CHECK(ret);
 
+	//free running, the alarm is re-armed for every segment by ADC_segmentStartFromISR()
 	timer_config_t config = {
         .divider = 2,
         .counter_dir = TIMER_COUNT_UP,
         .counter_en = TIMER_START,
-        .alarm_en = TIMER_ALARM_EN,
-        .auto_reload = TIMER_AUTORELOAD_EN,
+        .alarm_en = TIMER_ALARM_DIS,
+        .auto_reload = TIMER_AUTORELOAD_DIS,
     };
     timer_init(TIMER_GROUP_0, 1, &config);
+    timer_set_counter_value(TIMER_GROUP_0, 1, 0);
     timer_start(TIMER_GROUP_0, 1);
 
-    ADC_sampleQue = xQueueCreate(10, sizeof(ADC_Sample_t)); 
-    ADC_triggerQue = xQueueCreate(10, sizeof(ADC_triggerQue));  
-	
-    ADC_setSampingRate(2400);
+    RP_init(&ADC_predictor, TIMER_BASE_CLK / 2, deadtimePermille, ADC_BURST_LEN, samplingRate);
+    RP_schedule(&ADC_predictor, &ADC_schedule);
+
+    ADC_Sample_t * ringBuffer = malloc(sizeof(ADC_Sample_t) * ADC_RING_DEPTH);
+    ESP_ERROR_CHECK(SR_init(&ADC_sampleRing, ringBuffer, sizeof(ADC_Sample_t), ADC_RING_DEPTH) == 0 ? ESP_OK : ESP_ERR_INVALID_ARG);
+
+    xTaskCreate(ADC_task, "adc task", configMINIMAL_STACK_SIZE + 4000, 0, tskIDLE_PRIORITY + 10, &ADC_taskHandle);
+
     timer_enable_intr(TIMER_GROUP_0, 1);
     timer_isr_register(TIMER_GROUP_0, 1, ADC_timerISR, 1, 0, NULL);
+    return &ADC_sampleRing;
+}
+
+//called with the time between four rotor edges in timer ticks whenever it was measured, or 0 if the rotor stopped
+void ADC_setRotorPeriod(uint64_t periodTicks){
+    portENTER_CRITICAL(&ADC_scheduleLock);
+    RP_updatePeriod(&ADC_predictor, periodTicks);
+    RP_schedule(&ADC_predictor, &ADC_schedule);
+    portEXIT_CRITICAL(&ADC_scheduleLock);
+}
 
-    xTaskCreate(ADC_task, "adc task", configMINIMAL_STACK_SIZE + 4000, 0, tskIDLE_PRIORITY + 10, 0);
-    return ADC_sampleQue;
+void ADC_setDeadtime(uint32_t deadtimePermille){
+    portENTER_CRITICAL(&ADC_scheduleLock);
+    RP_setDeadtime(&ADC_predictor, deadtimePermille);
+    RP_schedule(&ADC_predictor, &ADC_schedule);
+    portEXIT_CRITICAL(&ADC_scheduleLock);
+}
+
+//sweeps the bursts through the whole segment ignoring the deadtime so the edges can be profiled, 0 returns to normal
+void ADC_setSweep(uint32_t sweepSteps){
+    portENTER_CRITICAL(&ADC_scheduleLock);
+    RP_setSweep(&ADC_predictor, sweepSteps);
+    RP_schedule(&ADC_predictor, &ADC_schedule);
+    portEXIT_CRITICAL(&ADC_scheduleLock);
+}
+
+//the calling task gets a notification whenever new samples were written to the ring
+void ADC_registerConsumer(){
+    ADC_consumerHandle = xTaskGetCurrentTaskHandle();
 }
 
 unsigned state;
-static void ADC_sample(ADC_Sample_t * ret){
-    spi_transaction_t transaction = {.rxlength = 16, .rx_buffer=&(ret->value)};
-    timer_get_counter_value(TIMER_GROUP_0, 0, &(ret->sampleTime));
-	unsigned use = FM_isSampleUsable(ret->sampleTime);
-	gpio_set_level(22, use);
-	if(!use) return;
-    ret->rotorPos = FM_rotorPos;
-	spi_device_polling_transmit(ADC_devHandle, &transaction);
-	ret->value = SPI_SWAP_DATA_RX(ret->value, 16);
-    if(ret->value & 0x1000) ret->value |= 0xfffff000; else ret->value &= 0xfff;  //sign extend the value
-	//ESP_LOGI(TAG, "got new ADC reading: %d at motorPos %d", ret->value, ret->rotorPos);
+static void ADC_burst(ADC_Block_t * block, spi_transaction_t * transactions){
+    RP_Schedule_t schedule;
+    portENTER_CRITICAL(&ADC_scheduleLock);
+    schedule = ADC_schedule;
+    portEXIT_CRITICAL(&ADC_scheduleLock);
+
+    block->count = 0;
+    if(schedule.burstLen == 0) return;
+
+    uint64_t sampleTime, start, end;
+    unsigned rotorPos = FM_rotorPos;
+    uint64_t edge = ADC_segmentEdge;
+
+	gpio_set_level(22, 1);
+    timer_get_counter_value(TIMER_GROUP_0, 1, &start);
+    sampleTime = start;
+    for(uint32_t i = 0; i < schedule.burstLen; i++){
+        transactions[i] = (spi_transaction_t) {.flags = SPI_TRANS_USE_RXDATA, .rxlength = 16};
+        spi_device_queue_trans(ADC_devHandle, &transactions[i], portMAX_DELAY);
+    }
+    for(uint32_t i = 0; i < schedule.burstLen; i++){
+        spi_transaction_t * done;
+        spi_device_get_trans_result(ADC_devHandle, &done, portMAX_DELAY);
+    }
+    timer_get_counter_value(TIMER_GROUP_0, 1, &end);
+	gpio_set_level(22, 0);
+
+    //the burst was placed inside the usable window, so every conversion is valid unless the segment is being swept
+    sampleTime += schedule.convTicks >> 1;
+    for(uint32_t i = 0; i < schedule.burstLen; i++){
+        ADC_Sample_t * sample = &block->samples[i];
+        sample->sampleTime = sampleTime;
+        sample->rotorPos = rotorPos;
+        sample->edgeOffset = (uint32_t) (sampleTime - edge);
+        sample->value = ADC_signExtend(SPI_SWAP_DATA_RX(*(uint32_t *) transactions[i].rx_data, 16));
+        sampleTime += schedule.convTicks;
+    }
+    block->count = schedule.burstLen;
+
+    portENTER_CRITICAL(&ADC_scheduleLock);
+    RP_updateConversionTime(&ADC_predictor, (uint32_t) (end - start), schedule.burstLen);
+    RP_nextSweep(&ADC_predictor);
+    RP_schedule(&ADC_predictor, &ADC_schedule);
+    portEXIT_CRITICAL(&ADC_scheduleLock);
 	gpio_set_level(23, (state = !state));
 }
 
 static void ADC_task(void * harambe){
     //kill(harambe);
+    static spi_transaction_t transactions[ADC_BURST_LEN];
+    static ADC_Block_t block;
 
     while(1){
-		QueueHandle_t * data;
-		if(xQueueReceive(ADC_triggerQue, &data, 1000/portTICK_PERIOD_MS)){
-			ADC_Sample_t sample;
-			ADC_sample(&sample);
-			xQueueSend(ADC_sampleQue, &sample, 0);
+		if(ulTaskNotifyTake(pdTRUE, 1000/portTICK_PERIOD_MS)){
+			ADC_burst(&block, transactions);
+			if(block.count == 0) continue;
+			SR_write(&ADC_sampleRing, block.samples, block.count);
+			if(ADC_consumerHandle != NULL) xTaskNotifyGive(ADC_consumerHandle);
 		}else{
 			ESP_LOGI(TAG, "where samples??");
 		}
     }
 }
-
-void ADC_setSampingRate(uint32_t samplingRate){
-	uint32_t targetCount = TIMER_BASE_CLK / (samplingRate * 4);
-	ESP_LOGI(TAG, "target count = %d", targetCount);
-    timer_set_alarm_value(TIMER_GROUP_0, 1, targetCount);
-    timer_set_counter_value(TIMER_GROUP_0, 1, 0);
-}
\ No newline at end of file
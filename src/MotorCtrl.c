@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "MotorCtrl.h"
+
+static float MC_clamp(float value, float min, float max){
+    if(value > max) return max;
+    if(value < min) return min;
+    return value;
+}
+
+void MC_init(MC_Controller_t * mc, const MC_Tuning_t * tuning){
+    memset(mc, 0, sizeof(MC_Controller_t));
+    mc->tuning = *tuning;
+}
+
+//new gains take effect on the next update, the integral is kept so the output doesn't jump
+void MC_setTuning(MC_Controller_t * mc, const MC_Tuning_t * tuning){
+    mc->tuning = *tuning;
+    mc->integral = MC_clamp(mc->integral, tuning->outMin - tuning->outMax, tuning->outMax - tuning->outMin);
+}
+
+//restarts the controller from the feed forward duty of the target, used when the rotor signal was lost
+void MC_reset(MC_Controller_t * mc, float target){
+    mc->integral = 0.0f;
+    mc->primed = 0;
+    mc->saturated = 0;
+    mc->output = MC_clamp(mc->tuning.feedForward * target, mc->tuning.outMin, mc->tuning.outMax);
+}
+
+//called with every measured rotor period, dt is the period in seconds. Returns the new duty in %
+float MC_update(MC_Controller_t * mc, float target, float rpm, float dt){
+    const MC_Tuning_t * t = &mc->tuning;
+    if(dt <= 0.0f) return mc->output;
+
+    float error = target - rpm;
+    float derivative = mc->primed ? (mc->lastRpm - rpm) / dt : 0.0f;
+    mc->lastRpm = rpm;
+    mc->primed = 1;
+
+    //don't integrate large errors or further into a limit the output is already stuck at
+    float step = t->ki * error * dt;
+    unsigned inBand = t->integralBand <= 0.0f || (error < t->integralBand && error > -t->integralBand);
+    if(inBand && !(mc->saturated > 0 && step > 0.0f) && !(mc->saturated < 0 && step < 0.0f)){
+        mc->integral = MC_clamp(mc->integral + step, t->outMin - t->outMax, t->outMax - t->outMin);
+    }
+
+    float out = t->feedForward * target + t->kp * error + mc->integral + t->kd * derivative;
+
+    int saturated = 0;
+    if(out > t->outMax){
+        out = t->outMax;
+        saturated = 1;
+    }else if(out < t->outMin){
+        out = t->outMin;
+        saturated = -1;
+    }
+
+    //a slew limited output counts as saturated as well, otherwise the integral winds up during every large step
+    if(t->slewRate > 0.0f){
+        float maxStep = t->slewRate * dt;
+        if(out > mc->output + maxStep){
+            out = mc->output + maxStep;
+            saturated = 1;
+        }else if(out < mc->output - maxStep){
+            out = mc->output - maxStep;
+            saturated = -1;
+        }
+    }
+
+    mc->saturated = saturated;
+    mc->output = out;
+    return out;
+}
@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "RotorEdge.h"
+
+//called from the capture interrupt on the device
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define RE_ISR_ATTR IRAM_ATTR
+#else
+#define RE_ISR_ATTR
+#endif
+
+void RE_init(RE_Filter_t * re){
+    memset(re, 0, sizeof(RE_Filter_t));
+}
+
+RE_Result_t RE_ISR_ATTR RE_addEdge(RE_Filter_t * re, uint32_t timestamp, unsigned level){
+    level = level ? 1 : 0;
+    uint32_t interval = timestamp - re->lastEdge;
+
+    if(re->started){
+        if(level == re->level || interval < (re->period >> 4)){
+            re->rejected ++;
+            return RE_REJECTED;
+        }
+
+        //half a revolution should take a quarter of the period. Twice that means the rotor stalled or an edge was lost,
+        //after a lost edge the next one has the same polarity and is rejected, so the gap is three quarters
+        if(re->period != 0 && interval > (re->period >> 1)){
+            re->period = 0;
+            re->edgeCount = 0;
+            re->restarts ++;
+        }
+    }
+
+    re->started = 1;
+    re->lastEdge = timestamp;
+    re->level = level;
+
+    if(re->edgeCount == 0){
+        if(level == 1){
+            re->periodStart = timestamp;
+            re->edgeCount = 1;
+        }
+        return RE_EDGE;
+    }
+
+    if(re->edgeCount < RE_EDGES_PER_PERIOD){
+        re->edgeCount ++;
+        return RE_EDGE;
+    }
+
+    //the fifth edge ends this period and starts the next one
+    re->period = timestamp - re->periodStart;
+    re->periodStart = timestamp;
+    re->edgeCount = 1;
+    return RE_PERIOD;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "RotorPhase.h"
+
+#define RP_SEGMENTS_PER_PERIOD 4
+#define RP_DEFAULT_CONV_US 12   //rough duration of one 16 bit transfer at 1.7MHz incl. driver overhead until it was measured
+
+void RP_init(RP_Predictor_t * rp, uint32_t timerHz, uint32_t deadtimePermille, uint32_t maxBurst, uint32_t maxSampleRate){
+    memset(rp, 0, sizeof(RP_Predictor_t));
+    rp->timerHz = timerHz;
+    rp->deadtimePermille = deadtimePermille;
+    rp->maxBurst = maxBurst;
+    rp->maxSampleRate = maxSampleRate;
+    rp->convTicks = (timerHz / 1000000) * RP_DEFAULT_CONV_US;
+}
+
+//periodTicks is the time between four rotor edges, 0 if the rotor isn't turning
+void RP_updatePeriod(RP_Predictor_t * rp, uint64_t periodTicks){
+    rp->segmentTicks = (uint32_t) (periodTicks / RP_SEGMENTS_PER_PERIOD);
+    rp->deadtime = RP_deadtimeTicks(rp->segmentTicks, rp->deadtimePermille);
+}
+
+uint32_t RP_deadtimeTicks(uint32_t segmentTicks, uint32_t deadtimePermille){
+    return (uint32_t) (((uint64_t) segmentTicks * deadtimePermille) / 1000);
+}
+
+void RP_updateConversionTime(RP_Predictor_t * rp, uint32_t burstTicks, uint32_t burstLen){
+    if(burstLen == 0 || burstTicks == 0) return;
+    uint32_t measured = burstTicks / burstLen;
+    //slowly follow the measurement so a single preempted burst doesn't shrink the window
+    rp->convTicks = (rp->convTicks * 7 + measured + 7) >> 3;
+}
+
+void RP_setDeadtime(RP_Predictor_t * rp, uint32_t deadtimePermille){
+    if(deadtimePermille > 499) deadtimePermille = 499;
+    rp->deadtimePermille = deadtimePermille;
+    rp->deadtime = RP_deadtimeTicks(rp->segmentTicks, deadtimePermille);
+}
+
+//0 stops the sweep and centers the burst in the window again
+void RP_setSweep(RP_Predictor_t * rp, uint32_t sweepSteps){
+    rp->sweepSteps = sweepSteps;
+    rp->sweepPos = 0;
+}
+
+//called once per burst, moves the next burst one step further through the segment
+void RP_nextSweep(RP_Predictor_t * rp){
+    if(rp->sweepSteps == 0) return;
+    if(++rp->sweepPos >= rp->sweepSteps) rp->sweepPos = 0;
+}
+
+void RP_schedule(const RP_Predictor_t * rp, RP_Schedule_t * out){
+    uint32_t deadtime = (rp->sweepSteps != 0) ? 0 : rp->deadtime;
+    out->convTicks = rp->convTicks;
+    out->startOffset = deadtime;
+    out->burstLen = 0;
+    if(rp->segmentTicks <= 2 * deadtime || rp->convTicks == 0) return;
+
+    uint32_t window = rp->segmentTicks - 2 * deadtime;
+    uint32_t burstLen = window / rp->convTicks;
+    if(burstLen > rp->maxBurst) burstLen = rp->maxBurst;
+
+    if(rp->maxSampleRate != 0){
+        uint32_t rateLimit = (uint32_t) (((uint64_t) rp->maxSampleRate * rp->segmentTicks) / rp->timerHz);
+        if(burstLen > rateLimit) burstLen = rateLimit;
+    }
+
+    out->burstLen = burstLen;
+    uint32_t pad = window - burstLen * rp->convTicks;
+    if(rp->sweepSteps > 1){
+        out->startOffset = deadtime + (uint32_t) (((uint64_t) pad * rp->sweepPos) / (rp->sweepSteps - 1));
+    }else{
+        out->startOffset = deadtime + (pad >> 1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "SampleRing.h"
+
+//returns 0 on success or -1 if depth isn't a power of two
+int SR_init(SR_Ring_t * ring, void * buffer, uint32_t elemSize, uint32_t depth){
+    if(buffer == 0 || elemSize == 0 || depth == 0 || (depth & (depth - 1)) != 0) return -1;
+    ring->buffer = buffer;
+    ring->elemSize = elemSize;
+    ring->mask = depth - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overruns, 0);
+    atomic_init(&ring->highWater, 0);
+    return 0;
+}
+
+//producer side, returns the number of elements that were written. The rest is counted as overrun
+uint32_t SR_write(SR_Ring_t * ring, const void * elems, uint32_t count){
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t space = (ring->mask + 1) - (head - tail);
+
+    uint32_t toWrite = (count < space) ? count : space;
+    if(toWrite < count) atomic_fetch_add_explicit(&ring->overruns, count - toWrite, memory_order_relaxed);
+    if(toWrite == 0) return 0;
+
+    //copy in at most two parts, the second one starts at the beginning of the buffer
+    uint32_t start = head & ring->mask;
+    uint32_t firstPart = ring->mask + 1 - start;
+    if(firstPart > toWrite) firstPart = toWrite;
+    memcpy(ring->buffer + start * ring->elemSize, elems, firstPart * ring->elemSize);
+    if(toWrite > firstPart) memcpy(ring->buffer, (const uint8_t *) elems + firstPart * ring->elemSize, (toWrite - firstPart) * ring->elemSize);
+
+    atomic_store_explicit(&ring->head, head + toWrite, memory_order_release);
+
+    uint32_t level = head + toWrite - tail;
+    if(level > atomic_load_explicit(&ring->highWater, memory_order_relaxed)) atomic_store_explicit(&ring->highWater, level, memory_order_relaxed);
+    return toWrite;
+}
+
+//consumer side, returns the number of elements available in one contiguous block and points elems to the first one
+uint32_t SR_peek(SR_Ring_t * ring, void ** elems){
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t available = head - tail;
+    if(available == 0) return 0;
+
+    uint32_t start = tail & ring->mask;
+    uint32_t contiguous = ring->mask + 1 - start;
+    *elems = ring->buffer + start * ring->elemSize;
+    return (available < contiguous) ? available : contiguous;
+}
+
+//consumer side, releases elements previously returned by SR_peek()
+void SR_consume(SR_Ring_t * ring, uint32_t count){
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+//consumer side, copies up to maxCount elements out of the ring
+uint32_t SR_read(SR_Ring_t * ring, void * elems, uint32_t maxCount){
+    uint32_t done = 0;
+    while(done < maxCount){
+        void * block;
+        uint32_t count = SR_peek(ring, &block);
+        if(count == 0) break;
+        if(count > maxCount - done) count = maxCount - done;
+        memcpy((uint8_t *) elems + done * ring->elemSize, block, count * ring->elemSize);
+        SR_consume(ring, count);
+        done += count;
+    }
+    return done;
+}
+
+uint32_t SR_fillLevel(SR_Ring_t * ring){
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,263 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#include "server.h"
+#include "ConfigManager.h"
+#include "FieldMill.h"
+#include "SpeedCal.h"
+
+#define SC_POLL_MS 20
+
+typedef enum{
+    SC_IDLE,
+    SC_RUNNING,
+    SC_DONE,
+    SC_FAILED
+} SC_State_t;
+
+typedef struct{
+    float rpm;              //measured mean speed of the step
+    float raw;              //mean uncompensated reading of the step
+} SC_Point_t;
+
+static const char *TAG = "SpeedCal";
+
+//written by the calibration task, the status handler copies them under the lock
+static SC_State_t SC_state = SC_IDLE;
+static SC_Point_t SC_points[SC_MAX_STEPS];
+static uint32_t SC_pointCount = 0;
+static const char * SC_error = "";
+static float SC_gain = 0.0f;
+static portMUX_TYPE SC_lock = portMUX_INITIALIZER_UNLOCKED;
+
+//only changed by the start handler while no calibration is running
+static uint32_t SC_low;
+static uint32_t SC_high;
+static uint32_t SC_steps;
+static uint32_t SC_settle;
+static uint32_t SC_dwell;
+static uint32_t SC_ref;
+
+unsigned SC_isRunning(){
+    portENTER_CRITICAL(&SC_lock);
+    unsigned running = (SC_state == SC_RUNNING);
+    portEXIT_CRITICAL(&SC_lock);
+    return running;
+}
+
+static void SC_finish(SC_State_t state, const char * error){
+    portENTER_CRITICAL(&SC_lock);
+    SC_state = state;
+    SC_error = error;
+    portEXIT_CRITICAL(&SC_lock);
+    if(state == SC_FAILED) ESP_LOGW(TAG, "calibration failed: %s", error);
+}
+
+//averages every new measurement over the dwell time, returns the number of measurements
+static uint32_t SC_measure(SC_Point_t * point){
+    FM_Measurement_t measurement;
+    FM_getMeasurement(&measurement);
+    uint32_t lastSequence = measurement.sequence;
+
+    double sumRaw = 0.0;
+    double sumRpm = 0.0;
+    uint32_t count = 0;
+    TickType_t start = xTaskGetTickCount();
+    while(xTaskGetTickCount() - start < pdMS_TO_TICKS(SC_dwell)){
+        vTaskDelay(pdMS_TO_TICKS(SC_POLL_MS));
+        FM_getMeasurement(&measurement);
+        if(measurement.sequence == lastSequence || measurement.rpm == 0) continue;
+        lastSequence = measurement.sequence;
+        sumRaw += measurement.reading;
+        sumRpm += measurement.rpm;
+        count++;
+    }
+
+    if(count > 0){
+        point->raw = (float) (sumRaw / count);
+        point->rpm = (float) (sumRpm / count);
+    }
+    return count;
+}
+
+//least squares line out = a + b * (n - ref) through the points, y = b / a
+static const char * SC_fit(float * gain){
+    double sumX = 0.0, sumY = 0.0;
+    for(uint32_t i = 0; i < SC_pointCount; i++){
+        sumX += SC_points[i].rpm - (float) SC_ref;
+        sumY += SC_points[i].raw;
+    }
+    double meanX = sumX / SC_pointCount;
+    double meanY = sumY / SC_pointCount;
+
+    double sxx = 0.0, sxy = 0.0;
+    for(uint32_t i = 0; i < SC_pointCount; i++){
+        double dx = SC_points[i].rpm - (float) SC_ref - meanX;
+        sxx += dx * dx;
+        sxy += dx * (SC_points[i].raw - meanY);
+    }
+    if(sxx < 1.0) return "the motor speed didn't change";
+
+    double slope = sxy / sxx;
+    double intercept = meanY - slope * meanX;
+    if(fabs(intercept) < SC_MIN_SIGNAL) return "reading too small, apply a static field";
+
+    *gain = (float) (slope / intercept);
+    const CFM_SettingDesc_t * desc = CFM_getSettingDesc(CFM_FM_speedGain);
+    if(*gain < desc->min || *gain > desc->max) return "gain out of range";
+    return NULL;
+}
+
+//runs on the httpd task like every other change of the settings
+static void SC_storeResult(void * arg){
+    esp_err_t ret = CFM_setNumber(CFM_FM_speedGain, SC_gain);
+    if(ret == ESP_OK) ret = CFM_setNumber(CFM_FM_speedRefRPM, SC_ref);
+    const CFM_Settings_t * settings = CFM_getSettings();
+    FM_setSpeedCompensation(settings->FM_speedGain, settings->FM_speedRefRPM);
+    if(ret == ESP_OK) SC_finish(SC_DONE, "");
+    else SC_finish(SC_FAILED, "result applied but could not be stored");
+}
+
+static void SC_task(void * param){
+    const CFM_Settings_t * settings = CFM_getSettings();
+    const char * error = NULL;
+
+    //the points have to be measured without the compensation that is being calibrated
+    FM_setSpeedCompensation(0.0f, SC_ref);
+    for(uint32_t i = 0; i < SC_steps && error == NULL; i++){
+        uint32_t target = SC_low + (SC_high - SC_low) * i / (SC_steps - 1);
+        ESP_LOGI(TAG, "step %d/%d: %d rpm", i + 1, SC_steps, target);
+        FM_setTargetRPM(target);
+        vTaskDelay(pdMS_TO_TICKS(SC_settle));
+
+        SC_Point_t point;
+        if(SC_measure(&point) == 0){
+            error = "no readings, is the rotor turning?";
+            break;
+        }
+        ESP_LOGI(TAG, "%.1f rpm -> %.2f", point.rpm, point.raw);
+        portENTER_CRITICAL(&SC_lock);
+        SC_points[SC_pointCount++] = point;
+        portEXIT_CRITICAL(&SC_lock);
+    }
+
+    FM_setTargetRPM(settings->FM_targetRPM);
+    float gain = 0.0f;
+    if(error == NULL) error = SC_fit(&gain);
+
+    if(error == NULL){
+        ESP_LOGI(TAG, "speed gain %.7f/rpm around %d rpm", gain, SC_ref);
+        portENTER_CRITICAL(&SC_lock);
+        SC_gain = gain;
+        portEXIT_CRITICAL(&SC_lock);
+        if(httpd_queue_work(SERVER_getServer(), SC_storeResult, NULL) != ESP_OK) error = "couldn't store the result";
+    }
+    if(error != NULL){
+        FM_setSpeedCompensation(settings->FM_speedGain, settings->FM_speedRefRPM);
+        SC_finish(SC_FAILED, error);
+    }
+    vTaskDelete(NULL);
+}
+
+static uint32_t SC_queryValue(const char * query, const char * key, uint32_t def, uint32_t min, uint32_t max){
+    char value[16];
+    if(httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) return def;
+    uint32_t number = strtoul(value, NULL, 10);
+    if(number < min) number = min;
+    if(number > max) number = max;
+    return number;
+}
+
+static esp_err_t SC_startHandler(httpd_req_t *req){
+    const CFM_Settings_t * settings = CFM_getSettings();
+    const CFM_SettingDesc_t * rpmDesc = CFM_getSettingDesc(CFM_FM_targetRPM);
+    uint32_t minRpm = (uint32_t) rpmDesc->min;
+    uint32_t maxRpm = (uint32_t) rpmDesc->max;
+
+    if(SC_isRunning()){
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_sendstr(req, "calibration already running");
+    }
+
+    char query[128] = "";
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+    SC_ref = SC_queryValue(query, "ref", settings->FM_targetRPM, minRpm, maxRpm);
+    SC_low = SC_queryValue(query, "low", (SC_ref > minRpm + 300) ? SC_ref - 300 : minRpm, minRpm, maxRpm);
+    SC_high = SC_queryValue(query, "high", (SC_ref + 300 < maxRpm) ? SC_ref + 300 : maxRpm, minRpm, maxRpm);
+    SC_steps = SC_queryValue(query, "steps", 5, 2, SC_MAX_STEPS);
+    SC_settle = SC_queryValue(query, "settle", 5000, 500, 60000);
+    SC_dwell = SC_queryValue(query, "dwell", 3000, 500, 60000);
+    if(SC_high <= SC_low){
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "high has to be above low");
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&SC_lock);
+    SC_state = SC_RUNNING;
+    SC_error = "";
+    SC_pointCount = 0;
+    SC_gain = 0.0f;
+    portEXIT_CRITICAL(&SC_lock);
+
+    ESP_LOGI(TAG, "calibrating %d-%d rpm in %d steps around %d rpm", SC_low, SC_high, SC_steps, SC_ref);
+    if(xTaskCreate(SC_task, "speed cal task", configMINIMAL_STACK_SIZE + 3000, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS){
+        SC_finish(SC_FAILED, "no memory for the calibration task");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory for the calibration task");
+        return ESP_OK;
+    }
+    return httpd_resp_sendstr(req, "OK");
+}
+
+static const char * SC_stateName(SC_State_t state){
+    switch(state){
+        case SC_IDLE: return "idle";
+        case SC_RUNNING: return "running";
+        case SC_DONE: return "done";
+        case SC_FAILED: return "failed";
+    }
+    return "unknown";
+}
+
+static esp_err_t SC_statusHandler(httpd_req_t *req){
+    SC_Point_t points[SC_MAX_STEPS];
+    portENTER_CRITICAL(&SC_lock);
+    SC_State_t state = SC_state;
+    const char * error = SC_error;
+    float gain = SC_gain;
+    uint32_t count = SC_pointCount;
+    for(uint32_t i = 0; i < count; i++) points[i] = SC_points[i];
+    portEXIT_CRITICAL(&SC_lock);
+
+    char buff[96 + 32 * SC_MAX_STEPS + 64];
+    uint32_t len = snprintf(buff, sizeof(buff), "{\"state\":\"%s\",\"steps\":%d,\"ref\":%d,\"gain\":%.7f,\"points\":[", SC_stateName(state), SC_steps, SC_ref, gain);
+    for(uint32_t i = 0; i < count; i++){
+        len += snprintf(buff + len, sizeof(buff) - len, "%s[%.1f,%.2f]", (i > 0) ? "," : "", points[i].rpm, points[i].raw);
+    }
+    snprintf(buff + len, sizeof(buff) - len, "],\"error\":\"%s\"}", error);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buff);
+}
+
+void SC_init(){
+    httpd_handle_t server = SERVER_getServer();
+
+    httpd_uri_t start = {
+        .uri       = "/speedcal/start",
+        .method    = HTTP_GET,
+        .handler   = SC_startHandler
+    };
+    httpd_register_uri_handler(server, &start);
+
+    httpd_uri_t status = {
+        .uri       = "/speedcal/status",
+        .method    = HTTP_GET,
+        .handler   = SC_statusHandler
+    };
+    httpd_register_uri_handler(server, &status);
+}
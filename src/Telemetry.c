@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Telemetry.h"
+
+//unknown names fall back to json
+TM_Format_t TM_parseFormat(const char * name){
+    if(strcmp(name, "cbor") == 0) return TM_FORMAT_CBOR;
+    return TM_FORMAT_JSON;
+}
+
+static uint32_t TM_encodeJSON(const TM_Reading_t * readings, uint32_t count, char * buffer, uint32_t size){
+    uint32_t length = 0;
+    buffer[length++] = '[';
+    for(uint32_t i = 0; i < count; i++){
+        const TM_Reading_t * reading = &readings[i];
+        int written = snprintf(buffer + length, size - length, "%s[%u,%.7g,%d,%u]", (i > 0) ? "," : "", reading->time, reading->field, reading->raw, reading->rpm);
+        if(written < 0 || (uint32_t) written >= size - length) return 0;
+        length += written;
+    }
+    if(length + 1 > size) return 0;
+    buffer[length++] = ']';
+    return length;
+}
+
+/*
+    Minimal CBOR (RFC 8949) writer, only what the batches need: arrays, integers and float32
+*/
+typedef struct{
+    uint8_t * buffer;
+    uint32_t size;
+    uint32_t length;
+    unsigned overflow;
+} TM_CborWriter_t;
+
+static void TM_cborHead(TM_CborWriter_t * writer, uint8_t major, uint32_t value){
+    uint8_t head[5];
+    uint32_t headLength;
+    if(value < 24){
+        head[0] = (major << 5) | value;
+        headLength = 1;
+    }else if(value <= 0xff){
+        head[0] = (major << 5) | 24;
+        head[1] = value;
+        headLength = 2;
+    }else if(value <= 0xffff){
+        head[0] = (major << 5) | 25;
+        head[1] = value >> 8;
+        head[2] = value;
+        headLength = 3;
+    }else{
+        head[0] = (major << 5) | 26;
+        head[1] = value >> 24;
+        head[2] = value >> 16;
+        head[3] = value >> 8;
+        head[4] = value;
+        headLength = 5;
+    }
+
+    if(writer->length + headLength > writer->size){
+        writer->overflow = 1;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, head, headLength);
+    writer->length += headLength;
+}
+
+static void TM_cborInt(TM_CborWriter_t * writer, int32_t value){
+    //negative integers are stored as -1 - n
+    if(value >= 0) TM_cborHead(writer, 0, value);
+    else TM_cborHead(writer, 1, (uint32_t) (-1 - value));
+}
+
+static void TM_cborFloat(TM_CborWriter_t * writer, float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if(writer->length + 5 > writer->size){
+        writer->overflow = 1;
+        return;
+    }
+    uint8_t * out = writer->buffer + writer->length;
+    out[0] = (7 << 5) | 26;
+    out[1] = bits >> 24;
+    out[2] = bits >> 16;
+    out[3] = bits >> 8;
+    out[4] = bits;
+    writer->length += 5;
+}
+
+static uint32_t TM_encodeCBOR(const TM_Reading_t * readings, uint32_t count, uint8_t * buffer, uint32_t size){
+    TM_CborWriter_t writer = {.buffer = buffer, .size = size};
+    TM_cborHead(&writer, 4, count);
+    for(uint32_t i = 0; i < count; i++){
+        TM_cborHead(&writer, 4, 4);
+        TM_cborHead(&writer, 0, readings[i].time);
+        TM_cborFloat(&writer, readings[i].field);
+        TM_cborInt(&writer, readings[i].raw);
+        TM_cborHead(&writer, 0, readings[i].rpm);
+    }
+    return writer.overflow ? 0 : writer.length;
+}
+
+//returns the length of the message or 0 if it doesn't fit into the buffer
+uint32_t TM_encode(const TM_Reading_t * readings, uint32_t count, TM_Format_t format, uint8_t * buffer, uint32_t size){
+    if(size < 2) return 0;
+    if(format == TM_FORMAT_CBOR) return TM_encodeCBOR(readings, count, buffer, size);
+    return TM_encodeJSON(readings, count, (char *) buffer, size);
+}
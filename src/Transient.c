@@ -0,0 +1,97 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Transient.h"
+
+#define TR_MASK (TR_RING - 1)
+
+//detects nothing until TR_configure() sets a threshold
+void TR_init(TR_Detector_t * tr){
+    memset(tr, 0, sizeof(TR_Detector_t));
+    tr->slopeWindow = 1;
+    tr->armed = 1;
+}
+
+/*
+    can be called at any time, the rate of the next reading is taken over the new slope window. A running event ends
+    early if the post window got shorter than what it already recorded
+*/
+void TR_configure(TR_Detector_t * tr, uint32_t slopeWindow, float rateThreshold, float levelThreshold, uint32_t pre, uint32_t post){
+    if(slopeWindow < 1) slopeWindow = 1;
+    if(slopeWindow > TR_RING - 1) slopeWindow = TR_RING - 1;
+    tr->slopeWindow = slopeWindow;
+    tr->rateThreshold = rateThreshold;
+    tr->levelThreshold = levelThreshold;
+    tr->pre = (pre > TR_MAX_WINDOW) ? TR_MAX_WINDOW : pre;
+    tr->post = (post > TR_MAX_WINDOW) ? TR_MAX_WINDOW : post;
+    if(tr->recording && tr->remaining > tr->post) tr->remaining = (tr->post > 0) ? tr->post : 1;
+}
+
+static unsigned TR_cause(const TR_Detector_t * tr, float field){
+    unsigned cause = 0;
+    if(tr->rateThreshold > 0.0f && fabsf(tr->rate) >= tr->rateThreshold) cause |= TR_CAUSE_RATE;
+    if(tr->levelThreshold > 0.0f && fabsf(field) >= tr->levelThreshold) cause |= TR_CAUSE_LEVEL;
+    return cause;
+}
+
+TR_Result_t TR_addReading(TR_Detector_t * tr, uint64_t time, float field){
+    TR_Reading_t * reading = &tr->ring[tr->head & TR_MASK];
+    reading->time = time;
+    reading->field = field;
+    tr->head ++;
+
+    tr->rate = 0.0f;
+    if(tr->head > tr->slopeWindow){
+        const TR_Reading_t * old = &tr->ring[(tr->head - 1 - tr->slopeWindow) & TR_MASK];
+        if(time > old->time) tr->rate = (field - old->field) * 1e6f / (float) (time - old->time);
+    }
+
+    unsigned cause = TR_cause(tr, field);
+    if(tr->recording){
+        if(--tr->remaining > 0) return TR_NONE;
+        tr->recording = 0;
+        tr->armed = (cause == 0);
+        return TR_COMPLETE;
+    }
+
+    if(!tr->armed){
+        tr->armed = (cause == 0);
+        return TR_NONE;
+    }
+    if(cause == 0) return TR_NONE;
+
+    tr->triggerHead = tr->head;
+    tr->events ++;
+    tr->trigger.event = tr->events;
+    tr->trigger.time = time;
+    tr->trigger.field = field;
+    tr->trigger.rate = tr->rate;
+    tr->trigger.cause = cause;
+    tr->armed = 0;
+    if(tr->post == 0) return TR_TRIGGER;        //nothing to wait for, TR_copyWindow works right away
+    tr->recording = 1;
+    tr->remaining = tr->post;
+    return TR_TRIGGER;
+}
+
+//the trigger of the last event, all zero before the first one
+void TR_lastTrigger(const TR_Detector_t * tr, TR_Trigger_t * trigger){
+    *trigger = tr->trigger;
+}
+
+/*
+    copies the window of the last event in chronological order into out, which needs room for 2 * TR_MAX_WINDOW + 1
+    readings. Returns the number of readings, triggerIndex is the position of the trigger reading in out
+*/
+uint32_t TR_copyWindow(const TR_Detector_t * tr, TR_Reading_t * out, uint32_t * triggerIndex){
+    uint32_t trigger = tr->triggerHead - 1;
+    uint32_t pre = (trigger < tr->pre) ? trigger : tr->pre;
+    uint32_t end = tr->recording ? tr->head : tr->triggerHead + tr->post;
+    if(end > tr->head) end = tr->head;
+
+    uint32_t count = 0;
+    for(uint32_t i = trigger - pre; i < end; i++) out[count++] = tr->ring[i & TR_MASK];
+    *triggerIndex = pre;
+    return count;
+}
@@ -0,0 +1,82 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Waveform.h"
+
+#define WF_HALF (WF_BINS / 2)
+#define WF_MIN_VARIANCE 0.01f   //relative to the average, limits the weight of a single very quiet bin
+#define WF_MAX_SHAPE 1.5f
+
+void WF_init(WF_Averager_t * wf, uint32_t averagingSamples, uint32_t minCount, float minAmplitude){
+    memset(wf, 0, sizeof(WF_Averager_t));
+    wf->alpha = 1.0f / (float) ((averagingSamples > 0) ? averagingSamples : 1);
+    wf->minCount = (minCount > 0) ? minCount : 1;
+    wf->minAmplitude = minAmplitude;
+}
+
+uint32_t WF_bin(unsigned rotorPos, uint32_t edgeOffset, uint32_t segmentTicks){
+    if(segmentTicks == 0 || edgeOffset >= segmentTicks) return WF_NO_BIN;
+    uint32_t bin = (uint32_t) (((uint64_t) edgeOffset * WF_HALF) / segmentTicks);
+    return rotorPos ? bin : bin + WF_HALF;
+}
+
+//a new bin averages over all of its samples until it has enough of them for the exponential average
+void WF_addSample(WF_Averager_t * wf, uint32_t bin, int32_t value){
+    if(bin >= WF_BINS) return;
+    uint32_t count = wf->count[bin];
+    if(count == 0){
+        wf->mean[bin] = (float) value;
+        wf->var[bin] = 0.0f;
+    }else{
+        float alpha = (count * wf->alpha < 1.0f) ? 1.0f / (float) (count + 1) : wf->alpha;
+        float delta = (float) value - wf->mean[bin];
+        wf->mean[bin] += alpha * delta;
+        wf->var[bin] = (1.0f - alpha) * (wf->var[bin] + alpha * delta * delta);
+    }
+    if(count < UINT32_MAX) wf->count[bin] = count + 1;
+}
+
+void WF_update(WF_Averager_t * wf){
+    float sum[2] = {0.0f, 0.0f};
+    uint32_t used[2] = {0, 0};
+    float varSum = 0.0f;
+    uint32_t varBins = 0;
+    for(uint32_t bin = 0; bin < WF_BINS; bin++){
+        if(wf->count[bin] < wf->minCount) continue;
+        varSum += wf->var[bin];
+        varBins ++;
+
+        uint32_t phase = bin % WF_HALF;
+        if(phase < WF_HALF / 4 || phase >= WF_HALF * 3 / 4) continue;
+        unsigned pos = (bin < WF_HALF) ? 1 : 0;
+        sum[pos] += wf->mean[bin];
+        used[pos] ++;
+    }
+    if(used[0] == 0 || used[1] == 0) return;
+
+    float plateau1 = sum[1] / (float) used[1];
+    float plateau0 = sum[0] / (float) used[0];
+    wf->offset = (plateau1 + plateau0) * 0.5f;
+    wf->amplitude = (plateau1 - plateau0) * 0.5f;
+    if(fabsf(wf->amplitude) < wf->minAmplitude) return;
+
+    float varAverage = (varSum > 0.0f) ? varSum / (float) varBins : 1.0f;
+    for(uint32_t bin = 0; bin < WF_BINS; bin++){
+        if(wf->count[bin] < wf->minCount){
+            wf->shape[bin] = wf->weight[bin] = wf->norm[bin] = 0.0f;
+            continue;
+        }
+
+        float shape = (wf->mean[bin] - wf->offset) / wf->amplitude;
+        if(shape > WF_MAX_SHAPE) shape = WF_MAX_SHAPE;
+        if(shape < -WF_MAX_SHAPE) shape = -WF_MAX_SHAPE;
+        float var = wf->var[bin] / varAverage;
+        if(var < WF_MIN_VARIANCE) var = WF_MIN_VARIANCE;
+
+        wf->shape[bin] = shape;
+        wf->weight[bin] = shape / var;
+        wf->norm[bin] = shape * shape / var;
+    }
+    wf->ready = 1;
+}
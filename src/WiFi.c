@@ -31,22 +31,15 @@ esp_err_t WIFI_init(){
     ESP_LOGI(TAG, "WIFI is starting");
 
     //Load configuration
-    SettingsItem* clientEnabled = CFM_getSetting("WIFI_clientEnabled");
-    unsigned mode = 0;
-    if(clientEnabled != 0){
-        mode = memcmp(clientEnabled->value, "true", strlen("true")) == 0;
-        ESP_LOGI(TAG, "WIFI_clientEnabled is \"%s\"", clientEnabled->value);
-    }
+    unsigned mode = CFM_getSettings()->WIFI_clientEnabled;
+    ESP_LOGI(TAG, "WIFI_clientEnabled is %d", mode);
 
     /*if(WIFI_inited){
         if(mode){
             wifi_config_t wifi_config = { .sta = { .threshold.authmode = WIFI_AUTH_WPA2_PSK, .pmf_cfg = { .capable = true, .required = false }, }, };
-            SettingsItem * ssid = CFM_getSetting("WIFI_ssid");
-            if(ssid == 0) return ESP_FAIL;
-            strlcpy((char*) wifi_config.sta.ssid, ssid->value, 32);
-            SettingsItem * pass = CFM_getSetting("WIFI_password");
-            if(pass == 0) return ESP_FAIL;
-            strlcpy((char*) wifi_config.sta.password, pass->value, 32);
+            if(CFM_getSettings()->WIFI_ssid[0] == 0) return ESP_FAIL;
+            strlcpy((char*) wifi_config.sta.ssid, CFM_getSettings()->WIFI_ssid, sizeof(wifi_config.sta.ssid));
+            strlcpy((char*) wifi_config.sta.password, CFM_getSettings()->WIFI_password, sizeof(wifi_config.sta.password));
             ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
             ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
         }else{
@@ -110,12 +103,10 @@ static esp_err_t WIFI_connectAP(){
 
     wifi_config_t wifi_config = { .sta = { .threshold.authmode = WIFI_AUTH_WPA2_PSK, .pmf_cfg = { .capable = true, .required = false }, }, };
 
-    SettingsItem * ssid = CFM_getSetting("WIFI_ssid");
-    if(ssid == 0) return ESP_FAIL;
-    strlcpy((char*) wifi_config.sta.ssid, ssid->value, 32);
-    SettingsItem * pass = CFM_getSetting("WIFI_password");
-    if(pass == 0) return ESP_FAIL;
-    strlcpy((char*) wifi_config.sta.password, pass->value, 32);
+    const CFM_Settings_t * settings = CFM_getSettings();
+    if(settings->WIFI_ssid[0] == 0) return ESP_FAIL;
+    strlcpy((char*) wifi_config.sta.ssid, settings->WIFI_ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char*) wifi_config.sta.password, settings->WIFI_password, sizeof(wifi_config.sta.password));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
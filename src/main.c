@@ -22,6 +22,7 @@
 #include "FieldMill.h"
 #include "WiFi.h"
 #include "ConfigManager.h"
+#include "LiveData.h"
 static const char *TAG = "FieldMill";
 
 /* Function to initialize SPIFFS */
@@ -85,4 +86,5 @@ void app_main(void)
     ESP_ERROR_CHECK(start_file_server("/spiffs"));
 
     FM_init();
+    LD_init();
 }
\ No newline at end of file
@@ -20,7 +20,9 @@
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "esp_http_server.h"
+#include "esp_crc.h"
 #include "ConfigManager.h"
+#include "AssetBundle.h"
 
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
@@ -30,8 +32,20 @@
 #define MAX_FILE_SIZE   (200*1024) // 200 KB
 #define MAX_FILE_SIZE_STR "200KB"
 
-/* Scratch buffer size */
-#define SCRATCH_BUFSIZE  8192
+/* Scratch buffer size. All handlers run on the single httpd task, so
+ * only one file is copied at a time and one buffer is enough */
+#define SCRATCH_BUFSIZE  4096
+
+/* Sockets the server keeps open. LWIP needs three more for itself and
+ * one for MQTT, keep this in line with CONFIG_LWIP_MAX_SOCKETS */
+#define SERVER_MAX_SOCKETS 12
+
+/* Web UI assets may be cached this long (in seconds) before the
+ * browser revalidates them with the ETag */
+#define ASSET_MAX_AGE_STR "86400"
+
+/* Number of assets whose ETags are kept in RAM */
+#define ASSET_CACHE_SIZE 16
 
 httpd_handle_t server = NULL;
 
@@ -45,6 +59,20 @@ struct file_server_data {
 
 static const char *TAG = "file_server";
 
+/* ETags of the web UI assets. They are computed from the file content
+ * the first time an asset is requested, after that a revalidation is
+ * answered from RAM without touching the flash. The assets only change
+ * when a new filesystem image is flashed, which also reboots. */
+typedef struct {
+    char path[FILE_PATH_MAX];
+    bool has_gzip;
+    char etag[11];
+    char gzip_etag[11];
+} asset_cache_entry_t;
+
+static asset_cache_entry_t asset_cache[ASSET_CACHE_SIZE];
+static size_t asset_cache_count = 0;
+
 static esp_err_t index_html_get_handler(httpd_req_t *req)
 {
     httpd_resp_set_status(req, "307 Temporary Redirect");
@@ -111,26 +139,122 @@ static const char* get_path_from_uri(char *dest, const char *base_path, const ch
     return dest + base_pathlen;
 }
 
-/* Handler to download a file kept on the server */
-static esp_err_t download_get_handler(httpd_req_t *req)
+/* Computes a strong ETag from the file content, returns false if the
+ * file can't be read */
+static bool compute_etag(const char *filepath, char *scratch, char *etag)
+{
+    FILE *fd = fopen(filepath, "r");
+    if (!fd) {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    size_t chunksize;
+    while ((chunksize = fread(scratch, 1, SCRATCH_BUFSIZE, fd)) > 0) {
+        crc = esp_crc32_le(crc, (const uint8_t *) scratch, chunksize);
+    }
+    fclose(fd);
+
+    sprintf(etag, "\"%08x\"", crc);
+    return true;
+}
+
+/* Returns the cache entry of an asset, the entry is created on the first
+ * request. NULL if the asset doesn't exist or the cache is full */
+static const asset_cache_entry_t *get_asset_info(const char *filepath, char *scratch)
+{
+    for (size_t i = 0; i < asset_cache_count; i++) {
+        if (strcmp(asset_cache[i].path, filepath) == 0) {
+            return &asset_cache[i];
+        }
+    }
+
+    if (asset_cache_count >= ASSET_CACHE_SIZE) {
+        return NULL;
+    }
+
+    asset_cache_entry_t *entry = &asset_cache[asset_cache_count];
+    if (!compute_etag(filepath, scratch, entry->etag)) {
+        return NULL;
+    }
+
+    char gzip_path[FILE_PATH_MAX + 3];
+    snprintf(gzip_path, sizeof(gzip_path), "%s.gz", filepath);
+    entry->has_gzip = compute_etag(gzip_path, scratch, entry->gzip_etag);
+
+    strlcpy(entry->path, filepath, sizeof(entry->path));
+    asset_cache_count++;
+    return entry;
+}
+
+/* Checks whether a comma separated request header contains the token */
+static bool header_contains(httpd_req_t *req, const char *field, const char *token)
+{
+    char value[64];
+    esp_err_t ret = httpd_req_get_hdr_value_str(req, field, value, sizeof(value));
+    if (ret != ESP_OK && ret != ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return false;
+    }
+    return strstr(value, token) != NULL;
+}
+
+/* Sends an asset out of the mapped bundle, the index already
+ * holds the content type, the ETags and the compressed variant */
+static esp_err_t send_bundled_asset(httpd_req_t *req, const AB_Asset_t *asset)
+{
+    bool gzip = asset->gzipLength > 0 && header_contains(req, "Accept-Encoding", "gzip");
+    const char *etag = gzip ? asset->gzipEtag : asset->etag;
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=" ASSET_MAX_AGE_STR);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    if (header_contains(req, "If-None-Match", etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset->mime);
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+#ifdef CONFIG_EXAMPLE_HTTPD_CONN_CLOSE_HEADER
+    httpd_resp_set_hdr(req, "Connection", "close");
+#endif
+    return httpd_resp_send(req, gzip ? asset->gzipData : asset->data, gzip ? asset->gzipLength : asset->length);
+}
+
+/* Streams a file from SPIFFS through the scratch buffer */
+static esp_err_t send_file(httpd_req_t *req, char *filepath, const char *filename, bool is_asset, char *scratch)
 {
-    char filepath[FILE_PATH_MAX];
     FILE *fd = NULL;
     struct stat file_stat;
+    const asset_cache_entry_t *asset = NULL;
+    bool gzip = false;
+    if (is_asset) {
+        asset = get_asset_info(filepath, scratch);
+    }
 
-    char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path, req->uri, sizeof(filepath));
+    if (asset) {
+        gzip = asset->has_gzip && header_contains(req, "Accept-Encoding", "gzip");
+        const char *etag = gzip ? asset->gzip_etag : asset->etag;
 
-    if (!filename) {
-        ESP_LOGE(TAG, "Filename is too long");
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
-        return ESP_FAIL;
-    }
+        httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=" ASSET_MAX_AGE_STR);
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
 
-    if(strcmp(filename, "/spiffs/") == 0){
-        free(filename);
-        filename = malloc(strlen("/spiffs/readout.html") + 1);
-        strcpy(filename, "/spiffs/readout.html");
+        if (header_contains(req, "If-None-Match", etag)) {
+            httpd_resp_set_status(req, "304 Not Modified");
+            httpd_resp_send(req, NULL, 0);
+            return ESP_OK;
+        }
+
+        if (gzip) {
+            /* The content type is still set from the original name */
+            set_content_type_from_file(req, filename);
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+            strcat(filepath, ".gz");
+        }
     }
 
     if (stat(filepath, &file_stat) == -1) {
@@ -150,11 +274,12 @@ static esp_err_t download_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
-    set_content_type_from_file(req, filename);
+    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
+    if (!gzip) {
+        set_content_type_from_file(req, filename);
+    }
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    char *chunk = ((struct file_server_data *)req->user_ctx)->scratch;
+    char *chunk = scratch;
     size_t chunksize;
     do {
         /* Read file in chunks into the scratch buffer */
@@ -188,6 +313,39 @@ static esp_err_t download_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Handler to download a file kept on the server */
+static esp_err_t download_get_handler(httpd_req_t *req)
+{
+    char filepath[FILE_PATH_MAX + 3];
+    struct file_server_data *server_data = (struct file_server_data *)req->user_ctx;
+
+    char *filename = get_path_from_uri(filepath, server_data->base_path, req->uri, FILE_PATH_MAX);
+
+    if (!filename) {
+        ESP_LOGE(TAG, "Filename is too long");
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+
+    if(strcmp(filename, "/spiffs/") == 0){
+        free(filename);
+        filename = malloc(strlen("/spiffs/readout.html") + 1);
+        strcpy(filename, "/spiffs/readout.html");
+    }
+
+    /* Only the web UI is cached, the json files are changed at runtime */
+    bool is_asset = strstr(req->uri, "/webUI/") == req->uri && !IS_FILE_EXT(filename, ".json");
+
+    /* Assets in the mapped bundle are sent straight from flash */
+    AB_Asset_t bundled;
+    if (is_asset && AB_find(filename, strlen(filename), &bundled)) {
+        return send_bundled_asset(req, &bundled);
+    }
+
+    return send_file(req, filepath, filename, is_asset, server_data->scratch);
+}
+
 /* Function to start the file server */
 esp_err_t start_file_server(const char *base_path)
 {
@@ -207,6 +365,9 @@ esp_err_t start_file_server(const char *base_path)
     strlcpy(server_data->base_path, base_path,
             sizeof(server_data->base_path));
 
+    /* Without a valid bundle every asset is read from SPIFFS */
+    AB_init();
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
     /* Use the URI wildcard matching function in order to
@@ -214,6 +375,22 @@ esp_err_t start_file_server(const char *base_path)
      * target URIs which match the wildcard scheme */
     config.uri_match_fn = httpd_uri_match_wildcard;
 
+    /* The measurement, live data and capture modules register
+     * their own handlers on this server as well */
+    config.max_uri_handlers = 24;
+
+    /* Several dashboards and websocket clients stay connected at the
+     * same time. When all sockets are taken the least recently used one
+     * is closed instead of refusing the new client. httpd only counts
+     * received data as use, so /live clients send a keepalive (see
+     * LiveData.h) and the idle keep-alive sockets of page loads go first */
+    config.max_open_sockets = SERVER_MAX_SOCKETS;
+    config.lru_purge_enable = true;
+
+    /* A stalled client must not hold up everyone else for long */
+    config.send_wait_timeout = 3;
+    config.recv_wait_timeout = 3;
+
     ESP_LOGI(TAG, "Starting HTTP Server");
     if (httpd_start(&server, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start file server!");
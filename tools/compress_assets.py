@@ -0,0 +1,33 @@
+# PlatformIO extra script: gzips the web UI assets in data/ before the filesystem image is built.
+# The file server sends <file>.gz with Content-Encoding: gzip to every client that accepts it, the uncompressed files
+# stay in the image for clients that don't. Runtime files (settings.json, cal.json) are rewritten by the firmware and are
+# never compressed.
+
+import gzip
+import os
+
+Import("env")
+
+COMPRESSED_TYPES = (".html", ".js", ".css", ".svg", ".ico")
+
+
+def compress_assets(source, target, env):
+    data_dir = env.subst("$PROJECT_DATA_DIR")
+    for name in sorted(os.listdir(data_dir)):
+        path = os.path.join(data_dir, name)
+        if not name.endswith(COMPRESSED_TYPES) or not os.path.isfile(path):
+            continue
+
+        with open(path, "rb") as f:
+            content = f.read()
+        # mtime=0 keeps the output identical between builds, so the ETag only changes if the asset does
+        compressed = gzip.compress(content, compresslevel=9, mtime=0)
+        if len(compressed) >= len(content):
+            continue
+
+        with open(path + ".gz", "wb") as f:
+            f.write(compressed)
+        print("compressed %s: %d -> %d bytes" % (name, len(content), len(compressed)))
+
+
+env.AddPreAction("$BUILD_DIR/spiffs.bin", compress_assets)
@@ -0,0 +1,183 @@
+# Load test for the web server: a number of simulated dashboards open the readout page at the same time, then keep
+# polling the measurement, reading the history and listening on the live data websocket.
+#
+#   python tools/loadtest.py http://192.168.4.1 --clients 8 --duration 30
+#
+# Every dashboard uses one keep-alive connection for the page and the polling like a browser does, revalidates the
+# assets with their ETags on reload and optionally holds a websocket open. At the end the latency percentiles and the
+# status codes are printed per endpoint. Only the standard library is used.
+
+import argparse
+import base64
+import collections
+import http.client
+import os
+import socket
+import struct
+import threading
+import time
+import urllib.parse
+
+PAGE = "/webUI/readout.html"
+ASSETS = ["/webUI/styles.css", "/webUI/gauge.js", "/webUI/live.js"]
+KEEPALIVE = 10.0  # s, LD_KEEPALIVE_MS
+POLL = "/measure.json"
+HISTORY = "/history?tier=0"
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latency = collections.defaultdict(list)
+        self.status = collections.defaultdict(collections.Counter)
+        self.ws_messages = 0
+        self.ws_failures = 0
+
+    def add(self, name, status, seconds):
+        with self.lock:
+            self.status[name][status] += 1
+            if seconds is not None:
+                self.latency[name].append(seconds)
+
+    def report(self, duration):
+        print("%-22s %7s %8s %8s %8s  %s" % ("endpoint", "count", "p50 ms", "p95 ms", "max ms", "status"))
+        for name in sorted(self.status):
+            times = sorted(self.latency[name])
+            count = sum(self.status[name].values())
+            if times:
+                p50 = times[len(times) // 2] * 1000
+                p95 = times[min(len(times) - 1, int(len(times) * 0.95))] * 1000
+                worst = times[-1] * 1000
+            else:
+                p50 = p95 = worst = 0
+            codes = " ".join("%s:%d" % (code, n) for code, n in sorted(self.status[name].items(), key=str))
+            print("%-22s %7d %8.1f %8.1f %8.1f  %s" % (name, count, p50, p95, worst, codes))
+        print("websocket: %d messages (%.1f/s), %d failed connections" %
+              (self.ws_messages, self.ws_messages / duration, self.ws_failures))
+
+
+def request(conn, stats, name, path, headers=None):
+    start = time.monotonic()
+    try:
+        conn.request("GET", path, headers=headers or {})
+        response = conn.getresponse()
+        response.read()
+    except (OSError, http.client.HTTPException) as e:
+        stats.add(name, type(e).__name__, None)
+        conn.close()
+        return None
+    stats.add(name, response.status, time.monotonic() - start)
+    return response
+
+
+def dashboard(host, port, args, stats, stop):
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    etags = {}
+    headers = {"Accept-Encoding": "gzip"}
+
+    # first load and one reload that should be answered with 304
+    for _ in range(2):
+        for path in [PAGE] + ASSETS:
+            h = dict(headers)
+            if path in etags:
+                h["If-None-Match"] = etags[path]
+            response = request(conn, stats, path.rsplit("/", 1)[1], path, h)
+            if response is not None and response.getheader("ETag"):
+                etags[path] = response.getheader("ETag")
+
+    next_history = 0
+    while not stop.is_set():
+        request(conn, stats, "measure.json", POLL)
+        if time.monotonic() >= next_history:
+            request(conn, stats, "history", HISTORY)
+            next_history = time.monotonic() + args.history_period
+        stop.wait(args.poll_period)
+    conn.close()
+
+
+def websocket(host, port, args, stats, stop):
+    try:
+        sock = socket.create_connection((host, port), timeout=10)
+        key = base64.b64encode(os.urandom(16)).decode()
+        sock.sendall(("GET /live HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (host, key)).encode())
+        handshake = b""
+        while b"\r\n\r\n" not in handshake:
+            chunk = sock.recv(1024)
+            if not chunk:
+                raise OSError("connection closed during the handshake")
+            handshake += chunk
+        if b" 101 " not in handshake.split(b"\r\n", 1)[0]:
+            raise OSError("upgrade refused")
+        buffer = handshake.split(b"\r\n\r\n", 1)[1]
+
+        # clients have to mask their frames
+        payload = str(int(args.live_period * 1000)).encode()
+        mask = os.urandom(4)
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        sock.sendall(struct.pack("BB", 0x81, 0x80 | len(payload)) + mask + masked)
+
+        # an empty frame keeps the socket from being the least recently used one, like live.js does
+        keepalive = time.time() + KEEPALIVE
+        sock.settimeout(0.5)
+        while not stop.is_set():
+            if time.time() >= keepalive:
+                sock.sendall(struct.pack("BB", 0x81, 0x80) + os.urandom(4))
+                keepalive += KEEPALIVE
+            try:
+                chunk = sock.recv(4096)
+            except socket.timeout:
+                continue
+            if not chunk:
+                raise OSError("connection closed")
+            buffer += chunk
+            # the server only sends short unmasked text frames
+            while len(buffer) >= 2 and len(buffer) >= 2 + (buffer[1] & 0x7F):
+                length = buffer[1] & 0x7F
+                buffer = buffer[2 + length:]
+                with stats.lock:
+                    stats.ws_messages += 1
+        sock.close()
+    except OSError:
+        with stats.lock:
+            stats.ws_failures += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test for the field mill web server")
+    parser.add_argument("url", help="base URL of the device, e.g. http://192.168.4.1")
+    parser.add_argument("--clients", type=int, default=6, help="simultaneous dashboards")
+    parser.add_argument("--duration", type=float, default=30, help="seconds to run after the pages are loaded")
+    parser.add_argument("--poll-period", type=float, default=0.5, help="seconds between /measure.json requests")
+    parser.add_argument("--history-period", type=float, default=5, help="seconds between /history requests")
+    parser.add_argument("--live-period", type=float, default=0.1, help="requested websocket update period in seconds")
+    parser.add_argument("--no-websocket", action="store_true", help="don't open the live data websocket")
+    args = parser.parse_args()
+
+    url = urllib.parse.urlsplit(args.url)
+    host, port = url.hostname, url.port or 80
+
+    stats = Stats()
+    stop = threading.Event()
+    threads = []
+    for _ in range(args.clients):
+        threads.append(threading.Thread(target=dashboard, args=(host, port, args, stats, stop)))
+        if not args.no_websocket:
+            threads.append(threading.Thread(target=websocket, args=(host, port, args, stats, stop)))
+    for thread in threads:
+        thread.start()
+
+    start = time.monotonic()
+    try:
+        time.sleep(args.duration)
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+    for thread in threads:
+        thread.join()
+
+    stats.report(time.monotonic() - start)
+
+
+if __name__ == "__main__":
+    main()
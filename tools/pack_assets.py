@@ -0,0 +1,139 @@
+# Packs the static web UI in data/ into the asset bundle that the file server maps from the "assets" partition.
+#
+# standalone:  python tools/pack_assets.py data assets.bin
+# PlatformIO:  pio run -t buildassets / pio run -t uploadassets
+#
+# Layout, all little endian, offsets are from the start of the bundle (see include/AssetBundle.h):
+#   header  magic "FMAB", u16 version, u16 count, u32 length of the bundle, u32 crc32 of everything after the header
+#   index   count entries sorted by path hash:
+#           u32 hash, u32 pathOffset, u16 pathLength, u8 mime, u8 reserved,
+#           u32 offset, u32 length, u32 crc32, u32 gzipOffset, u32 gzipLength, u32 gzipCrc32
+#   data    paths and file contents, 4 byte aligned. gzipLength is 0 if compressing didn't help
+#
+# Runtime files (*.json) are left out, the firmware keeps writing those to SPIFFS.
+
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x42414D46  # "FMAB"
+VERSION = 1
+HEADER = struct.Struct("<IHHII")
+ENTRY = struct.Struct("<IIHBBIIIIII")
+
+# has to match AB_mimeTypes in src/AssetBundle.c
+MIME_TYPES = {
+    ".html": 1,
+    ".css": 2,
+    ".js": 3,
+    ".ico": 4,
+    ".jpeg": 5,
+    ".jpg": 5,
+    ".pdf": 6,
+    ".svg": 7,
+    ".png": 8,
+}
+SKIPPED = (".json", ".gz")
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h ^= b
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def align(blob):
+    blob.extend(b"\0" * (-len(blob) % 4))
+
+
+def pack(data_dir):
+    files = []
+    for name in sorted(os.listdir(data_dir)):
+        path = os.path.join(data_dir, name)
+        if not os.path.isfile(path) or name.endswith(SKIPPED):
+            continue
+        with open(path, "rb") as f:
+            content = f.read()
+        mime = MIME_TYPES.get(os.path.splitext(name)[1].lower(), 0)
+        compressed = gzip.compress(content, compresslevel=9, mtime=0)
+        if len(compressed) >= len(content):
+            compressed = b""
+        files.append((("/" + name).encode(), mime, content, compressed))
+
+    files.sort(key=lambda f: fnv1a(f[0]))
+    hashes = [fnv1a(f[0]) for f in files]
+    if len(set(hashes)) != len(hashes):
+        raise SystemExit("asset path hash collision, rename one of the files")
+
+    data_start = HEADER.size + ENTRY.size * len(files)
+    blob = bytearray()
+    entries = []
+    for (path, mime, content, compressed), h in zip(files, hashes):
+        path_offset = data_start + len(blob)
+        blob.extend(path)
+        align(blob)
+        offset = data_start + len(blob)
+        blob.extend(content)
+        align(blob)
+        gzip_offset = data_start + len(blob) if compressed else 0
+        blob.extend(compressed)
+        align(blob)
+        entries.append(ENTRY.pack(h, path_offset, len(path), mime, 0,
+                                  offset, len(content), zlib.crc32(content),
+                                  gzip_offset, len(compressed), zlib.crc32(compressed) if compressed else 0))
+        print("  %-20s %6d bytes, gzip %6d bytes" % (path.decode(), len(content), len(compressed)))
+
+    body = b"".join(entries) + bytes(blob)
+    return HEADER.pack(MAGIC, VERSION, len(files), HEADER.size + len(body), zlib.crc32(body)) + body
+
+
+def partition_offset(csv_path, name):
+    with open(csv_path) as f:
+        for line in f:
+            fields = [field.strip() for field in line.split("#")[0].split(",")]
+            if len(fields) >= 5 and fields[0] == name:
+                return fields[3]
+    raise SystemExit("partition %s not found in %s" % (name, csv_path))
+
+
+def write_bundle(data_dir, output):
+    bundle = pack(data_dir)
+    with open(output, "wb") as f:
+        f.write(bundle)
+    print("asset bundle: %d bytes -> %s" % (len(bundle), output))
+
+
+# Import only exists when the file is loaded by PlatformIO as an extra script
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is None:
+    if len(sys.argv) != 3:
+        raise SystemExit("usage: pack_assets.py <data dir> <output file>")
+    write_bundle(sys.argv[1], sys.argv[2])
+else:
+    bundle_path = os.path.join(env.subst("$BUILD_DIR"), "assets.bin")
+    offset = partition_offset(os.path.join(env.subst("$PROJECT_DIR"), "partitions.csv"), "assets")
+
+    env.AddCustomTarget(
+        name="buildassets",
+        dependencies=None,
+        actions=[lambda target, source, env: write_bundle(env.subst("$PROJECT_DATA_DIR"), bundle_path)],
+        title="Build asset bundle",
+        description="Pack data/ into the asset bundle image")
+
+    env.AddCustomTarget(
+        name="uploadassets",
+        dependencies=None,
+        actions=[
+            lambda target, source, env: write_bundle(env.subst("$PROJECT_DATA_DIR"), bundle_path),
+            '"$PYTHONEXE" "$UPLOADER" --chip esp32 --port "$UPLOAD_PORT" write_flash %s "%s"' % (offset, bundle_path),
+        ],
+        title="Upload asset bundle",
+        description="Pack data/ and write it to the assets partition")